@@ -0,0 +1,363 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QThread>
+#include <QDeadlineTimer>
+#include <QFile>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "../src/dbuspropertycache_p.h"
+#include "dbusadaptorutilities.h"
+#include "dbustrace.h"
+#include "testbus.h"
+#include "testservice.h"
+#include "loadservice.h"
+
+// Run with e.g. `-o results.xml,xml` or `-o results.csv,csv` for machine-readable output, or use the run_benchmarks
+// build target. With a library built with DBUSWRAPPER_TRACING, setting DBUSWRAPPER_TRACE_FILE writes a Chrome trace
+// of the whole run to that file.
+
+static const QString benchService = QStringLiteral("bench.service");
+static const QString benchPath = QStringLiteral("/bench/service");
+static const QString benchInterface = QStringLiteral("bench.service");
+
+static QString propertyName(int i)
+{
+    return QStringLiteral("property%1").arg(i);
+}
+
+// Serves any number of integer properties from a PropertyStore
+class BenchService : public QObject
+{
+    Q_OBJECT
+
+public:
+    QDBusConnection m_bus;
+    DBusWrapper::PropertyStore store;
+    int value = 0;
+
+    BenchService(const QDBusConnection& bus, QObject* parent = nullptr)
+        : QObject(parent), m_bus(bus), store(bus, benchPath, benchInterface)
+    {
+        m_bus.registerService(benchService);
+    }
+    ~BenchService() {
+        m_bus.unregisterService(benchService);
+    }
+
+    void setPropertyCount(int count)
+    {
+        QVariantMap values;
+        for (int i = 0; i < count; i++)
+            values.insert(propertyName(i), value);
+        store.setValues(values);
+        store.emitter().flush();
+    }
+
+    // Sends one PropertiesChanged signal for each of count changes to property0
+    void emitChanges(int count)
+    {
+        for (int i = 0; i < count; i++) {
+            store.setValue(propertyName(0), ++value);
+            store.emitter().flush();
+        }
+    }
+
+    // Changes all of the first count properties in a single signal
+    void changeAll(int count)
+    {
+        value++;
+        QVariantMap values;
+        for (int i = 0; i < count; i++)
+            values.insert(propertyName(i), value);
+        store.setValues(values);
+        store.emitter().flush();
+    }
+};
+
+// Processes events until pred returns true, or fails after a timeout
+template<typename Pred> static bool waitFor(Pred pred, int timeout = 10000)
+{
+    QDeadlineTimer deadline(timeout);
+    while (!pred()) {
+        if (deadline.hasExpired())
+            return false;
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return true;
+}
+
+// Resident set size of the process in bytes, or 0 if it isn't known
+static qint64 residentSize()
+{
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    // The second field is the resident size in pages
+    return fields.size() > 1 ? fields[1].toLongLong() * 4096 : 0;
+}
+
+class BenchPropertyCache : public QObject
+{
+    Q_OBJECT
+
+    std::unique_ptr<DBusTest::TestBus> dbus;
+    std::unique_ptr<DBusTest::TestService<BenchService>> service;
+
+    DBusWrapper::Target target() const
+    {
+        return DBusWrapper::Target(dbus->client(), benchService, benchPath, benchInterface);
+    }
+
+    void setPropertyCount(int count)
+    {
+        service->sync([count](auto s) { s->setPropertyCount(count); });
+    }
+
+private slots:
+    void initTestCase()
+    {
+        if (qEnvironmentVariableIsSet("DBUSWRAPPER_TRACE_FILE"))
+            DBusWrapper::Trace::start(1 << 20);
+    }
+
+    void cleanupTestCase()
+    {
+        if (!DBusWrapper::Trace::isRecording())
+            return;
+        DBusWrapper::Trace::stop();
+        QVERIFY(DBusWrapper::Trace::saveChromeTrace(qEnvironmentVariable("DBUSWRAPPER_TRACE_FILE")));
+    }
+
+    void init()
+    {
+        dbus = std::make_unique<DBusTest::TestBus>();
+        QVERIFY(dbus->isValid());
+        service = std::make_unique<DBusTest::TestService<BenchService>>(*dbus);
+    }
+
+    void cleanup()
+    {
+        service.reset();
+        auto bus = std::move(dbus);
+        DBusWrapper::PropertyCacheBackend::test_clearCache();
+        QVERIFY(waitFor([] { return DBusWrapper::PropertyCacheBackend::test_backendsEmpty(); }));
+        QVERIFY(bus->waitForAllDisconnected());
+    }
+
+    void propertyCount_data()
+    {
+        QTest::addColumn<int>("properties");
+        QTest::newRow("10") << 10;
+        QTest::newRow("100") << 100;
+        QTest::newRow("1000") << 1000;
+    }
+
+    // Constructing a cache for a target that isn't loaded anywhere, until it's available
+    void coldInitialization_data() { propertyCount_data(); }
+    void coldInitialization()
+    {
+        QFETCH(int, properties);
+        setPropertyCount(properties);
+        QBENCHMARK {
+            DBusWrapper::PropertyCacheBackend::test_clearCache();
+            DBusWrapper::PropertyCache cache(target());
+            QVERIFY(waitFor([&] { return cache.isAvailable(); }));
+        }
+    }
+
+    // Constructing a cache for a target that's already loaded, until it initializes on the next event loop iteration
+    void warmInitialization_data() { propertyCount_data(); }
+    void warmInitialization()
+    {
+        QFETCH(int, properties);
+        setPropertyCount(properties);
+        DBusWrapper::PropertyCache shared(target());
+        QVERIFY(waitFor([&] { return shared.isAvailable(); }));
+        QBENCHMARK {
+            DBusWrapper::PropertyCache cache(target());
+            QSignalSpy spyReady(&cache, &DBusWrapper::PropertyCache::ready);
+            QVERIFY(waitFor([&] { return spyReady.count() > 0; }));
+        }
+    }
+
+    // Constructing a cache and initializing it immediately from the shared data
+    void immediateInitialization_data() { propertyCount_data(); }
+    void immediateInitialization()
+    {
+        QFETCH(int, properties);
+        setPropertyCount(properties);
+        DBusWrapper::PropertyCache shared(target());
+        QVERIFY(waitFor([&] { return shared.isAvailable(); }));
+        QBENCHMARK {
+            DBusWrapper::PropertyCache cache(target());
+            QVERIFY(cache.initialize());
+        }
+    }
+
+    // Receiving 1000 PropertiesChanged signals; divide 1000 by the result for signals per second
+    void changeThroughput()
+    {
+        const int changes = 1000;
+        setPropertyCount(10);
+        DBusWrapper::PropertyCache cache(target());
+        QVERIFY(waitFor([&] { return cache.isAvailable(); }));
+        QBENCHMARK {
+            int last = 0;
+            service->sync([&](auto s) { last = s->value + changes; });
+            service->invoke([changes](auto s) { s->emitChanges(changes); });
+            QVERIFY(waitFor([&] { return cache.get<int>(propertyName(0)) == last; }));
+        }
+    }
+
+    // Delivering one signal changing every property to caches on several threads
+    void fanOut_data()
+    {
+        QTest::addColumn<int>("threads");
+        QTest::addColumn<int>("properties");
+        for (int threads : {1, 2, 4, 8}) {
+            for (int properties : {10, 100}) {
+                QTest::addRow("%d threads, %d properties", threads, properties) << threads << properties;
+            }
+        }
+    }
+    void fanOut()
+    {
+        QFETCH(int, threads);
+        QFETCH(int, properties);
+        setPropertyCount(properties);
+
+        std::atomic<int> received{0};
+        std::vector<std::unique_ptr<QThread>> workers;
+        std::vector<std::unique_ptr<QObject>> contexts;
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(std::make_unique<QThread>());
+            workers.back()->start();
+            contexts.push_back(std::make_unique<QObject>());
+            contexts.back()->moveToThread(workers.back().get());
+            // Each thread has its own cache, which is destroyed with the context object on that thread
+            const DBusWrapper::Target t = target();
+            QMetaObject::invokeMethod(contexts.back().get(), [&received, t, context = contexts.back().get()] {
+                auto cache = new DBusWrapper::PropertyCache(t, context);
+                QObject::connect(cache, &DBusWrapper::PropertyCache::propertyChanged, [&received] { received++; });
+            }, Qt::BlockingQueuedConnection);
+        }
+        // Initial values are signalled as changes too
+        QVERIFY(waitFor([&] { return received == threads * properties; }));
+
+        QBENCHMARK {
+            received = 0;
+            service->invoke([properties](auto s) { s->changeAll(properties); });
+            QVERIFY(waitFor([&] { return received == threads * properties; }));
+        }
+
+        for (int i = 0; i < threads; i++) {
+            QObject* context = contexts[i].release();
+            QMetaObject::invokeMethod(context, [context] { delete context; }, Qt::BlockingQueuedConnection);
+            workers[i]->quit();
+            workers[i]->wait();
+        }
+    }
+
+    // Reloading every object of a service after it restarts
+    void restartStorm_data()
+    {
+        QTest::addColumn<int>("paths");
+        QTest::newRow("50") << 50;
+        QTest::newRow("500") << 500;
+    }
+    void restartStorm()
+    {
+        QFETCH(int, paths);
+        DBusTest::LoadService::Profile profile;
+        profile.paths = paths;
+        profile.properties = 20;
+        DBusTest::TestService<DBusTest::LoadService> load(*dbus, [=](auto bus) {
+            return new DBusTest::LoadService(bus, profile);
+        });
+
+        int ready = 0;
+        std::vector<std::unique_ptr<DBusWrapper::PropertyCache>> caches;
+        for (int i = 0; i < paths; i++) {
+            caches.push_back(std::make_unique<DBusWrapper::PropertyCache>(
+                DBusWrapper::Target(dbus->client(), profile.service, QStringLiteral("/load/%1").arg(i), profile.interface)));
+            connect(caches.back().get(), &DBusWrapper::PropertyCache::ready, [&ready] { ready++; });
+        }
+        QVERIFY(waitFor([&] { return ready == paths; }));
+
+        QBENCHMARK {
+            ready = 0;
+            load.invoke([](auto s) { s->restart(); });
+            QVERIFY(waitFor([&] { return ready == paths; }));
+        }
+    }
+
+    // Memory used by caches for many targets of one interface, reported as bytes of resident memory
+    void manyTargets_data()
+    {
+        QTest::addColumn<int>("paths");
+        QTest::newRow("1000") << 1000;
+        QTest::newRow("5000") << 5000;
+    }
+    void manyTargets()
+    {
+        QFETCH(int, paths);
+        DBusTest::LoadService::Profile profile;
+        profile.paths = paths;
+        profile.properties = 20;
+        DBusTest::TestService<DBusTest::LoadService> load(*dbus, [=](auto bus) {
+            return new DBusTest::LoadService(bus, profile);
+        });
+
+        const qint64 before = residentSize();
+        if (!before)
+            QSKIP("resident memory isn't available on this platform");
+        int ready = 0;
+        std::vector<std::unique_ptr<DBusWrapper::PropertyCache>> caches;
+        for (int i = 0; i < paths; i++) {
+            caches.push_back(std::make_unique<DBusWrapper::PropertyCache>(
+                DBusWrapper::Target(dbus->client(), profile.service, QStringLiteral("/load/%1").arg(i), profile.interface)));
+            connect(caches.back().get(), &DBusWrapper::PropertyCache::ready, [&ready] { ready++; });
+        }
+        QVERIFY(waitFor([&] { return ready == paths; }, 60000));
+        QTest::setBenchmarkResult(qreal(residentSize() - before), QTest::BytesAllocated);
+    }
+
+    // Looking up every property by handle
+    void getByHandle_data() { propertyCount_data(); }
+    void getByHandle()
+    {
+        QFETCH(int, properties);
+        setPropertyCount(properties);
+        DBusWrapper::PropertyCache cache(target());
+        QVERIFY(waitFor([&] { return cache.isAvailable(); }));
+        QVector<DBusWrapper::PropertyHandle> handles;
+        for (int i = 0; i < properties; i++)
+            handles.append(DBusWrapper::PropertyCache::handle(propertyName(i)));
+        QBENCHMARK {
+            for (auto handle : qAsConst(handles))
+                QVERIFY(cache.get(handle).isValid());
+        }
+    }
+
+    // Looking up every property by name
+    void getByName_data() { propertyCount_data(); }
+    void getByName()
+    {
+        QFETCH(int, properties);
+        setPropertyCount(properties);
+        DBusWrapper::PropertyCache cache(target());
+        QVERIFY(waitFor([&] { return cache.isAvailable(); }));
+        QStringList names;
+        for (int i = 0; i < properties; i++)
+            names.append(propertyName(i));
+        QBENCHMARK {
+            for (const auto& name : qAsConst(names))
+                QVERIFY(cache.get(name).isValid());
+        }
+    }
+};
+
+QTEST_MAIN(BenchPropertyCache)
+#include "bench_propertycache.moc"
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QVariant>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QSet>
+#include <QHash>
 #include <QDBusConnection>
+#include <QDBusVirtualObject>
 
 namespace DBusWrapper {
 
@@ -11,5 +19,108 @@ void emitPropertiesChanged(const QString& path, const QString& interface, const
 
 void emitPropertiesChanged(const QDBusConnection& bus, const QString& path, const QString& interface, const QString& property, const QVariant& value);
 void emitPropertiesChanged(const QDBusConnection& bus, const QString& path, const QString& interface, const QVariantMap& changed_properties);
+void emitPropertiesChanged(const QDBusConnection& bus, const QString& path, const QString& interface, const QVariantMap& changed_properties,
+                           const QStringList& invalidated_properties);
+
+/*!
+   \brief Collects property changes of one object and emits them as a single PropertiesChanged signal.
+
+   \sa emitPropertiesChanged()
+ */
+class PropertiesChangedEmitter : public QObject
+{
+    Q_OBJECT
+
+public:
+    PropertiesChangedEmitter(const QDBusConnection& bus, const QString& path, const QString& interface,
+                             QObject* parent = nullptr);
+    ~PropertiesChangedEmitter();
+
+    const QString& path() const { return m_path; }
+    const QString& interface() const { return m_interface; }
+
+    int interval() const { return m_interval; }
+    void setInterval(int msec);
+
+    void change(const QString& property, const QVariant& value);
+    void change(const QVariantMap& properties);
+    void invalidate(const QString& property);
+
+    bool hasPendingChanges() const { return !m_changed.isEmpty() || !m_invalidated.isEmpty(); }
+
+public slots:
+    void flush();
+
+private:
+    QDBusConnection m_bus;
+    const QString m_path;
+    const QString m_interface;
+    int m_interval = 0;
+    QVariantMap m_changed;
+    QStringList m_invalidated;
+    QTimer m_flushTimer;
+    QElapsedTimer m_lastFlush;
+
+    void scheduleFlush();
+};
+
+/*!
+   \brief Owns the property values of one DBus interface and answers Get, GetAll, and Set from memory.
+
+   \sa PropertiesChangedEmitter
+ */
+class PropertyStore : public QDBusVirtualObject
+{
+    Q_OBJECT
+
+public:
+    PropertyStore(const QDBusConnection& bus, const QString& path, const QString& interface, QObject* parent = nullptr);
+    ~PropertyStore();
+
+    const QString& path() const { return m_emitter.path(); }
+    const QString& interface() const { return m_emitter.interface(); }
+    bool isRegistered() const { return m_registered; }
+
+    QVariant value(const QString& property) const;
+    QVariantMap values() const;
+    void setValue(const QString& property, const QVariant& value);
+    void setValues(const QVariantMap& values);
+    void removeValue(const QString& property);
+    void setWritable(const QString& property, bool writable);
+
+    PropertiesChangedEmitter& emitter() { return m_emitter; }
+
+    // For tests: the number of times the GetAll reply has been marshalled
+    int test_getAllMarshalCount() const;
+
+    QString introspect(const QString& path) const override;
+    bool handleMessage(const QDBusMessage& message, const QDBusConnection& connection) override;
+
+signals:
+    // Emitted after a client changed the value of a writable property
+    void valueWritten(const QString& property, const QVariant& value);
+
+private:
+    QDBusConnection m_bus;
+    PropertiesChangedEmitter m_emitter;
+    bool m_registered = false;
+
+    // Values and writable properties are also read from the DBus thread; must hold m_mutex to access
+    mutable QMutex m_mutex;
+    QVariantMap m_values;
+    QSet<QString> m_writable;
+    // Introspection data, rebuilt only when the set of properties or their types change
+    mutable QString m_introspection;
+    // The a{sv} argument of GetAll replies, marshalled once after the values change and shared by every reply
+    mutable QVariant m_getAllReply;
+    mutable int m_getAllMarshalCount = 0;
+    // Incremented for every change, to tell whether a value written by a client has been replaced since
+    quint64 m_revision = 0;
+    QHash<QString, quint64> m_revisions;
+
+    bool storeValue(const QString& property, const QVariant& value);
+    QVariant getAllReply() const;
+    QDBusMessage handleSet(const QDBusMessage& message, const QString& property, const QVariant& value);
+};
 
 } // namepsace DBusWrapper
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "dbuspropertycache.h"
+#include "dbuspendingcall.h"
+
+// Optional C++20 coroutine support. Everything in this header is only available when the including code is built
+// with coroutines enabled; the library itself doesn't require them.
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <array>
+#include <coroutine>
+#include <tuple>
+#include <utility>
+
+namespace DBusWrapper {
+
+/*!
+  \brief Awaitable returned by \l{untilReady()}.
+ */
+struct CacheReady
+{
+    PropertyCache* cache;
+};
+
+namespace Detail {
+
+using Connections = std::array<QMetaObject::Connection, 2>;
+
+inline void disconnectAll(Connections& connections)
+{
+    for (auto& connection : connections) {
+        if (connection)
+            QObject::disconnect(connection);
+    }
+}
+
+// Adapts each type that can be awaited: whether it's done, how to be notified once when it's done, and its result.
+// Notifications are connected directly to objects on the thread that awaits, so coroutines resume on that thread.
+template<typename T> struct Waitable;
+
+template<> struct Waitable<QSharedPointer<PendingSet>>
+{
+    using Value = QSharedPointer<PendingSet>;
+    static bool isDone(const Value& set) { return !set || set->isFinished(); }
+    // The functor holds a reference to the result, so it isn't destroyed while it's signalling
+    template<typename Functor> static void connect(const Value& set, Functor functor, Connections& connections)
+    {
+        connections[0] = QObject::connect(set.get(), &PendingSet::finished, set.get(), [set, functor]() { functor(); });
+    }
+    static QDBusError result(const Value& set) { return set ? set->error() : QDBusError(); }
+};
+
+template<typename R> struct Waitable<PendingReply<R>>
+{
+    using Value = PendingReply<R>;
+    static bool isDone(const Value& reply) { return !reply.isValid() || reply.isFinished(); }
+    template<typename Functor> static void connect(const Value& reply, Functor functor, Connections& connections)
+    {
+        connections[0] = QObject::connect(reply.call(), &PendingCall::finished, reply.call(),
+                                          [reply, functor]() { functor(); });
+    }
+    static Value result(const Value& reply) { return reply; }
+};
+
+template<> struct Waitable<CacheReady>
+{
+    using Value = CacheReady;
+    static bool isDone(const Value& wait) { return wait.cache->initialize(); }
+    template<typename Functor> static void connect(const Value& wait, Functor functor, Connections& connections)
+    {
+        connections[0] = QObject::connect(wait.cache, &PropertyCache::ready, wait.cache, functor);
+        connections[1] = QObject::connect(wait.cache, &PropertyCache::errorChanged, wait.cache,
+                                          [functor](const QDBusError& error) {
+            if (error.isValid())
+                functor();
+        });
+    }
+    static bool result(const Value& wait) { return wait.cache->isAvailable(); }
+};
+
+// Awaiters live in the coroutine frame and are never copied, so waiting needs no shared state beyond the signal
+// connections. Destroying a suspended coroutine disconnects them.
+template<typename T> class Awaiter
+{
+public:
+    explicit Awaiter(T value) : m_value(std::move(value)) {}
+    Awaiter(const Awaiter&) = delete;
+    Awaiter& operator=(const Awaiter&) = delete;
+    ~Awaiter() { disconnectAll(m_connections); }
+
+    bool await_ready() const { return Waitable<T>::isDone(m_value); }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        Waitable<T>::connect(m_value, [this, handle]() {
+            disconnectAll(m_connections);
+            handle.resume();
+        }, m_connections);
+    }
+    auto await_resume() const { return Waitable<T>::result(m_value); }
+
+private:
+    T m_value;
+    Connections m_connections;
+};
+
+template<typename... Ts> class WhenAllAwaiter
+{
+public:
+    explicit WhenAllAwaiter(Ts... values) : m_values(std::move(values)...) {}
+    WhenAllAwaiter(const WhenAllAwaiter&) = delete;
+    WhenAllAwaiter& operator=(const WhenAllAwaiter&) = delete;
+    ~WhenAllAwaiter()
+    {
+        for (auto& connections : m_connections)
+            disconnectAll(connections);
+    }
+
+    bool await_ready() const
+    {
+        return std::apply([](const auto&... values) { return (isDone(values) && ...); }, m_values);
+    }
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        m_handle = handle;
+        connectAll(std::index_sequence_for<Ts...>());
+        return m_remaining > 0;
+    }
+    std::tuple<decltype(Waitable<Ts>::result(std::declval<const Ts&>()))...> await_resume() const
+    {
+        return std::apply([](const auto&... values) {
+            return std::make_tuple(Waitable<std::decay_t<decltype(values)>>::result(values)...);
+        }, m_values);
+    }
+
+private:
+    template<typename T> static bool isDone(const T& value) { return Waitable<T>::isDone(value); }
+
+    template<std::size_t... Is> void connectAll(std::index_sequence<Is...>)
+    {
+        // Count everything first, so that nothing resumes until every wait is connected
+        m_remaining = 0;
+        ((m_remaining += isDone(std::get<Is>(m_values)) ? 0 : 1), ...);
+        (connectOne<Is>(), ...);
+    }
+    template<std::size_t I> void connectOne()
+    {
+        using T = std::tuple_element_t<I, std::tuple<Ts...>>;
+        const T& value = std::get<I>(m_values);
+        if (isDone(value))
+            return;
+        Waitable<T>::connect(value, [this]() {
+            disconnectAll(m_connections[I]);
+            if (--m_remaining == 0)
+                m_handle.resume();
+        }, m_connections[I]);
+    }
+
+    std::tuple<Ts...> m_values;
+    std::array<Connections, sizeof...(Ts)> m_connections;
+    std::coroutine_handle<> m_handle;
+    int m_remaining = 0;
+};
+
+} // namespace Detail
+
+/*!
+  \brief Returns an awaitable that resumes when \a{cache} has initialized, with the result of
+  \l{PropertyCache::isAvailable()}.
+
+  The coroutine continues immediately if the data is already loaded, or when \l{PropertyCache::ready()} or an error is
+  signalled. A cache for a service that doesn't exist therefore resumes with \c{false}, and will still emit
+  \l{PropertyCache::ready()} later if the service starts.
+
+  \code
+    if (!co_await DBusWrapper::untilReady(cache))
+        co_return;
+  \endcode
+ */
+inline CacheReady untilReady(PropertyCache& cache)
+{
+    return CacheReady{&cache};
+}
+
+inline Detail::Awaiter<CacheReady> operator co_await(CacheReady ready)
+{
+    return Detail::Awaiter<CacheReady>(ready);
+}
+
+/*!
+  \brief Awaits the result of \l{PropertyCache::set()}, returning the error of the call, if any.
+ */
+inline Detail::Awaiter<QSharedPointer<PendingSet>> operator co_await(QSharedPointer<PendingSet> set)
+{
+    return Detail::Awaiter<QSharedPointer<PendingSet>>(std::move(set));
+}
+
+/*!
+  \brief Awaits the result of \l{Target::callAsync()}, returning \a{reply} once it has finished.
+ */
+template<typename R> Detail::Awaiter<PendingReply<R>> operator co_await(PendingReply<R> reply)
+{
+    return Detail::Awaiter<PendingReply<R>>(std::move(reply));
+}
+
+/*!
+  \brief Returns an awaitable that resumes once every one of \a{waits} has finished, with a tuple of their results.
+
+  Each wait can be a \l{PendingReply}, the result of \l{PropertyCache::set()}, or \l{untilReady()}. Everything is
+  already in flight before the coroutine suspends, so independent calls overlap instead of running one after another:
+
+  \code
+    auto [speed, gear] = co_await DBusWrapper::whenAll(vehicle.callAsync<double>("Speed"),
+                                                       vehicle.callAsync<int>("Gear"));
+  \endcode
+ */
+template<typename... Ts> Detail::WhenAllAwaiter<Ts...> whenAll(Ts... waits)
+{
+    return Detail::WhenAllAwaiter<Ts...>(std::move(waits)...);
+}
+
+} // namespace DBusWrapper
+
+#endif
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QVariant>
+#include <QVector>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusError>
+#include <QtDBus/QDBusMessage>
+#include <type_traits>
+
+namespace DBusWrapper {
+
+/*!
+   \brief Result of an asynchronous DBus method call.
+
+   Returned through \l{PendingReply} by \l{Target::callAsync()}. The call is sent immediately, and the reply is
+   received and decoded on a DBusWrapper backend thread. The \l{finished()} signal is emitted once on the thread that
+   made the call, and never before control returns to its event loop, so it's always safe to connect after the call.
+
+   The call is kept alive until it finishes, even if every reference to it is released.
+ */
+class PendingCall : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+      \brief Returns the name of the method that was called.
+     */
+    const QString& method() const { return m_method; }
+    /*!
+      \brief Returns the meta type ID that the reply is decoded as, or QMetaType::UnknownType if it isn't decoded.
+     */
+    int valueType() const { return m_valueType; }
+    /*!
+      \brief Returns true if the call has finished.
+     */
+    bool isFinished() const { return m_finished; }
+    /*!
+      \brief Returns true if the call finished with an error, including a reply that couldn't be decoded.
+     */
+    bool isError() const { return m_error.isValid(); }
+    /*!
+      \brief Returns the error of the call, if any.
+     */
+    QDBusError error() const { return m_error; }
+    /*!
+      \brief Returns the reply message, or an invalid message if the call hasn't finished.
+     */
+    QDBusMessage reply() const { return m_reply; }
+    /*!
+      \brief Returns the first argument of the reply decoded as \l{valueType()}, or an invalid QVariant.
+     */
+    QVariant value() const { return m_value; }
+
+    static QSharedPointer<PendingCall> send(const QDBusConnection& bus, const QDBusMessage& message, int valueType);
+    static QVector<QSharedPointer<PendingCall>> sendAll(const QDBusConnection& bus, const QVector<QDBusMessage>& messages,
+                                                        int valueType);
+
+signals:
+    void finished(const QDBusError& error);
+
+private:
+    PendingCall(const QString& method, int valueType) : m_method(method), m_valueType(valueType) {}
+    void finish(const QDBusMessage& reply, const QVariant& value, const QDBusError& error);
+
+    const QString m_method;
+    const int m_valueType;
+    bool m_finished = false;
+    QDBusMessage m_reply;
+    QVariant m_value;
+    QDBusError m_error;
+};
+
+/*!
+   \brief Typed handle to a \l{PendingCall}.
+
+   PendingReply is a lightweight, copyable reference to the result of \l{Target::callAsync()}. \c{R} is the type of
+   the first argument of the reply, or \c{void} if the reply isn't needed. Complex types are demarshalled on the
+   backend thread for any type registered with \c{qDBusRegisterMetaType()}:
+
+   \code
+     auto reply = target.callAsync<QStringList>("ListNames");
+     reply.then(this, [](const DBusWrapper::PendingReply<QStringList>& reply) {
+         if (!reply.isError())
+             qDebug() << reply.value();
+     });
+   \endcode
+ */
+template<typename R> class PendingReply
+{
+public:
+    /*!
+      \brief Construct an invalid reply.
+     */
+    PendingReply() = default;
+    /*!
+      \brief Construct a handle for \a{call}, which must have been sent with \l{valueType()}.
+     */
+    explicit PendingReply(QSharedPointer<PendingCall> call) : m_call(std::move(call)) {}
+
+    /*!
+      \brief Returns the meta type ID that replies are decoded as.
+     */
+    static int valueType()
+    {
+        if constexpr (std::is_void_v<R>)
+            return QMetaType::UnknownType;
+        else
+            return qMetaTypeId<R>();
+    }
+
+    /*!
+      \brief Returns true if this refers to a call.
+     */
+    bool isValid() const { return !m_call.isNull(); }
+    /*!
+      \brief Returns true if the call has finished.
+     */
+    bool isFinished() const { return m_call && m_call->isFinished(); }
+    /*!
+      \brief Returns true if the call finished with an error.
+     */
+    bool isError() const { return m_call && m_call->isError(); }
+    /*!
+      \brief Returns the error of the call, if any.
+     */
+    QDBusError error() const { return m_call ? m_call->error() : QDBusError(); }
+    /*!
+      \brief Returns the decoded reply, or a default-constructed value if the call hasn't finished successfully.
+     */
+    R value() const { return qvariant_cast<R>(m_call ? m_call->value() : QVariant()); }
+    /*!
+      \brief Returns the \l{PendingCall}, for connecting to \l{PendingCall::finished()}.
+     */
+    PendingCall* call() const { return m_call.data(); }
+
+    /*!
+      \brief Calls \a{functor} with this reply on the thread of \a{context} when the call finishes.
+
+      If the call has already finished, \a{functor} is called when control returns to the event loop. Nothing is
+      called if \a{context} is destroyed first.
+     */
+    template<typename Functor> void then(const QObject* context, Functor functor) const
+    {
+        if (!m_call)
+            return;
+        if (m_call->isFinished()) {
+            QTimer::singleShot(0, context, [reply = *this, functor = std::move(functor)]() { functor(reply); });
+            return;
+        }
+        // The call holds itself until it finishes, so a weak reference avoids a cycle through the connection
+        QWeakPointer<PendingCall> weak = m_call;
+        QObject::connect(m_call.data(), &PendingCall::finished, context, [weak, functor = std::move(functor)]() {
+            functor(PendingReply(weak.toStrongRef()));
+        });
+    }
+
+private:
+    QSharedPointer<PendingCall> m_call;
+};
+
+} // namespace DBusWrapper
@@ -2,12 +2,196 @@
 
 #include <QObject>
 #include <QVariant>
+#include <QSharedPointer>
+#include <QThread>
 #include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusError>
 #include "dbustarget.h"
+#include "dbuspropertyhandle.h"
 
 namespace DBusWrapper {
 
 class PropertyCachePrivate;
+class PropertyCachePreloadPrivate;
+class PropertySnapshotReaderPrivate;
+class PropertyCacheThreadData;
+template<typename Schema> class TypedPropertyCache;
+
+/*!
+   \brief Controls how PropertyCache delivers frequent property changes.
+
+   By default, every PropertiesChanged message from the service is applied and signalled separately. With coalescing
+   enabled, changes are merged and only the latest value of each property is delivered, either once per iteration of
+   the event loop or at most once per interval.
+
+   \sa {Coalescing changes}
+ */
+class CoalescingPolicy
+{
+public:
+    /*!
+      \brief Construct a policy that delivers every change (no coalescing).
+     */
+    CoalescingPolicy() = default;
+
+    /*!
+      \brief Returns a policy that delivers changes once per event loop iteration.
+     */
+    static CoalescingPolicy eventLoop() { return CoalescingPolicy(0); }
+    /*!
+      \brief Returns a policy that delivers changes at most once every \a{msec} milliseconds.
+     */
+    static CoalescingPolicy interval(int msec) { return CoalescingPolicy(qMax(msec, 0)); }
+
+    /*!
+      \brief Returns true if changes are coalesced.
+     */
+    bool isEnabled() const { return m_interval >= 0; }
+    /*!
+      \brief Returns the minimum interval between deliveries in milliseconds, or 0 for once per event loop iteration.
+     */
+    int interval() const { return qMax(m_interval, 0); }
+
+    bool operator==(const CoalescingPolicy& other) const { return m_interval == other.m_interval; }
+    bool operator!=(const CoalescingPolicy& other) const { return m_interval != other.m_interval; }
+    friend uint qHash(const CoalescingPolicy& policy, uint seed = 0) noexcept { return qHash(policy.m_interval, seed); }
+
+private:
+    explicit CoalescingPolicy(int interval) : m_interval(interval) { }
+
+    // -1 is disabled, 0 is once per event loop iteration, otherwise the minimum interval in msec
+    int m_interval = -1;
+};
+
+/*!
+   \brief Result of an asynchronous PropertyCache::set().
+
+   The \l{finished()} signal is emitted when the service replies, and never before control returns to the event loop.
+   A coalesced write that was replaced by a later value finishes together with the call that sent the later value.
+
+   \sa {Setting properties}
+ */
+class PendingSet : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+      \brief Returns the name of the property being set.
+     */
+    const QString& property() const { return m_property; }
+    /*!
+      \brief Returns the value that was requested.
+     */
+    const QVariant& value() const { return m_value; }
+    /*!
+      \brief Returns true if the service has replied.
+     */
+    bool isFinished() const { return m_finished; }
+    /*!
+      \brief Returns true if the call finished with an error.
+     */
+    bool isError() const { return m_error.isValid(); }
+    /*!
+      \brief Returns the error from the service, if any.
+     */
+    QDBusError error() const { return m_error; }
+
+signals:
+    void finished(const QDBusError& error);
+
+private:
+    friend class PropertyCacheThreadData;
+
+    PendingSet(const QString& property, const QVariant& value) : m_property(property), m_value(value) {}
+    void finish(const QDBusError& error);
+
+    const QString m_property;
+    const QVariant m_value;
+    bool m_finished = false;
+    QDBusError m_error;
+};
+
+/*!
+   \brief Keeps a group of targets loaded for PropertyCache instances on the same thread.
+
+   Returned by \l{PropertyCache::preload()}. The \l{ready()} signal is emitted once, after every target has finished
+   loading (successfully or not), and never before control returns to the event loop.
+
+   While this object exists, PropertyCache instances created for its targets on the same thread share its data, so
+   \l{PropertyCache::initialize()} succeeds immediately once the target is loaded.
+ */
+class PropertyCachePreload : public QObject
+{
+    Q_OBJECT
+
+public:
+    ~PropertyCachePreload();
+
+    const QList<Target>& targets() const;
+    bool isReady() const;
+    int loadedCount() const;
+
+signals:
+    void ready();
+
+private:
+    friend class PropertyCache;
+
+    PropertyCachePreload(const QList<Target>& targets, QObject* parent);
+    void checkReady();
+
+    PropertyCachePreloadPrivate* d;
+};
+
+/*!
+   \brief Reads the properties of a target from any thread, without an event loop.
+
+   A reader holds a consistent snapshot of the target's properties, as of one DBus message, until \l{update()} moves
+   it to the latest published snapshot. Updating never blocks on a mutex and reading never synchronizes with other
+   threads, so readers are suitable for worker threads (such as QtConcurrent or QThread::create) that poll properties
+   at high rates. There are no signals; compare \l{version()} to detect changes.
+
+   Each reader must be used by only one thread at a time; create one per worker. Readers share the backend with
+   PropertyCache instances for the same target, and keep it loaded while they exist.
+
+   \sa {Threads without an event loop}
+ */
+class PropertySnapshotReader
+{
+public:
+    explicit PropertySnapshotReader(const Target& target);
+    ~PropertySnapshotReader();
+
+    PropertySnapshotReader(const PropertySnapshotReader&) = delete;
+    PropertySnapshotReader& operator=(const PropertySnapshotReader&) = delete;
+
+    const Target& target() const;
+    bool update();
+    quint64 version() const;
+
+    bool isAvailable() const;
+    QDBusError error() const;
+    bool contains(const QString& property) const;
+    QVariant get(const QString& property) const;
+    QVariant get(const QString& property, int type) const;
+    template<typename T> T get(const QString& property) const
+    {
+        return get(property, qMetaTypeId<T>()).template value<T>();
+    }
+    QVariant get(PropertyHandle property) const;
+    QVariant get(PropertyHandle property, int type) const;
+    template<typename T> T get(PropertyHandle property) const
+    {
+        return get(property, qMetaTypeId<T>()).template value<T>();
+    }
+    QVariantMap getAll() const;
+    bool isStale(const QString& property) const;
+
+private:
+    PropertySnapshotReaderPrivate* d;
+};
+
 class PropertyCache : public QObject
 {
     Q_OBJECT
@@ -17,26 +201,139 @@ class PropertyCache : public QObject
 
 public:
     PropertyCache(const Target& target, QObject* parent = nullptr);
+    PropertyCache(const Target& target, CoalescingPolicy coalescing, QObject* parent = nullptr);
+    PropertyCache(const Target& target, const QStringList& watchedProperties,
+                  CoalescingPolicy coalescing = CoalescingPolicy(), QObject* parent = nullptr);
     PropertyCache(const QString& service, const QString& path, const QString& interface, QObject *parent = nullptr);
     PropertyCache(const QDBusConnection& bus, const QString& service, const QString& path, const QString& interface, QObject *parent = nullptr);
     virtual ~PropertyCache();
 
     QDBusConnection bus() const;
     const Target& target() const;
+    CoalescingPolicy coalescing() const;
+    QStringList watchedProperties() const;
     bool isAvailable() const;
     QDBusError error() const;
 
     bool initialize();
+    bool initialize(quint64 sequence);
+    quint64 sequence() const;
 
     bool contains(const QString& property) const;
     QVariant get(const QString& property) const;
+    QVariant get(const QString& property, int type) const;
     template<typename T> T get(const QString& property) const
     {
-        return get(property).template value<T>();
+        return get(property, qMetaTypeId<T>()).template value<T>();
     }
     QVariantMap getAll() const;
+    bool isStale(const QString& property) const;
+    bool isRevalidating() const;
 
-    void set(const QString& property, const QVariant& value);
+    static PropertyHandle handle(const QString& property);
+    bool contains(PropertyHandle property) const;
+    QVariant get(PropertyHandle property) const;
+    QVariant get(PropertyHandle property, int type) const;
+    template<typename T> T get(PropertyHandle property) const
+    {
+        return get(property, qMetaTypeId<T>()).template value<T>();
+    }
+
+    enum class SetMode
+    {
+        Immediate,
+        Coalesced
+    };
+    QSharedPointer<PendingSet> set(const QString& property, const QVariant& value, SetMode mode = SetMode::Immediate);
+
+    static void setObjectManager(const QDBusConnection& bus, const QString& service, const QString& path = QStringLiteral("/"));
+    static void setLazyProperties(const Target& target, const QStringList& properties);
+
+    struct RetentionLimits
+    {
+        // Maximum number of unused targets to keep
+        int capacity = 5;
+        // Approximate total size of the kept property values in bytes, or negative for no limit
+        qint64 memoryBudget = -1;
+        // Milliseconds to keep an unused target, or negative to keep it until it's evicted
+        int idleTimeout = -1;
+    };
+    static void setRetentionLimits(const RetentionLimits& limits);
+    static RetentionLimits retentionLimits();
+
+    struct RetentionStatistics
+    {
+        // Caches created for a target that was kept unused, without loading again
+        quint64 hits = 0;
+        // Caches created for a target that had to be loaded
+        quint64 misses = 0;
+        // Unused targets discarded because of the capacity or memory budget
+        quint64 evictions = 0;
+        // Unused targets discarded because of the idle timeout
+        quint64 expirations = 0;
+        // Targets currently kept unused, and their approximate size in bytes
+        int unusedCount = 0;
+        qint64 unusedSize = 0;
+    };
+    static RetentionStatistics retentionStatistics();
+
+    struct ReloadPolicy
+    {
+        // Milliseconds to wait after a service appears on the bus before loading again
+        int restartDelay = 50;
+        // Loads started at once for one service, and milliseconds to wait before starting more
+        int burstSize = 50;
+        int burstInterval = 10;
+        // Delay before loading again after a failed load, multiplied by backoffFactor for each consecutive failure
+        // up to maxBackoff milliseconds
+        int initialBackoff = 100;
+        int maxBackoff = 30000;
+        double backoffFactor = 2;
+        // Random variation of each backoff, as a fraction of it
+        double jitter = 0.2;
+    };
+    static void setReloadPolicy(const ReloadPolicy& policy);
+    static ReloadPolicy reloadPolicy();
+
+    static void setJournalCapacity(int capacity);
+    static int journalCapacity();
+
+    struct Statistics
+    {
+        // Loads of all properties of a target, and loads repeated for the same target (e.g. after the service
+        // restarted or returned an error)
+        quint64 loads = 0;
+        quint64 retries = 0;
+        quint64 loadErrors = 0;
+        // Number of loads that finished within each of loadLatencyBounds(), and a final count of slower loads
+        QVector<quint64> loadLatency;
+        // Total and longest time of finished loads in milliseconds
+        quint64 totalLoadTime = 0;
+        quint64 maxLoadTime = 0;
+        // PropertiesChanged signals received, and ignored because a load was pending
+        quint64 signalsReceived = 0;
+        quint64 signalsIgnored = 0;
+        // Snapshots of changes published by backends, and received by threads (counted once per thread)
+        quint64 snapshotsPublished = 0;
+        quint64 snapshotsDelivered = 0;
+        // Property change signals emitted on all threads
+        quint64 changesDelivered = 0;
+        // Snapshots published to threads that haven't been received yet
+        quint64 queuedDeliveries = 0;
+        // Only set in the aggregate statistics: targets in use and kept unused, and the retention hit rate
+        int liveTargets = 0;
+        int unusedTargets = 0;
+        double retentionHitRate = 0;
+    };
+    static Statistics statistics();
+    static Statistics statistics(const Target& target);
+    static QVector<int> loadLatencyBounds();
+
+    static void setSnapshotStore(const QString& fileName);
+    static PropertyCachePreload* preload(const QList<Target>& targets, QObject* parent = nullptr);
+
+    static void setBackendThreadCount(int count);
+    static void setServicePriority(const QDBusConnection& bus, const QString& service, QThread::Priority priority);
 
     void moveToThread(QThread*) = delete;
 
@@ -47,12 +344,19 @@ signals:
     void lost();
 
     void propertyChanged(const QString& property, const QVariant& value);
+    void propertyHandleChanged(DBusWrapper::PropertyHandle property, const QVariant& value);
     void propertiesReset(const QVariantMap& properties);
+    void revalidated();
 
 protected:
     virtual bool event(QEvent* e) override;
 
 private:
+    template<typename Schema> friend class TypedPropertyCache;
+
+    // Returns a number that is different every time the value of property may have changed
+    quint64 revision(PropertyHandle property) const;
+
     PropertyCachePrivate* d;
 };
 
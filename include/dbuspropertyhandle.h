@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <QDebug>
+#include <QMetaType>
+
+namespace DBusWrapper {
+
+/*!
+   \brief Interned name of a DBus property.
+
+   PropertyHandle represents a property name as a small integer ID. Handles for the same name are always equal, even
+   across caches with different targets, so they can be created once and used for fast lookups and comparisons.
+
+   PropertyHandle is copyable, comparable, can be used as the key of \l{QHash}, and can be printed directly to
+   \l{QDebug}.
+
+   \sa PropertyCache::handle()
+ */
+class PropertyHandle
+{
+public:
+    /*!
+      \brief Construct an invalid handle.
+     */
+    PropertyHandle() = default;
+    /*!
+      \brief Construct the handle for the property \a{name}, interning the name if necessary.
+
+      This is thread-safe. Interned names are never released, so this should only be used for property names.
+     */
+    explicit PropertyHandle(const QString& name);
+
+    /*!
+      \brief Returns true if this isn't a default-constructed handle.
+     */
+    bool isValid() const { return m_id >= 0; }
+    /*!
+      \brief Returns the unique ID for the property name.
+
+      IDs are assigned in order of first use and are only meaningful within the same process.
+     */
+    int id() const { return m_id; }
+    /*!
+      \brief Returns the property name.
+     */
+    QString name() const;
+
+    bool operator==(const PropertyHandle& other) const { return m_id == other.m_id; }
+    bool operator!=(const PropertyHandle& other) const { return m_id != other.m_id; }
+
+    friend uint qHash(const PropertyHandle& handle, uint seed = 0) noexcept
+    {
+        return qHash(handle.m_id, seed);
+    }
+
+    friend QDebug operator<<(QDebug debug, const PropertyHandle& handle)
+    {
+        QDebugStateSaver saver(debug);
+        if (handle.isValid())
+            debug.nospace() << "PropertyHandle(" << handle.m_id << ", " << handle.name() << ")";
+        else
+            debug << "PropertyHandle(invalid)";
+        return debug;
+    }
+
+private:
+    int m_id = -1;
+};
+
+} // namespace DBusWrapper
+
+Q_DECLARE_METATYPE(DBusWrapper::PropertyHandle)
@@ -1,20 +1,53 @@
 #pragma once
 
 #include "dbusutilities.h"
+#include "dbuspendingcall.h"
 #include <QString>
 #include <QHash>
 #include <QDebug>
 #include <QtDBus/QDBusConnection>
 #include <QtDBus/QDBusMessage>
+#include <atomic>
+#include <utility>
 
 namespace DBusWrapper {
 
+namespace Detail {
+
+// The fields of a Target, interned so that every equal Target shares one instance with a precomputed hash. Instances
+// are reference counted by Target and removed from the registry when the last one is destroyed. Identities are only
+// shared by targets on the same connection, not just the same bus name.
+struct TargetIdentity
+{
+    QDBusConnection bus;
+    QString busName, service, path, interface;
+    uint hash;
+    std::atomic<int> ref;
+
+    // Returns a referenced identity for the fields, or nullptr if all of them are empty. Thread-safe.
+    static TargetIdentity* intern(const QDBusConnection& bus, const QString& service, const QString& path,
+                                  const QString& interface);
+    // Unregisters and deletes an identity after its last reference is released. Thread-safe.
+    static void release(TargetIdentity* identity);
+
+    bool operator==(const TargetIdentity& other) const
+    {
+        return hash == other.hash && busName == other.busName && service == other.service && path == other.path &&
+                interface == other.interface && bus == other.bus;
+    }
+};
+
+} // namespace Detail
+
 /*!
    \brief Represents the target of a DBus message.
 
    Target represents the tuple of (bus, service, path, interface) used by DBus messages.
 
    Target is copyable, movable, comparable, can be used as the key of \l{QHash}, and can be printed directly to \l{QDebug}.
+
+   Equal targets share a single interned identity, so copying, comparing, and hashing a target doesn't touch its
+   strings. Constructing a target from strings looks up the identity once.
  */
 class Target
 {
@@ -23,7 +56,7 @@ public:
       \brief Construct a target with an explicit \a{bus}, \a{service}, \a{path}, and \a{interface}.
      */
     Target(const QDBusConnection& bus, const QString& service, const QString& path, const QString& interface)
-        : m_bus(bus), m_service(service), m_path(path), m_interface(interface)
+        : m_identity(Detail::TargetIdentity::intern(bus, service, path, interface))
     {
     }
     /*!
@@ -36,44 +69,50 @@ public:
     /*!
       \brief Construct an invalid target.
      */
-    Target()
-        : m_bus(QString())
+    Target() = default;
+    ~Target()
     {
+        if (m_identity && m_identity->ref.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            Detail::TargetIdentity::release(m_identity);
     }
 
     /*!
       \brief Returns true if the service, path, and interface are non-empty.
      */
-    bool isValid() const { return !m_service.isEmpty() && !m_path.isEmpty() && !m_interface.isEmpty(); }
+    bool isValid() const
+    {
+        return m_identity && !m_identity->service.isEmpty() && !m_identity->path.isEmpty() &&
+                !m_identity->interface.isEmpty();
+    }
     /*!
       \brief Returns the \l{QDBusConnection}.
      */
-    QDBusConnection bus() const { return m_bus; }
+    QDBusConnection bus() const { return m_identity ? m_identity->bus : QDBusConnection(QString()); }
     /*!
       \brief Returns the service name.
      */
-    QString service() const { return m_service; }
+    QString service() const { return m_identity ? m_identity->service : QString(); }
     /*!
       \brief Returns the object path.
      */
-    QString path() const { return m_path; }
+    QString path() const { return m_identity ? m_identity->path : QString(); }
     /*!
       \brief Returns the interface name.
      */
-    QString interface() const { return m_interface; }
+    QString interface() const { return m_identity ? m_identity->interface : QString(); }
 
     /*!
       \brief Returns a new target for \a{path} with the same bus, service, and interface.
      */
-    Target withPath(const QString& path) const { return Target(m_bus, m_service, path, m_interface); }
+    Target withPath(const QString& path) const { return Target(bus(), service(), path, interface()); }
     /*!
       \brief Returns a new target for \a{interface} with the same bus, service, and path.
      */
-    Target withInterface(const QString& interface) const { return Target(m_bus, m_service, m_path, interface); }
+    Target withInterface(const QString& interface) const { return Target(bus(), service(), path(), interface); }
     /*!
       \brief Returns a new target for \a{path} and \a{interface} with the same bus and service.
      */
-    Target with(const QString& path, const QString& interface) const { return Target(m_bus, m_service, path, interface);}
+    Target with(const QString& path, const QString& interface) const { return Target(bus(), service(), path, interface);}
 
     /*!
       \brief Creates a QDBusMessage for calling \a{method} on this target.
@@ -84,23 +123,83 @@ public:
       \note
       QVariant arguments are automatically wrapped in \l{QDBusVariant} and will be sent as the DBus 'variant' type.
      */
-    template<typename... Args> QDBusMessage createMethodCall(const QString& method, Args... args)
+    template<typename... Args> QDBusMessage createMethodCall(const QString& method, Args... args) const
     {
-        auto msg = QDBusMessage::createMethodCall(m_service, m_path, m_interface, method);
+        auto msg = QDBusMessage::createMethodCall(service(), path(), interface(), method);
         if (sizeof...(args) > 0)
             msg.setArguments(QVariantList{toDBusArgVariant(args)...});
         return msg;
     }
 
-    Target(const Target& other) = default;
-    Target(Target&& other) = default;
-    Target& operator=(const Target& other) = default;
+    /*!
+      \brief Calls \a{method} on this target asynchronously, and returns a \l{PendingReply} for its result.
+
+      Arguments are passed as for \l{createMethodCall()}. The message is sent immediately, and the first argument of
+      the reply is decoded as \c{R} on a DBusWrapper backend thread, instead of in the caller's event loop. Use
+      \c{void} for \c{R} if the reply has no arguments or isn't needed.
+
+      \code
+        auto reply = target.callAsync<int>("Add", 1, 2);
+        reply.then(this, [](const DBusWrapper::PendingReply<int>& reply) { qDebug() << reply.value(); });
+      \endcode
+     */
+    template<typename R = void, typename... Args> PendingReply<R> callAsync(const QString& method, Args... args) const
+    {
+        return PendingReply<R>(PendingCall::send(bus(), createMethodCall(method, args...), PendingReply<R>::valueType()));
+    }
+    /*!
+      \brief Sends all of the method \a{calls} back-to-back on this target's bus, and returns a \l{PendingReply} for
+      each of them in the same order.
+
+      Nothing waits for a reply before the next call is sent, so a batch costs roughly one round trip rather than one
+      per call. Each reply finishes as soon as it arrives and is decoded. Calls are usually created with
+      \l{createMethodCall()} on this target or on others of the same service, such as \l{withPath()}:
+
+      \code
+        QVector<QDBusMessage> calls;
+        for (const auto& path : paths)
+            calls.append(target.withPath(path).createMethodCall("GetState"));
+        const auto replies = target.callAsync<QString>(calls);
+      \endcode
+     */
+    template<typename R = void> QVector<PendingReply<R>> callAsync(const QVector<QDBusMessage>& calls) const
+    {
+        QVector<PendingReply<R>> replies;
+        const auto results = PendingCall::sendAll(bus(), calls, PendingReply<R>::valueType());
+        replies.reserve(results.size());
+        for (const auto& result : results)
+            replies.append(PendingReply<R>(result));
+        return replies;
+    }
+
+    Target(const Target& other)
+        : m_identity(other.m_identity)
+    {
+        if (m_identity)
+            m_identity->ref.fetch_add(1, std::memory_order_relaxed);
+    }
+    Target(Target&& other) noexcept
+        : m_identity(std::exchange(other.m_identity, nullptr))
+    {
+    }
+    Target& operator=(const Target& other)
+    {
+        Target copy(other);
+        std::swap(m_identity, copy.m_identity);
+        return *this;
+    }
+    Target& operator=(Target&& other) noexcept
+    {
+        std::swap(m_identity, other.m_identity);
+        return *this;
+    }
+    // Equal targets almost always have the same identity. The only exception is targets created while the process
+    // exits, after the registry is destroyed, so those are compared by value.
     bool operator==(const Target& other) const
     {
-        return m_bus.name() == other.m_bus.name() &&
-                m_service   == other.m_service &&
-                m_path      == other.m_path &&
-                m_interface == other.m_interface;
+        if (m_identity == other.m_identity)
+            return true;
+        return m_identity && other.m_identity && *m_identity == *other.m_identity;
     }
     bool operator!=(const Target& other) const
     {
@@ -109,25 +208,20 @@ public:
 
     friend uint qHash(const Target& target, uint seed = 0) noexcept
     {
-        QtPrivate::QHashCombine hash;
-        seed = hash(seed, target.m_bus.name());
-        seed = hash(seed, target.m_service);
-        seed = hash(seed, target.m_path);
-        seed = hash(seed, target.m_interface);
-        return seed;
+        return qHash(target.m_identity ? target.m_identity->hash : 0u, seed);
     }
 
     friend QDebug operator<<(QDebug debug, const Target& target)
     {
         QDebugStateSaver saver(debug);
         if (target.isValid()) {
-            QString busName = target.m_bus.name();
+            QString busName = target.m_identity->busName;
             if (busName == "qt_default_session_bus")
                 busName = "SessionBus";
             else if (busName == "qt_default_system_bus")
                 busName = "SystemBus";
-            debug.nospace().noquote() << "DBus(" << busName << ", " << target.m_service
-                    << ", " << target.m_path << ", " << target.m_interface << ")";
+            debug.nospace().noquote() << "DBus(" << busName << ", " << target.m_identity->service
+                    << ", " << target.m_identity->path << ", " << target.m_identity->interface << ")";
         } else {
             debug << "DBus(invalid)";
         }
@@ -135,8 +229,7 @@ public:
     }
 
 private:
-    QDBusConnection m_bus;
-    QString m_service, m_path, m_interface;
+    Detail::TargetIdentity* m_identity = nullptr;
 };
 
 } // namespace DBusWrapper
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+namespace DBusWrapper {
+
+/*!
+   \brief Records a timeline of the stages that property changes pass through, for latency analysis.
+
+   Tracepoints are only compiled into the library when it's configured with \c{-DDBUSWRAPPER_TRACING=ON}; otherwise
+   they cost nothing and \l{isSupported()} returns false. When compiled in, a tracepoint costs a single relaxed load
+   while nothing is recording.
+
+   Recorded events follow each load and change from the bus to the signals of every thread: the \c{GetAll} or
+   \c{GetManagedObjects} call in flight, demarshalling the reply, publishing the snapshot, its delivery to each thread
+   (connected across threads by flow arrows), and the signals emitted there. \l{emitPropertiesChanged()} is traced on
+   the service side, so clients and services in the same process appear on one timeline.
+
+   \code
+     DBusWrapper::Trace::start();
+     // ... run the scenario
+     DBusWrapper::Trace::stop();
+     DBusWrapper::Trace::saveChromeTrace("dbuswrapper.json");
+   \endcode
+
+   The file can be opened in \c{chrome://tracing} or \l{https://ui.perfetto.dev}{Perfetto}.
+ */
+class Trace
+{
+public:
+    Trace() = delete;
+
+    static bool isSupported();
+    static void start(int eventsPerThread = 65536);
+    static void stop();
+    static bool isRecording();
+
+    static QByteArray toChromeTrace();
+    static bool saveChromeTrace(const QString& fileName);
+};
+
+} // namespace DBusWrapper
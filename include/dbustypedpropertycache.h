@@ -0,0 +1,224 @@
+#pragma once
+
+#include "dbuspropertycache.h"
+#include <QDBusArgument>
+#include <array>
+#include <limits>
+#include <memory>
+#include <tuple>
+#include <utility>
+
+/*!
+  \brief Declares a property tag named \a{Tag} for use in a TypedPropertyCache schema.
+
+  The property is called \a{Name} on DBus, has the C++ type \a{Type}, and the DBus signature \a{Signature}.
+
+  \sa DBusWrapper::TypedPropertyCache
+ */
+#define DBUSWRAPPER_PROPERTY(Tag, Type, Name, Signature) \
+    struct Tag \
+    { \
+        using ValueType = Type; \
+        static constexpr const char* name = Name; \
+        static constexpr const char* signature = Signature; \
+    }
+
+namespace DBusWrapper {
+
+namespace Detail {
+
+template<typename Tag, typename Tuple> struct TupleIndex;
+template<typename Tag, typename... Rest> struct TupleIndex<Tag, std::tuple<Tag, Rest...>>
+    : std::integral_constant<std::size_t, 0>
+{
+};
+template<typename Tag, typename First, typename... Rest> struct TupleIndex<Tag, std::tuple<First, Rest...>>
+    : std::integral_constant<std::size_t, 1 + TupleIndex<Tag, std::tuple<Rest...>>::value>
+{
+};
+
+template<typename Tuple> struct TypedValues;
+template<typename... Tags> struct TypedValues<std::tuple<Tags...>>
+{
+    using type = std::tuple<typename Tags::ValueType...>;
+};
+
+enum class TypedValueState
+{
+    Missing,
+    Valid,
+    Mismatch
+};
+
+template<typename T> TypedValueState decodeTypedValue(const QVariant& value, const char* signature, T& out)
+{
+    if (!value.isValid())
+        return TypedValueState::Missing;
+    if (value.userType() == qMetaTypeId<T>()) {
+        out = *static_cast<const T*>(value.constData());
+        return TypedValueState::Valid;
+    }
+    // Complex types are left marshalled by QtDBus, and PropertyCache only decodes types registered with QtDBus;
+    // decode others directly if the signature matches
+    if (value.userType() == qMetaTypeId<QDBusArgument>()) {
+        const QDBusArgument arg = value.value<QDBusArgument>();
+        if (arg.currentSignature() != QLatin1String(signature))
+            return TypedValueState::Mismatch;
+        arg >> out;
+        return TypedValueState::Valid;
+    }
+    return TypedValueState::Mismatch;
+}
+
+void reportTypeMismatch(const Target& target, const char* property, const char* signature, const QVariant& value);
+
+} // namespace Detail
+
+/*!
+  \class DBusWrapper::TypedPropertyCache
+  \brief Typed access to DBus properties described by a compile-time schema.
+
+  TypedPropertyCache wraps a \l{PropertyCache} and decodes each property into a field of its C++ type. A value is
+  decoded at most once each time it changes, so reading it is a plain reference to the decoded value without
+  QVariant conversions.
+
+  The \c{Schema} type lists its properties as tags declared with \l{DBUSWRAPPER_PROPERTY}:
+
+  \code
+    struct DisplaySchema
+    {
+        DBUSWRAPPER_PROPERTY(Brightness, int, "Brightness", "i");
+        DBUSWRAPPER_PROPERTY(Modes, QStringList, "Modes", "as");
+        using Properties = std::tuple<Brightness, Modes>;
+    };
+
+    DBusWrapper::TypedPropertyCache<DisplaySchema> display(target);
+    display.onChanged<DisplaySchema::Brightness>(this, [](int brightness) { ... });
+    int brightness = display.get<DisplaySchema::Brightness>();
+  \endcode
+
+  If the service provides a value with a different type than the schema, a warning is logged once for that change,
+  \l{isValid} returns false for the property, and \l{get} returns a default-constructed value.
+
+  TypedPropertyCache has the same threading rules and consistency guarantees as \l{PropertyCache}, which is available
+  from \l{cache()} for availability and other signals. Types other than those built in to QtDBus must be
+  demarshallable from \l{QDBusArgument}.
+ */
+template<typename Schema> class TypedPropertyCache
+{
+public:
+    using Properties = typename Schema::Properties;
+    using Values = typename Detail::TypedValues<Properties>::type;
+    static constexpr std::size_t size = std::tuple_size<Properties>::value;
+
+    /*!
+      \brief Constructs a typed cache for \a{target}.
+     */
+    explicit TypedPropertyCache(const Target& target)
+        : m_cache(std::make_unique<PropertyCache>(target))
+    {
+        initHandles(std::make_index_sequence<size>());
+        m_revisions.fill(std::numeric_limits<quint64>::max());
+        m_states.fill(Detail::TypedValueState::Missing);
+    }
+
+    TypedPropertyCache(const TypedPropertyCache&) = delete;
+    TypedPropertyCache& operator=(const TypedPropertyCache&) = delete;
+
+    /*!
+      \brief Returns the underlying PropertyCache.
+     */
+    PropertyCache& cache() const { return *m_cache; }
+    /*!
+      \brief Returns the handle for the property \c{Tag}.
+     */
+    template<typename Tag> PropertyHandle handle() const { return m_handles[index<Tag>()]; }
+
+    /*!
+      \brief Returns the decoded value of the property \c{Tag}.
+
+      Returns a default-constructed value if the property is not available or has the wrong type.
+     */
+    template<typename Tag> const typename Tag::ValueType& get() const
+    {
+        constexpr std::size_t i = index<Tag>();
+        decode<Tag, i>();
+        return std::get<i>(m_values);
+    }
+
+    /*!
+      \brief Returns true if the property \c{Tag} has a value of the expected type.
+     */
+    template<typename Tag> bool isValid() const
+    {
+        constexpr std::size_t i = index<Tag>();
+        decode<Tag, i>();
+        return m_states[i] == Detail::TypedValueState::Valid;
+    }
+
+    /*!
+      \brief Returns the decoded values of all properties, in schema order.
+     */
+    const Values& values() const
+    {
+        decodeAll(std::make_index_sequence<size>());
+        return m_values;
+    }
+
+    /*!
+      \brief Calls \a{f} with the new value every time the property \c{Tag} changes.
+
+      The connection is removed when \a{context} or this cache is destroyed.
+     */
+    template<typename Tag, typename Func> QMetaObject::Connection onChanged(const QObject* context, Func f)
+    {
+        const PropertyHandle property = handle<Tag>();
+        return QObject::connect(m_cache.get(), &PropertyCache::propertyHandleChanged, context,
+                                [this, property, f](PropertyHandle changed, const QVariant&) {
+            if (changed == property)
+                f(get<Tag>());
+        });
+    }
+
+private:
+    std::unique_ptr<PropertyCache> m_cache;
+    std::array<PropertyHandle, size> m_handles;
+    mutable Values m_values;
+    mutable std::array<quint64, size> m_revisions;
+    mutable std::array<Detail::TypedValueState, size> m_states;
+
+    template<typename Tag> static constexpr std::size_t index()
+    {
+        return Detail::TupleIndex<Tag, Properties>::value;
+    }
+
+    template<std::size_t... I> void initHandles(std::index_sequence<I...>)
+    {
+        m_handles = {{PropertyHandle(QString::fromLatin1(std::tuple_element_t<I, Properties>::name))...}};
+    }
+
+    template<std::size_t... I> void decodeAll(std::index_sequence<I...>) const
+    {
+        (decode<std::tuple_element_t<I, Properties>, I>(), ...);
+    }
+
+    template<typename Tag, std::size_t I> void decode() const
+    {
+        const PropertyHandle property = m_handles[I];
+        const quint64 revision = m_cache->revision(property);
+        if (revision == m_revisions[I])
+            return;
+
+        m_revisions[I] = revision;
+        auto& value = std::get<I>(m_values);
+        value = typename Tag::ValueType();
+        const QVariant variant = m_cache->get(property, qMetaTypeId<typename Tag::ValueType>());
+        m_states[I] = Detail::decodeTypedValue(variant, Tag::signature, value);
+        if (m_states[I] == Detail::TypedValueState::Mismatch) {
+            value = typename Tag::ValueType();
+            Detail::reportTypeMismatch(m_cache->target(), Tag::name, Tag::signature, variant);
+        }
+    }
+};
+
+} // namespace DBusWrapper
@@ -8,6 +8,7 @@ namespace DBusWrapper {
 
 extern const QString k_property_interface;
 extern const QString k_properties_changed_signal_name;
+extern const QString k_object_manager_interface;
 
 /*!
   Converts \a{value} to a QVariant for use as a DBus argument.
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <QDBusConnection>
+#include <QDBusVirtualObject>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QTimer>
+#include <QVector>
+
+namespace DBusTest {
+
+/*!
+  \class DBusTest::LoadService
+  \brief Configurable mock service that generates property load.
+
+  LoadService exports \c{Profile::paths} objects, each with \c{Profile::properties} properties of type \c{ay} and
+  \c{Profile::payloadSize} bytes. It emits \c{PropertiesChanged} at \c{Profile::rate} changes per second, with up to
+  \c{Profile::batchSize} changes of one object in each signal, and can restart (unregister and register again) on
+  demand or on a schedule. Values change on every emitted change, so clients never see redundant signals.
+
+  This reproduces production-like situations in tests and benchmarks, such as many clients reloading after a
+  service restart, or high-frequency sensor properties:
+
+  \code
+  DBusTest::LoadService::Profile profile;
+  profile.paths = 500;
+  profile.rate = 1000;
+  DBusTest::TestService<DBusTest::LoadService> service(dbus, [=](auto bus) {
+      return new DBusTest::LoadService(bus, profile);
+  });
+  service.invoke([](auto s) { s->scriptRestarts(10, 1000); });
+  \endcode
+
+  Like any controller of \l{TestService}, LoadService lives on the service's thread. Get and GetAll requests are
+  answered from the current values.
+ */
+class LoadService : public QDBusVirtualObject
+{
+    Q_OBJECT
+
+public:
+    struct Profile
+    {
+        QString service = QStringLiteral("load.service");
+        // Objects are at pathPrefix/0 to pathPrefix/(paths - 1)
+        QString pathPrefix = QStringLiteral("/load");
+        QString interface = QStringLiteral("load.service");
+        int paths = 1;
+        int properties = 10;
+        // Size in bytes of each property value
+        int payloadSize = 16;
+        // Property changes per second over all objects, and the number of changes in each signal
+        double rate = 0;
+        int batchSize = 1;
+    };
+
+    explicit LoadService(const QDBusConnection& bus, QObject* parent = nullptr);
+    LoadService(const QDBusConnection& bus, const Profile& profile, QObject* parent = nullptr);
+    ~LoadService();
+
+    const Profile& profile() const { return m_profile; }
+    QString path(int index) const;
+    static QString propertyName(int index);
+
+    void setRate(double rate);
+    void setBatchSize(int batchSize);
+    void start();
+    void stop();
+    bool isRunning() const { return m_emitTimer.isActive(); }
+
+    void emitChanges(int count);
+
+    bool isRegistered() const { return m_registered; }
+    void unregister();
+    void reregister();
+    void restart(int downtime = 0);
+    void scriptRestarts(int count, int interval, int downtime = 0);
+
+    quint64 changesEmitted() const;
+    quint64 signalsEmitted() const;
+    quint64 getAllCount() const;
+    quint64 restartCount() const;
+
+    QString introspect(const QString& path) const override;
+    bool handleMessage(const QDBusMessage& message, const QDBusConnection& connection) override;
+
+signals:
+    void restarted();
+
+private:
+    QDBusConnection m_bus;
+    Profile m_profile;
+    bool m_registered = false;
+    QTimer m_emitTimer;
+    // Time and number of changes when emitting at the rate started, to emit the changes that are due
+    QElapsedTimer m_elapsed;
+    quint64 m_startChanges = 0;
+    QTimer m_restartTimer;
+    int m_restartsLeft = 0;
+    int m_restartDowntime = 0;
+    // Next property to change, as an index into m_revisions
+    int m_next = 0;
+
+    // Requests are answered from the DBus thread; must hold m_mutex to access
+    mutable QMutex m_mutex;
+    // Number of changes of each property of each object, in path-major order
+    QVector<quint32> m_revisions;
+    quint64 m_changesEmitted = 0;
+    quint64 m_signalsEmitted = 0;
+    quint64 m_getAllCount = 0;
+    quint64 m_restartCount = 0;
+
+    int objectIndex(const QString& path) const;
+    QVariant value(int object, int property) const;
+    QVariantMap values(int object) const;
+    void emitDue();
+};
+
+} // namespace DBusTest
@@ -0,0 +1,321 @@
+#include "loadservice.h"
+#include <QDBusMessage>
+#include <QDBusError>
+#include <QDBusVariant>
+#include <QDebug>
+#include <limits>
+
+namespace DBusTest {
+
+static const QString propertyInterface = QStringLiteral("org.freedesktop.DBus.Properties");
+
+/*!
+  \brief Creates a mock service on \a{bus} with the default profile.
+
+  This is the constructor used by \l{TestService}'s default init function.
+ */
+LoadService::LoadService(const QDBusConnection& bus, QObject* parent)
+    : LoadService(bus, Profile(), parent)
+{
+}
+
+/*!
+  \brief Creates a mock service on \a{bus} described by \a{profile}, and registers it.
+
+  If \c{Profile::rate} is positive, changes start immediately.
+ */
+LoadService::LoadService(const QDBusConnection& bus, const Profile& profile, QObject* parent)
+    : QDBusVirtualObject(parent), m_bus(bus), m_profile(profile)
+{
+    m_profile.paths = qMax(m_profile.paths, 1);
+    m_profile.properties = qMax(m_profile.properties, 1);
+    m_profile.batchSize = qMax(m_profile.batchSize, 1);
+    m_revisions.fill(0, m_profile.paths * m_profile.properties);
+
+    m_emitTimer.setTimerType(Qt::PreciseTimer);
+    m_emitTimer.setInterval(1);
+    connect(&m_emitTimer, &QTimer::timeout, this, &LoadService::emitDue);
+    connect(&m_restartTimer, &QTimer::timeout, this, [this]() {
+        if (--m_restartsLeft <= 0)
+            m_restartTimer.stop();
+        restart(m_restartDowntime);
+    });
+
+    reregister();
+    if (m_profile.rate > 0)
+        start();
+}
+
+LoadService::~LoadService()
+{
+    unregister();
+}
+
+/*!
+  \brief Returns the path of the object with \a{index}.
+ */
+QString LoadService::path(int index) const
+{
+    return m_profile.pathPrefix + QLatin1Char('/') + QString::number(index);
+}
+
+/*!
+  \brief Returns the name of the property with \a{index}.
+ */
+QString LoadService::propertyName(int index)
+{
+    return QStringLiteral("property%1").arg(index);
+}
+
+/*!
+  \brief Sets the number of changes per second to \a{rate}, and starts emitting them if \a{rate} is positive.
+ */
+void LoadService::setRate(double rate)
+{
+    m_profile.rate = rate;
+    if (rate > 0)
+        start();
+    else
+        stop();
+}
+
+/*!
+  \brief Sets the maximum number of changes in each signal to \a{batchSize}.
+ */
+void LoadService::setBatchSize(int batchSize)
+{
+    m_profile.batchSize = qMax(batchSize, 1);
+}
+
+/*!
+  \brief Starts emitting changes at the profile's rate.
+ */
+void LoadService::start()
+{
+    m_elapsed.start();
+    m_startChanges = changesEmitted();
+    m_emitTimer.start();
+}
+
+/*!
+  \brief Stops emitting changes at the profile's rate.
+ */
+void LoadService::stop()
+{
+    m_emitTimer.stop();
+}
+
+void LoadService::emitDue()
+{
+    // Nothing is sent while the service is down, and the rate continues from when it returns
+    if (!m_registered) {
+        m_elapsed.start();
+        m_startChanges = changesEmitted();
+        return;
+    }
+    const quint64 due = quint64(m_elapsed.elapsed() * m_profile.rate / 1000);
+    const quint64 emitted = changesEmitted() - m_startChanges;
+    if (due > emitted)
+        emitChanges(int(qMin<quint64>(due - emitted, std::numeric_limits<int>::max())));
+}
+
+/*!
+  \brief Changes \a{count} properties immediately, cycling through all properties of all objects.
+
+  Consecutive changes of the same object are sent in signals of up to \c{Profile::batchSize} changes.
+ */
+void LoadService::emitChanges(int count)
+{
+    const int properties = m_profile.properties;
+    while (count > 0) {
+        const int object = m_next / properties;
+        QVariantMap changed;
+        QMutexLocker lock(&m_mutex);
+        do {
+            const int property = m_next % properties;
+            m_revisions[m_next]++;
+            changed.insert(propertyName(property), value(object, property));
+            m_next = (m_next + 1) % m_revisions.size();
+            m_changesEmitted++;
+            count--;
+        } while (count > 0 && changed.size() < m_profile.batchSize && m_next % properties != 0);
+        m_signalsEmitted++;
+        lock.unlock();
+
+        auto signal = QDBusMessage::createSignal(path(object), propertyInterface, QStringLiteral("PropertiesChanged"));
+        signal << m_profile.interface << changed << QStringList();
+        m_bus.send(signal);
+    }
+}
+
+/*!
+  \brief Removes the objects and the service name from the bus, as if the service stopped.
+ */
+void LoadService::unregister()
+{
+    if (!m_registered)
+        return;
+    m_bus.unregisterService(m_profile.service);
+    m_bus.unregisterObject(m_profile.pathPrefix, QDBusConnection::UnregisterTree);
+    m_registered = false;
+}
+
+/*!
+  \brief Registers the objects and the service name on the bus again.
+ */
+void LoadService::reregister()
+{
+    if (m_registered)
+        return;
+    m_registered = m_bus.registerVirtualObject(m_profile.pathPrefix, this, QDBusConnection::SubPath);
+    if (m_registered)
+        m_registered = m_bus.registerService(m_profile.service);
+    if (!m_registered)
+        qWarning() << "LoadService failed to register" << m_profile.service << "at" << m_profile.pathPrefix;
+}
+
+/*!
+  \brief Unregisters the service, and registers it again after \a{downtime} ms.
+
+  Every client reloads its properties when the service returns, which creates a burst of GetAll calls.
+  \l{restarted()} is emitted after the service is registered again.
+ */
+void LoadService::restart(int downtime)
+{
+    unregister();
+    {
+        QMutexLocker lock(&m_mutex);
+        m_restartCount++;
+    }
+    auto reregisterNow = [this]() {
+        reregister();
+        emit restarted();
+    };
+    if (downtime > 0)
+        QTimer::singleShot(downtime, this, reregisterNow);
+    else
+        reregisterNow();
+}
+
+/*!
+  \brief Restarts the service \a{count} times, every \a{interval} ms, with \a{downtime} ms between unregistering and
+  registering again.
+ */
+void LoadService::scriptRestarts(int count, int interval, int downtime)
+{
+    m_restartsLeft = count;
+    m_restartDowntime = downtime;
+    if (count > 0)
+        m_restartTimer.start(interval);
+    else
+        m_restartTimer.stop();
+}
+
+/*!
+  \brief Returns the number of property changes emitted.
+ */
+quint64 LoadService::changesEmitted() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_changesEmitted;
+}
+
+/*!
+  \brief Returns the number of PropertiesChanged signals emitted.
+ */
+quint64 LoadService::signalsEmitted() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_signalsEmitted;
+}
+
+/*!
+  \brief Returns the number of GetAll calls answered.
+ */
+quint64 LoadService::getAllCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_getAllCount;
+}
+
+/*!
+  \brief Returns the number of restarts.
+ */
+quint64 LoadService::restartCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_restartCount;
+}
+
+int LoadService::objectIndex(const QString& path) const
+{
+    const QString prefix = m_profile.pathPrefix + QLatin1Char('/');
+    if (!path.startsWith(prefix))
+        return -1;
+    bool ok = false;
+    const int index = path.midRef(prefix.size()).toInt(&ok);
+    return (ok && index >= 0 && index < m_profile.paths) ? index : -1;
+}
+
+// Must hold m_mutex
+QVariant LoadService::value(int object, int property) const
+{
+    // The revision makes every value different from the previous one
+    QByteArray value = QByteArray::number(m_revisions[object * m_profile.properties + property]);
+    return value.leftJustified(qMax(m_profile.payloadSize, value.size()), '.');
+}
+
+// Must hold m_mutex
+QVariantMap LoadService::values(int object) const
+{
+    QVariantMap values;
+    for (int i = 0; i < m_profile.properties; i++)
+        values.insert(propertyName(i), value(object, i));
+    return values;
+}
+
+QString LoadService::introspect(const QString& path) const
+{
+    if (objectIndex(path) < 0)
+        return QString();
+    QString xml = QStringLiteral("  <interface name=\"%1\">\n").arg(m_profile.interface);
+    for (int i = 0; i < m_profile.properties; i++)
+        xml += QStringLiteral("    <property name=\"%1\" type=\"ay\" access=\"read\"/>\n").arg(propertyName(i));
+    xml += QStringLiteral("  </interface>\n");
+    return xml;
+}
+
+bool LoadService::handleMessage(const QDBusMessage& message, const QDBusConnection& connection)
+{
+    const int object = objectIndex(message.path());
+    if (object < 0 || message.type() != QDBusMessage::MethodCallMessage || message.interface() != propertyInterface)
+        return false;
+
+    const QList<QVariant> args = message.arguments();
+    if (args.isEmpty() || args[0].toString() != m_profile.interface) {
+        connection.send(message.createErrorReply(QDBusError::UnknownInterface, QStringLiteral("Unknown interface")));
+        return true;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    QDBusMessage reply;
+    if (message.member() == QLatin1String("GetAll") && message.signature() == QLatin1String("s")) {
+        m_getAllCount++;
+        reply = message.createReply(QVariant::fromValue(values(object)));
+    } else if (message.member() == QLatin1String("Get") && message.signature() == QLatin1String("ss")) {
+        const QString name = args[1].toString();
+        bool ok = name.startsWith(QLatin1String("property"));
+        const int property = ok ? name.midRef(8).toInt(&ok) : -1;
+        if (ok && property >= 0 && property < m_profile.properties)
+            reply = message.createReply(QVariant::fromValue(QDBusVariant(value(object, property))));
+        else
+            reply = message.createErrorReply(QDBusError::UnknownProperty, QStringLiteral("Unknown property %1").arg(name));
+    } else {
+        return false;
+    }
+    lock.unlock();
+    connection.send(reply);
+    return true;
+}
+
+} // namespace DBusTest
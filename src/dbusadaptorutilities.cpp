@@ -2,11 +2,19 @@
 
 #include <QDBusConnection>
 #include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QDBusArgument>
+#include <QLoggingCategory>
 
 #include "dbusutilities.h"
+#include "dbustrace_p.h"
+
+#include <utility>
 
 namespace DBusWrapper {
 
+Q_LOGGING_CATEGORY(logPropertyStore, "dbuswrapper.propertystore", QtWarningMsg)
+
 void emitPropertiesChanged(const QString &path, const QString &interface, const QString &property, const QVariant &value)
 {
     emitPropertiesChanged(QDBusConnection::sessionBus(), path, interface, QVariantMap{{property, value}});
@@ -24,11 +32,379 @@ void emitPropertiesChanged(const QString &path, const QString &interface, const
 
 void emitPropertiesChanged(const QDBusConnection& bus, const QString& path, const QString& interface, const QVariantMap& changed_properties)
 {
+    emitPropertiesChanged(bus, path, interface, changed_properties, QStringList());
+}
+
+void emitPropertiesChanged(const QDBusConnection& bus, const QString& path, const QString& interface, const QVariantMap& changed_properties,
+                           const QStringList& invalidated_properties)
+{
+    DBUSWRAPPER_TRACE_SCOPE("service", "emitPropertiesChanged", Target(bus, bus.baseService(), path, interface),
+                            changed_properties.size() + invalidated_properties.size());
     QDBusMessage signal = QDBusMessage::createSignal(path, k_property_interface, k_properties_changed_signal_name);
     signal << interface;
     signal << changed_properties;
-    signal << QStringList();
+    signal << invalidated_properties;
     bus.send(signal);
 }
 
+/*!
+  \class DBusWrapper::PropertiesChangedEmitter
+  \brief Collects property changes of one object and emits them as a single PropertiesChanged signal.
+
+  Services often update several properties in a row, and calling \l{emitPropertiesChanged()} for each of them sends
+  a separate signal that every client has to receive and process. PropertiesChangedEmitter accumulates the changes
+  for one \a{path} and \a{interface} and sends them together, once per event loop iteration by default or at most
+  once per \l{setInterval()}{interval}.
+
+  Within a batch, only the last value of each property is sent. Invalidating a property drops its pending value, and
+  a later value replaces the invalidation. Pending changes are sent when the emitter is destroyed.
+
+  \code
+    ExampleService::ExampleService(const QDBusConnection& bus)
+      : m_emitter(bus, "/org/example", "org.example", this)
+    {
+    }
+
+    void ExampleService::setLevel(int level)
+    {
+        m_level = level;
+        m_emitter.change("Level", level);
+        m_emitter.change("Description", describeLevel(level));
+    }
+  \endcode
+
+  PropertiesChangedEmitter must be used from its own thread, which must run an event loop.
+ */
+PropertiesChangedEmitter::PropertiesChangedEmitter(const QDBusConnection& bus, const QString& path,
+                                                   const QString& interface, QObject* parent)
+    : QObject(parent), m_bus(bus), m_path(path), m_interface(interface)
+{
+    m_flushTimer.setSingleShot(true);
+    connect(&m_flushTimer, &QTimer::timeout, this, &PropertiesChangedEmitter::flush);
+}
+
+PropertiesChangedEmitter::~PropertiesChangedEmitter()
+{
+    flush();
+}
+
+/*!
+  \brief Sets the minimum interval between signals to \a{msec} milliseconds.
+
+  With an interval of 0 (the default), changes are sent once per event loop iteration.
+ */
+void PropertiesChangedEmitter::setInterval(int msec)
+{
+    m_interval = qMax(msec, 0);
+}
+
+/*!
+  \brief Queues a change of \a{property} to \a{value}.
+ */
+void PropertiesChangedEmitter::change(const QString& property, const QVariant& value)
+{
+    m_changed.insert(property, value);
+    m_invalidated.removeOne(property);
+    scheduleFlush();
+}
+
+/*!
+  \brief Queues changes to all \a{properties}.
+ */
+void PropertiesChangedEmitter::change(const QVariantMap& properties)
+{
+    for (auto it = properties.constBegin(); it != properties.constEnd(); it++) {
+        m_changed.insert(it.key(), it.value());
+        m_invalidated.removeOne(it.key());
+    }
+    scheduleFlush();
+}
+
+/*!
+  \brief Queues \a{property} as invalidated, without sending its new value.
+
+  Clients fetch the value when they need it. This is useful for large values.
+ */
+void PropertiesChangedEmitter::invalidate(const QString& property)
+{
+    m_changed.remove(property);
+    if (!m_invalidated.contains(property))
+        m_invalidated.append(property);
+    scheduleFlush();
+}
+
+/*!
+  \brief Sends pending changes immediately.
+ */
+void PropertiesChangedEmitter::flush()
+{
+    m_flushTimer.stop();
+    if (!hasPendingChanges())
+        return;
+    m_lastFlush.start();
+    emitPropertiesChanged(m_bus, m_path, m_interface, std::exchange(m_changed, {}), std::exchange(m_invalidated, {}));
+}
+
+void PropertiesChangedEmitter::scheduleFlush()
+{
+    if (m_flushTimer.isActive())
+        return;
+    const qint64 delay = m_lastFlush.isValid() ? m_interval - m_lastFlush.elapsed() : 0;
+    m_flushTimer.start(int(qMax<qint64>(delay, 0)));
+}
+
+/*!
+  \class DBusWrapper::PropertyStore
+  \brief Owns the property values of one DBus interface and answers Get, GetAll, and Set from memory.
+
+  Exporting properties with QtDBus adaptors calls every property getter through QMetaObject reflection for each
+  \c{GetAll} request, which is expensive when many clients reconnect at once (e.g. after the service restarts).
+  PropertyStore instead keeps the current values of \a{interface} at \a{path}, and replies to
+  \c{org.freedesktop.DBus.Properties} calls with those values directly.
+
+  The service updates values with \l{setValue()} or \l{setValues()}. Values that actually changed are sent with
+  \l{PropertiesChangedEmitter}, so changes made in a row are sent as a single signal; \l{emitter()} can be used to
+  configure the interval.
+
+  \code
+    ExampleService::ExampleService(const QDBusConnection& bus)
+      : m_properties(bus, "/org/example", "org.example", this)
+    {
+        m_properties.setValues({{"Level", 0}, {"Description", QString()}});
+        m_properties.setWritable("Level", true);
+        connect(&m_properties, &DBusWrapper::PropertyStore::valueWritten, this, &ExampleService::onWritten);
+    }
+  \endcode
+
+  The store is registered as a virtual object for \a{path}, so no other object can be registered for that path, and
+  method calls other than the properties interface are answered with an error. Properties are read-only for clients
+  unless made writable with \l{setWritable()}.
+
+  PropertyStore must be used from its own thread, which must run an event loop. Requests from clients are answered
+  safely from any thread.
+ */
+PropertyStore::PropertyStore(const QDBusConnection& bus, const QString& path, const QString& interface, QObject* parent)
+    : QDBusVirtualObject(parent), m_bus(bus), m_emitter(bus, path, interface, this)
+{
+    m_registered = m_bus.registerVirtualObject(path, this, QDBusConnection::SingleNode);
+    if (!m_registered)
+        qCWarning(logPropertyStore) << "failed to register property store for" << interface << "at" << path;
+}
+
+PropertyStore::~PropertyStore()
+{
+    m_emitter.flush();
+    if (m_registered)
+        m_bus.unregisterObject(path());
+}
+
+/*!
+  \brief Returns the current value of \a{property}, or an invalid QVariant if it doesn't exist.
+ */
+QVariant PropertyStore::value(const QString& property) const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_values.value(property);
+}
+
+/*!
+  \brief Returns the current values of all properties.
+ */
+QVariantMap PropertyStore::values() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_values;
+}
+
+/*!
+  \brief Sets \a{property} to \a{value}, and signals the change to clients if it's different.
+
+  An invalid \a{value} can't be sent over DBus, so it's ignored with a warning; use \l{removeValue()} to remove a
+  property.
+ */
+void PropertyStore::setValue(const QString& property, const QVariant& value)
+{
+    if (!value.isValid()) {
+        qCWarning(logPropertyStore) << "ignoring invalid value for" << property << "on" << interface() << "at" << path();
+        return;
+    }
+    if (storeValue(property, value))
+        m_emitter.change(property, value);
+}
+
+/*!
+  \brief Removes \a{property} from the interface.
+
+  Clients are sent the property as invalidated, and reading it afterwards fails with an unknown property error, so
+  a PropertyCache keeps its last value and reports it as stale.
+ */
+void PropertyStore::removeValue(const QString& property)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        if (!m_values.remove(property))
+            return;
+        m_revisions.remove(property);
+        m_introspection.clear();
+        m_getAllReply.clear();
+    }
+    m_emitter.invalidate(property);
+}
+
+/*!
+  \brief Sets all of \a{values}, and signals the changes to clients together.
+ */
+void PropertyStore::setValues(const QVariantMap& values)
+{
+    for (auto it = values.constBegin(); it != values.constEnd(); it++)
+        setValue(it.key(), it.value());
+}
+
+/*!
+  \brief Sets whether clients can change \a{property}.
+
+  Changes by clients are stored, signalled to other clients, and emitted as \l{valueWritten()}.
+ */
+void PropertyStore::setWritable(const QString& property, bool writable)
+{
+    QMutexLocker lock(&m_mutex);
+    if (writable)
+        m_writable.insert(property);
+    else
+        m_writable.remove(property);
+    m_introspection.clear();
+}
+
+bool PropertyStore::storeValue(const QString& property, const QVariant& value)
+{
+    QMutexLocker lock(&m_mutex);
+    auto it = m_values.find(property);
+    if (it == m_values.end()) {
+        m_values.insert(property, value);
+        m_introspection.clear();
+    } else {
+        if (it.value() == value)
+            return false;
+        if (it.value().userType() != value.userType())
+            m_introspection.clear();
+        it.value() = value;
+    }
+    m_revisions.insert(property, ++m_revision);
+    m_getAllReply.clear();
+    return true;
+}
+
+QVariant PropertyStore::getAllReply() const
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_getAllReply.isValid()) {
+        QDBusArgument arg;
+        arg << m_values;
+        m_getAllReply = QVariant::fromValue(arg);
+        m_getAllMarshalCount++;
+    }
+    return m_getAllReply;
+}
+
+int PropertyStore::test_getAllMarshalCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_getAllMarshalCount;
+}
+
+static QString dbusSignature(const QVariant& value)
+{
+    if (value.userType() == qMetaTypeId<QDBusArgument>())
+        return value.value<QDBusArgument>().currentSignature();
+    if (value.userType() == qMetaTypeId<QDBusVariant>())
+        return QStringLiteral("v");
+    return QString::fromLatin1(QDBusMetaType::typeToSignature(value.userType()));
+}
+
+QString PropertyStore::introspect(const QString& path) const
+{
+    Q_UNUSED(path);
+    QMutexLocker lock(&m_mutex);
+    if (!m_introspection.isEmpty())
+        return m_introspection;
+
+    QString xml = QStringLiteral("  <interface name=\"%1\">\n").arg(interface());
+    for (auto it = m_values.constBegin(); it != m_values.constEnd(); it++) {
+        xml += QStringLiteral("    <property name=\"%1\" type=\"%2\" access=\"%3\"/>\n")
+                   .arg(it.key(), dbusSignature(it.value()),
+                        m_writable.contains(it.key()) ? QStringLiteral("readwrite") : QStringLiteral("read"));
+    }
+    xml += QStringLiteral("  </interface>\n");
+    m_introspection = xml;
+    return xml;
+}
+
+bool PropertyStore::handleMessage(const QDBusMessage& message, const QDBusConnection& connection)
+{
+    if (message.type() != QDBusMessage::MethodCallMessage || message.interface() != k_property_interface)
+        return false;
+
+    const QList<QVariant> args = message.arguments();
+    const QString& signature = message.signature();
+    // Per the specification, an empty interface name matches any interface
+    if (args.isEmpty() || (!args[0].toString().isEmpty() && args[0].toString() != interface())) {
+        connection.send(message.createErrorReply(QDBusError::UnknownInterface,
+                                                 QStringLiteral("Unknown interface %1").arg(args.value(0).toString())));
+        return true;
+    }
+
+    QDBusMessage reply;
+    if (message.member() == QLatin1String("Get") && signature == QLatin1String("ss")) {
+        const QVariant value = this->value(args[1].toString());
+        if (value.isValid())
+            reply = message.createReply(QVariant::fromValue(QDBusVariant(value)));
+        else
+            reply = message.createErrorReply(QDBusError::UnknownProperty,
+                                             QStringLiteral("Unknown property %1").arg(args[1].toString()));
+    } else if (message.member() == QLatin1String("GetAll") && signature == QLatin1String("s")) {
+        reply = message.createReply(getAllReply());
+    } else if (message.member() == QLatin1String("Set") && signature == QLatin1String("ssv")) {
+        reply = handleSet(message, args[1].toString(), args[2].value<QDBusVariant>().variant());
+    } else {
+        return false;
+    }
+    connection.send(reply);
+    return true;
+}
+
+QDBusMessage PropertyStore::handleSet(const QDBusMessage& message, const QString& property, const QVariant& value)
+{
+    QMutexLocker lock(&m_mutex);
+    auto it = m_values.find(property);
+    if (it == m_values.end())
+        return message.createErrorReply(QDBusError::UnknownProperty, QStringLiteral("Unknown property %1").arg(property));
+    if (!m_writable.contains(property))
+        return message.createErrorReply(QDBusError::PropertyReadOnly, QStringLiteral("Property %1 is read-only").arg(property));
+    const QString signature = dbusSignature(it.value());
+    if (dbusSignature(value) != signature) {
+        return message.createErrorReply(QDBusError::InvalidArgs,
+                                        QStringLiteral("Property %1 has signature %2").arg(property, signature));
+    }
+    if (it.value() == value)
+        return message.createReply();
+    it.value() = value;
+    const quint64 revision = ++m_revision;
+    m_revisions.insert(property, revision);
+    m_getAllReply.clear();
+    lock.unlock();
+
+    // The value is stored before replying, but clients are notified from the store's thread. If the service changed
+    // or removed the property in the meantime, that change has already been signalled and this one is outdated.
+    QMetaObject::invokeMethod(this, [this, property, value, revision] {
+        {
+            QMutexLocker lock(&m_mutex);
+            if (m_revisions.value(property) != revision)
+                return;
+        }
+        m_emitter.change(property, value);
+        emit valueWritten(property, value);
+    }, Qt::QueuedConnection);
+    return message.createReply();
+}
+
 } // namespace DBusWrapper
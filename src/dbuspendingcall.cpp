@@ -0,0 +1,120 @@
+#include "dbuspendingcall.h"
+#include "dbuspropertycache_p.h"
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QDBusPendingCallWatcher>
+#include <QLoggingCategory>
+#include <memory>
+
+namespace DBusWrapper {
+
+Q_LOGGING_CATEGORY(logPendingCall, "dbuswrapper.pendingcall", QtWarningMsg)
+
+// Decodes the first argument of reply as type into value, or returns the reason it can't be decoded
+static QDBusError decodeReply(const QDBusMessage& reply, int type, QVariant* value)
+{
+    if (type == QMetaType::UnknownType)
+        return QDBusError();
+    const QVariantList args = reply.arguments();
+    if (args.isEmpty())
+        return QDBusError(QDBusError::InvalidSignature, QStringLiteral("Reply has no arguments"));
+
+    const QVariant& arg = args.first();
+    if (arg.userType() == qMetaTypeId<QDBusArgument>()) {
+        const QDBusArgument marshalled = arg.value<QDBusArgument>();
+        const char* signature = QDBusMetaType::typeToSignature(type);
+        if (signature && marshalled.currentSignature() == QLatin1String(signature)) {
+            QVariant decoded(type, nullptr);
+            if (QDBusMetaType::demarshall(marshalled, type, decoded.data())) {
+                *value = decoded;
+                return QDBusError();
+            }
+        }
+        return QDBusError(QDBusError::InvalidSignature, QStringLiteral("Reply has signature %1 instead of %2")
+                          .arg(marshalled.currentSignature(), QString::fromLatin1(signature)));
+    }
+
+    if (type == QMetaType::QVariant) {
+        *value = QVariant::fromValue(arg.userType() == qMetaTypeId<QDBusVariant>() ? arg.value<QDBusVariant>().variant() : arg);
+        return QDBusError();
+    }
+    QVariant converted = arg;
+    if (converted.userType() == type || converted.convert(type)) {
+        *value = converted;
+        return QDBusError();
+    }
+    return QDBusError(QDBusError::InvalidSignature, QStringLiteral("Reply of type %1 can't be decoded as %2")
+                      .arg(QString::fromLatin1(arg.typeName()), QString::fromLatin1(QMetaType::typeName(type))));
+}
+
+void PendingCall::finish(const QDBusMessage& reply, const QVariant& value, const QDBusError& error)
+{
+    m_finished = true;
+    m_reply = reply;
+    m_value = value;
+    m_error = error;
+    emit finished(error);
+}
+
+/*!
+  \brief Sends \a{message} on \a{bus}, decoding the reply as \a{valueType}.
+
+  \sa Target::callAsync()
+ */
+QSharedPointer<PendingCall> PendingCall::send(const QDBusConnection& bus, const QDBusMessage& message, int valueType)
+{
+    return sendAll(bus, {message}, valueType).first();
+}
+
+/*!
+  \brief Sends all \a{messages} on \a{bus} back-to-back, decoding each reply as \a{valueType}.
+
+  Every call is sent before this returns, without waiting for any reply, and each one finishes independently as its
+  reply arrives. The replies are decoded on the backend thread for the service of the first message.
+
+  \sa Target::callAsync()
+ */
+QVector<QSharedPointer<PendingCall>> PendingCall::sendAll(const QDBusConnection& bus, const QVector<QDBusMessage>& messages,
+                                                          int valueType)
+{
+    QVector<QSharedPointer<PendingCall>> results;
+    if (messages.isEmpty())
+        return results;
+    results.reserve(messages.size());
+    QVector<QDBusPendingCall> calls;
+    calls.reserve(messages.size());
+    for (const auto& message : messages) {
+        results.append(QSharedPointer<PendingCall>(new PendingCall(message.member(), valueType), &QObject::deleteLater));
+        calls.append(bus.asyncCall(message));
+    }
+
+    // Watchers are created on the backend thread so that replies are decoded there. Replies that arrive first are
+    // delivered as soon as their watcher exists.
+    auto context = new QObject;
+    context->moveToThread(PropertyCacheService::threadFor(bus, messages.first().service()));
+    QMetaObject::invokeMethod(context, [context, calls, results, valueType]() {
+        auto remaining = std::make_shared<int>(calls.size());
+        for (int i = 0; i < calls.size(); i++) {
+            auto w = new QDBusPendingCallWatcher(calls[i], context);
+            auto result = results[i];
+            QObject::connect(w, &QDBusPendingCallWatcher::finished, context,
+                             [context, remaining, valueType, result](QDBusPendingCallWatcher* w) {
+                const QDBusMessage reply = w->reply();
+                QVariant value;
+                QDBusError error = w->isError() ? w->error() : decodeReply(reply, valueType, &value);
+                if (error.isValid())
+                    qCDebug(logPendingCall) << "call to" << result->m_method << "failed with error" << error;
+                // The result holds itself until it finishes on the thread that made the call
+                QMetaObject::invokeMethod(result.data(), [result, reply, value, error]() {
+                    result->finish(reply, value, error);
+                }, Qt::QueuedConnection);
+                w->deleteLater();
+                if (--*remaining == 0)
+                    context->deleteLater();
+            });
+        }
+    }, Qt::QueuedConnection);
+    return results;
+}
+
+} // namespace DBusWrapper
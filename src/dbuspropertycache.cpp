@@ -1,14 +1,25 @@
 #include "dbuspropertycache_p.h"
 #include "dbusutilities.h"
+#include "dbustrace_p.h"
 #include <QDBusMessage>
 #include <QDBusPendingReply>
 #include <QDBusVariant>
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QDBusObjectPath>
 #include <QLoggingCategory>
 #include <QCoreApplication>
 #include <QThread>
 #include <QThreadStorage>
 #include <QMutex>
 #include <QTimer>
+#include <QRandomGenerator>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <list>
+#include <vector>
+#include <utility>
 
 /*!
   \class DBusWrapper::PropertyCache
@@ -72,6 +83,23 @@
     }
   \endcode
 
+  QtDBus leaves values of complex types, such as structs, arrays of structs, and dictionaries, in their marshalled
+  form as a \l{QDBusArgument}. \l{get<T>} demarshals them for any type registered with \c{qDBusRegisterMetaType()}
+  the first time they are read, and every instance on every thread shares the decoded value until the property
+  changes. Values that are never read are never demarshalled.
+
+  \section3 Property handles
+  Code that reads properties very frequently can use a \l{PropertyHandle} instead of a string. Handles are interned
+  names that can be created once with \l{handle()} and then looked up without comparing strings:
+
+  \code
+    static const auto speed = DBusWrapper::PropertyCache::handle("Speed");
+    return m_properties->get<double>(speed);
+  \endcode
+
+  The \l{propertyHandleChanged} signal is emitted along with every \l{propertyChanged} signal and carries the handle
+  instead of the name, allowing consumers to compare integers rather than strings.
+
   \section2 Signals
 
   When data becomes available, PropertyCache will:
@@ -105,15 +133,27 @@
 
   \list
     \li \l{set} is asynchronous and \e{does not immediately update the value}.
-    \li \l{set} can fail and does not report any errors.
+    \li \l{set} can fail, which is only reported by its result.
     \li The service can choose to do nothing or to use a different value.
   \endlist
 
   In other words, \l{set} \e{requests} that the service change the value, but it does not actually change unless/until
   the service emits the PropertiesChanged DBus signal.
 
-  \note
-  We plan to allow \l{set} to return an asynchronous result in the future.
+  \l{set} returns a \l{PendingSet}, which reports the result of the call:
+
+  \code
+    auto result = m_properties->set("Brightness", 50);
+    connect(result.get(), &DBusWrapper::PendingSet::finished, this, [](const QDBusError& error) { ... });
+  \endcode
+
+  Interactive controls, like sliders, can change a value much faster than the service can apply it. Use
+  \l{SetMode::Coalesced} to keep at most one call in flight for each property, sending only the latest value when
+  the previous call finishes:
+
+  \code
+    m_properties->set("Brightness", slider->value(), DBusWrapper::PropertyCache::SetMode::Coalesced);
+  \endcode
 
   \section1 Advanced Usage
   \section2 Multi-threaded applications
@@ -129,6 +169,34 @@
   These restrictions are common for many QObject-derived types. For example, using QTimer or queued signal connections
   also requires an event loop. The Qt documentation on \l{Threads and QObjects} explains this in more detail.
 
+  \section3 Threads without an event loop
+  Threads that can't run an event loop, such as QtConcurrent workers, can read properties with a
+  \l{PropertySnapshotReader} instead. It holds the latest snapshot published by the backend and moves to a newer one
+  when \l{PropertySnapshotReader::update()}{update()} is called, without locking a mutex:
+
+  \code
+    DBusWrapper::PropertySnapshotReader reader(target);
+    for (const auto& sample : samples) {
+        reader.update();
+        process(sample, reader.get<double>("Speed"));
+    }
+  \endcode
+
+  All values read between two updates come from the same snapshot, so they are consistent with each other in the
+  same way as \l{Atomic signals}. Readers have no signals, and share loaded data with PropertyCache on every thread.
+
+  \section3 Backend threads
+  All DBus calls and signals are handled on internal backend threads, not on the threads that use PropertyCache. By
+  default there is a single backend thread; \l{setBackendThreadCount()} spreads services across more of them, and
+  \l{setServicePriority()} gives important services a thread of their own.
+
+  Updates from the backend threads are collected for each thread that uses PropertyCache and delivered in a single
+  event, in the order they happened. A thread using many targets therefore wakes up once for a burst of changes, such
+  as when a service restarts, rather than once for each target.
+
+  Method calls made with \l{Target::callAsync()} also have their replies received and decoded on the backend thread
+  for the service, and only finish on the calling thread.
+
   \section3 Singletons
   Historically, a common pattern has been to create a singleton type to provide information from a DBus interface, such
   as in libvehicle. \e{This is fundamentally unsafe} in a multi-threaded application: even if each individual function
@@ -142,6 +210,14 @@
   avoid redundant DBus activity. This means that constructing a PropertyCache does not require any DBus calls if that
   data exists anywhere else in the process.
 
+  Data for a few recently used targets is also kept after their last PropertyCache is destroyed. Applications that
+  frequently recreate caches for many targets can tune this with \l{setRetentionLimits()} and
+  \l{retentionStatistics()}.
+
+  Properties are stored compactly, so a process can watch thousands of targets: each target's values are kept in a
+  single sorted array, and property names are shared by every target that has them. \l{getAll()} builds a
+  QVariantMap from this on each call, so reading individual properties with \l{get()} is cheaper.
+
   However, a newly constructed PropertyCache is \e{always} uninitialized, even if the data could be available
   immediately. This allows you to connect signals before data is initialized and have consistent behavior in all cases.
   PropertyCache will initialize using the shared data and emit signals after the thread returns to the event loop.
@@ -167,6 +243,73 @@
     }
   \endcode
 
+  \section3 Preloading
+  Applications that know at startup which targets they will use can load them together with \l{preload()}, which
+  sends all of their DBus calls at once and signals when everything is loaded:
+
+  \code
+    auto preload = DBusWrapper::PropertyCache::preload(targets, this);
+    connect(preload, &DBusWrapper::PropertyCachePreload::ready, this, &Application::createViews);
+  \endcode
+
+  Caches constructed on the same thread after \l{PropertyCachePreload::ready()} can \l{initialize()} immediately.
+
+  \section3 Resuming
+  A consumer that destroys its cache and creates another one later normally receives \l{propertiesReset()} and a
+  \l{propertyChanged()} for every property again. Instead, it can remember \l{sequence()} before destroying the cache
+  and pass it to \l{initialize()} on the new one. If the data is still shared or kept unused (see
+  \l{setRetentionLimits()}), the new cache then signals only the properties that changed since that sequence, with
+  their current values, and skips \l{propertiesReset()}:
+
+  \code
+    m_properties = new DBusWrapper::PropertyCache(target, this);
+    connect(m_properties, &DBusWrapper::PropertyCache::propertyChanged, this, &View::onPropertyChanged);
+    m_properties->initialize(m_lastSequence);
+  \endcode
+
+  Each target remembers the properties changed by its latest \l{journalCapacity()} versions. If the sequence is older
+  than that, or the data was discarded in between, the new cache falls back to the full signals.
+
+  \section2 Object managers
+  Services that publish many objects often implement the standard
+  \l{https://dbus.freedesktop.org/doc/dbus-specification.html#standard-interfaces-objectmanager}{org.freedesktop.DBus.ObjectManager}
+  interface. By default, every PropertyCache loads its properties with a separate \c{GetAll} call, so creating caches
+  for hundreds of objects on the same service costs hundreds of round-trips.
+
+  Calling \l{setObjectManager()} before creating any PropertyCache for a service changes that: all caches for objects
+  below the manager's path are loaded together by a single \c{GetManagedObjects} call, and are kept up to date by the
+  \c{InterfacesAdded} and \c{InterfacesRemoved} signals.
+
+  \code
+    DBusWrapper::PropertyCache::setObjectManager(QDBusConnection::systemBus(), "org.bluez", "/");
+  \endcode
+
+  If the service does not implement ObjectManager at that path, PropertyCache falls back to loading each object
+  individually. Behavior and signals are otherwise identical in both modes.
+
+  \section2 Invalidated properties
+  Instead of sending a new value, PropertiesChanged may list a property as invalidated. This is common for large
+  values, like arrays. PropertyCache marks invalidated properties as stale (see \l{isStale()}) and fetches each one
+  with a \c{Get} call; \l{propertyChanged()} is emitted when the new value arrives, if it is different. Until then,
+  \l{get()} returns the last known value, so the guarantees in \l{Consistency} still hold.
+
+  For properties that are expensive to transfer and not always needed, \l{setLazyProperties()} delays the \c{Get}
+  until the stale property is actually read with \l{get()} or \l{getAll()}:
+
+  \code
+    DBusWrapper::PropertyCache::setLazyProperties(target, {"Thumbnail"});
+  \endcode
+
+  \section2 Warm start
+  At startup, services may take a long time to reply, or may not be running yet. \l{setSnapshotStore()} keeps the last
+  known properties of each target in a file, so a PropertyCache created for one of those targets is available
+  immediately, and \l{initialize()} succeeds without any DBus calls.
+
+  Until the service replies, \l{isRevalidating()} is true. The properties are then updated like any other change:
+  \l{propertyChanged()} is emitted only for the values that are different, followed by \l{revalidated()}. If the
+  service isn't running, the stored values stay in use until it starts. Targets with values that can't be stored
+  (such as types that are demarshalled as \l{QDBusArgument}) are not stored.
+
   \section2 Consistency
   PropertyCache guarantees a consistent view of data (as provided by the service) at all times. Specifically:
   \list
@@ -186,6 +329,58 @@
   values at all times, and signals emitted by these instances are interleaved. In other words, if two properties change,
   all instances on the thread will apply both changes, then each will emit propertyChanged for the first property, and
   finally each will emit propertyChanged for the second property.
+
+  \section2 Coalescing changes
+  Some services change properties much faster than a user interface needs to follow them. Constructing
+  PropertyCache with a \l{CoalescingPolicy} merges changes that arrive in quick succession, and emits
+  \l{propertyChanged()} only once for the latest value of each property:
+
+  \code
+    // Emit at most 10 batches of changes per second
+    DBusWrapper::PropertyCache cache(target, DBusWrapper::CoalescingPolicy::interval(100));
+  \endcode
+
+  Intermediate values are never observed, and properties that change back to their previous value do not emit
+  signals. All changes in a batch still apply simultaneously before any signal, so the guarantees of
+  \l{Atomic signals} extend to the whole batch. Instances with the same target and policy on the same thread share
+  data as described in \l{Per-thread consistency}; instances with different policies do not.
+
+  \section2 Watching properties
+  Objects with many frequently changing properties wake up every thread that uses them, even if a thread only
+  displays one of the properties. Constructing PropertyCache with a list of watched properties limits it to those
+  properties:
+
+  \code
+    DBusWrapper::PropertyCache cache(target, {"Position", "Status"});
+  \endcode
+
+  Other properties are not returned by \l{get()} or \l{getAll()} and never signalled. Changes that don't affect any
+  watched property are dropped on the backend thread without waking up this thread. Instances watching the same
+  properties on the same thread share data; instances watching different properties do not, and their signals are
+  not interleaved as described in \l{Per-thread consistency}. This can be combined with a \l{CoalescingPolicy}.
+
+  \section2 Monitoring
+  \l{statistics()} returns counters for the DBus activity of all caches, and \l{statistics(const Target&)} for a
+  single target: load counts and latencies, signals received and ignored while loading, changes delivered to each
+  thread, and deliveries that are still queued. They are always collected without logging, so slow services and
+  targets with a large fan-out can be found in production.
+
+  For the latency of individual changes, a library built with \c{-DDBUSWRAPPER_TRACING=ON} can record a timeline
+  with \l{Trace}: each load and change is followed from the call or signal through the backend thread to the signals
+  on every thread, and exported in the Chrome trace format for \c{chrome://tracing} or Perfetto.
+
+  \section2 Coroutines
+  Code built with C++20 coroutines can include \c{dbuscoroutines.h} to await initialization, the result of \l{set()},
+  and \l{Target::callAsync()} instead of connecting to signals. Coroutines resume on the thread that awaits, and
+  \l{whenAll()} waits for several of them at once:
+
+  \code
+    if (!co_await DBusWrapper::untilReady(cache))
+        co_return;
+    auto [error, reply] = co_await DBusWrapper::whenAll(cache.set("Mode", 2), target.callAsync<int>("Apply"));
+  \endcode
+
+  The library itself doesn't require C++20.
  */
 
 namespace DBusWrapper {
@@ -207,30 +402,139 @@ Q_LOGGING_CATEGORY(logCacheInternal, "dbuswrapper.propertycache.internal", QtWar
 //   - data is consistent between multiple PropertyCache instances on the same thread, even during signals
 //
 // Finally, there's an instance of PropertyCacheBackend for each target, shared by all threads. The backend objects
-// live on the dedicated `backendThread`, where they manage all DBus activity and emit signals to the ThreadData
+// live on one of the dedicated backend threads, where they manage all DBus activity and emit signals to the ThreadData
 // instances.
 //
+// The backend threads are a small pool, created on demand. All backends for a (bus, service) live on the same thread
+// as their PropertyCacheService, chosen by a hash of (bus, service). Services with an explicit priority instead share
+// a separate thread for that priority, so they're isolated from services that are slow or flood signals.
+//
+// Backend data is published as immutable, versioned PropertySnapshot instances. Each change creates a new snapshot
+// holding the complete properties (sharing QVariantMap data where possible) and the changes since the last version.
+// ThreadData instances adopt the snapshot by reference instead of copying and merging values on every thread.
+// Backends also keep a bounded journal of the properties changed by recent versions, so a new PropertyCache can
+// resume from a version a previous one had and signal only what changed since.
+//
 // Each PropertyCacheThreadData holds a QSharedPointer reference to the backend. When there are no remaining references,
-// the backend is _not_ deleted immediately. Instead, ownership is transferred to the 'unusedCacheBackends' list, which
-// keeps a number of recently-unused backends alive in case they're needed again. This helps avoid expensive DBus calls
-// in certain situations.
+// the backend is _not_ deleted immediately. Instead, ownership is transferred to the 'unusedCacheBackends' LRU list,
+// which keeps recently-unused backends alive in case they're needed again. This helps avoid expensive DBus calls in
+// certain situations.
+//
+// When the unusedCacheBackends list exceeds the RetentionLimits capacity or memory budget, the least recently used
+// items are scheduled for deletion on their backend thread. Items are also deleted after the idle timeout, if any.
 //
-// When the unusedCacheBackends list is full, the oldest item is scheduled for deletion from the backendThread.
+// Backends for the same (bus, service) also share a PropertyCacheService, which lives on their backend thread and holds
+// per-service state. It installs a single PropertiesChanged match rule for the whole service and routes each signal
+// to the backend for its (path, interface). If the service has an ObjectManager configured, PropertyCacheService also
+// loads all of its backends with a single GetManagedObjects call and forwards InterfacesAdded/InterfacesRemoved.
+// Reloads after the service restarts or a load fails are scheduled by the service, which merges requests for the same
+// backend and starts them in bursts according to the ReloadPolicy.
 
 // Holds a per-thread map of property cache data. This is safe to access from the associated thread without locking.
-static QThreadStorage<QHash<Target, QWeakPointer<PropertyCacheThreadData>>> cacheThreadData;
+// Caches with different coalescing policies or watched properties have separate data, because they see changes at
+// different times.
+struct ThreadDataKey
+{
+    Target target;
+    CoalescingPolicy coalescing;
+    QStringList watched;
+
+    bool operator==(const ThreadDataKey& other) const
+    {
+        return target == other.target && coalescing == other.coalescing && watched == other.watched;
+    }
+    friend uint qHash(const ThreadDataKey& key, uint seed = 0) noexcept
+    {
+        QtPrivate::QHashCombine hash;
+        seed = hash(seed, key.target);
+        seed = hash(seed, key.coalescing);
+        seed = hash(seed, key.watched);
+        return seed;
+    }
+};
+static QThreadStorage<QHash<ThreadDataKey, QWeakPointer<PropertyCacheThreadData>>> cacheThreadData;
+// Dispatcher of each thread, shared by its PropertyCacheThreadData
+static QThreadStorage<QWeakPointer<PropertyCacheDispatcher>> threadDispatchers;
 
-static std::unique_ptr<QThread> backendThread;
 static QMutex backendsMutex;
+// Owns all backend threads that have been started. Must hold backendsMutex to access.
+static std::vector<std::unique_ptr<QThread>> backendThreads;
+// Threads for the hashed pool, which are null until started, and for each explicit priority. Must hold backendsMutex
+// to access.
+static int backendThreadCount = 1;
+static QVector<QThread*> backendThreadPool;
+static QHash<int, QThread*> priorityThreads;
+// Holds the priority for each (bus, service) set by PropertyCache::setServicePriority. Must hold backendsMutex to
+// access.
+static QHash<QPair<QString, QString>, QThread::Priority> servicePriorities;
+// Set by PropertyCache::setReloadPolicy. Must hold backendsMutex to access.
+static PropertyCache::ReloadPolicy backendReloadPolicy;
+// Set by PropertyCache::setJournalCapacity. Must hold backendsMutex to access.
+static int backendJournalCapacity = 64;
+// Counts backends created in the process, for the high bits of their versions. Must hold backendsMutex to access.
+static quint32 backendEpoch = 0;
+// The store set by PropertyCache::setSnapshotStore, if any. Must hold backendsMutex to access.
+static QSharedPointer<PropertySnapshotStore> snapshotStore;
 // Holds weak references to all referenced PropertyCacheBackend instances. Must hold backendsMutex to access.
 static QHash<DBusWrapper::Target, QWeakPointer<PropertyCacheBackend>> cacheBackends;
-// Holds all unreferenced PropertyCacheBackend instances. Must hold backendsMutex to access.
-static constexpr int unusedCacheCapacity = 5;
-static QVarLengthArray<DBusWrapper::PropertyCacheBackend*, unusedCacheCapacity> unusedCacheBackends;
+// Counters of all backends over the lifetime of the process
+static PropertyCacheMetrics globalMetrics;
+// Holds all unreferenced PropertyCacheBackend instances, most recently released first, and an index of them by target.
+// Must hold backendsMutex to access.
+struct UnusedBackend
+{
+    PropertyCacheBackend* backend;
+    // Approximate size of the backend's data, for the memory budget
+    qint64 size;
+    QElapsedTimer released;
+};
+using UnusedBackendList = std::list<UnusedBackend>;
+static UnusedBackendList unusedCacheBackends;
+static QHash<DBusWrapper::Target, UnusedBackendList::iterator> unusedCacheIndex;
+static qint64 unusedCacheSize = 0;
+static PropertyCache::RetentionLimits unusedCacheLimits;
+static PropertyCache::RetentionStatistics unusedCacheStatistics;
+static void trimUnusedBackends();
+static void scheduleExpiry(PropertyCacheBackend* backend, qint64 msec);
+// Holds weak references to the PropertyCacheService for each (bus, service). Must hold backendsMutex to access.
+static QHash<QPair<QString, QString>, QWeakPointer<PropertyCacheService>> cacheServices;
+// Holds the ObjectManager path for each (bus, service) set by PropertyCache::setObjectManager. Must hold
+// backendsMutex to access.
+static QHash<QPair<QString, QString>, QString> objectManagerPaths;
+// Holds the properties of each target that are only fetched on demand after they're invalidated, set by
+// PropertyCache::setLazyProperties. Must hold backendsMutex to access.
+static QHash<Target, QSet<QString>> lazyProperties;
+
+void PendingSet::finish(const QDBusError& error)
+{
+    m_finished = true;
+    m_error = error;
+    emit finished(error);
+}
 
 PropertyCache::PropertyCache(const Target& target, QObject *parent)
+    : PropertyCache(target, CoalescingPolicy(), parent)
+{
+}
+
+PropertyCache::PropertyCache(const Target& target, CoalescingPolicy coalescing, QObject *parent)
+    : QObject(parent)
+    , d(new PropertyCachePrivate(this, target, coalescing, QStringList()))
+{
+}
+
+/*!
+  \brief Creates a cache for \a{target} that only holds and signals \a{watchedProperties}.
+
+  Other properties are never returned by \l{get()} or \l{getAll()} and never signalled, and changes that only affect
+  them don't wake up this thread at all. An empty list watches all properties.
+
+  \sa {Watching properties}
+ */
+PropertyCache::PropertyCache(const Target& target, const QStringList& watchedProperties, CoalescingPolicy coalescing,
+                             QObject *parent)
     : QObject(parent)
-    , d(new PropertyCachePrivate(this, target))
+    , d(new PropertyCachePrivate(this, target, coalescing, watchedProperties))
 {
 }
 
@@ -254,6 +558,19 @@ const Target& PropertyCache::target() const
     return d->data->m_target;
 }
 
+CoalescingPolicy PropertyCache::coalescing() const
+{
+    return d->data->m_coalescing;
+}
+
+/*!
+  \brief Returns the sorted names of the properties this cache watches, or an empty list if it watches all properties.
+ */
+QStringList PropertyCache::watchedProperties() const
+{
+    return d->data->m_watched;
+}
+
 QDBusConnection PropertyCache::bus() const
 {
     return d->data->m_target.bus();
@@ -278,13 +595,54 @@ bool PropertyCache::initialize()
     return (d->data->m_available || d->data->m_error.isValid());
 }
 
+/*!
+  \brief Initializes like \l{initialize()}, but only signals the properties that changed after \a{sequence}.
+
+  \a{sequence} is a value previously returned by \l{sequence()} from any cache for the same target. If the changes
+  since then are no longer known, this emits the same signals as \l{initialize()}.
+
+  \sa {Resuming}
+ */
+bool PropertyCache::initialize(quint64 sequence)
+{
+    d->initialize(sequence);
+    return (d->data->m_available || d->data->m_error.isValid());
+}
+
+/*!
+  \brief Returns the sequence number of the data this cache has, or 0 if it isn't initialized.
+
+  The sequence increases with every change of the target and can be passed to \l{initialize()} on a later cache to
+  resume from this point.
+ */
+quint64 PropertyCache::sequence() const
+{
+    return d->initialized ? d->data->m_snapshot->version : 0;
+}
+
 QVariant PropertyCache::get(const QString& property) const
 {
     if (!d->initialized)
         return {};
+    d->data->fetchIfStale(property);
     return d->data->m_properties.value(property);
 }
 
+/*!
+  \brief Returns the cached value of \a{property} as the metatype \a{type}.
+
+  If the value is still marshalled as a \l{QDBusArgument} with the DBus signature of \a{type}, it is demarshalled
+  once and shared with every other reader until the property changes. Other values are returned unchanged, and
+  can be converted with QVariant::value(). This is used by \l{get<T>}.
+ */
+QVariant PropertyCache::get(const QString& property, int type) const
+{
+    const QVariant value = get(property);
+    if (value.userType() != qMetaTypeId<QDBusArgument>() || value.userType() == type)
+        return value;
+    return d->data->decode(PropertyHandle(property), value, type);
+}
+
 bool PropertyCache::contains(const QString& property) const
 {
     if (!d->initialized)
@@ -296,243 +654,1514 @@ QVariantMap PropertyCache::getAll() const
 {
     if (!d->initialized)
         return {};
-    return d->data->m_properties;
+    for (const auto& property : d->data->m_snapshot->stale)
+        d->data->fetchIfStale(property);
+    return d->data->propertiesMap();
 }
 
-void PropertyCache::set(const QString& property, const QVariant& value)
-{
-    const auto& target = d->data->m_target;
-    auto msg = target.withInterface(k_property_interface).createMethodCall("Set",
-                                                      target.interface(),
-                                                      property,
-                                                      value);
-    auto reply = target.bus().asyncCall(msg);
-    auto pendingSet = new QDBusPendingCallWatcher(reply, this);
-    connect(pendingSet, &QDBusPendingCallWatcher::finished, this, [this, property](QDBusPendingCallWatcher *w){
-        w->deleteLater();
+/*!
+  \brief Returns true if \a{property} was invalidated by the service and its new value hasn't been fetched yet.
 
-        QDBusPendingReply<> reply = *w;
-        if (reply.isError()) {
-            qCWarning(logPropertyCache) << "failed to set property" << property << "for" << d->data->m_target << "with error" << reply.error();
-        }
-    });
-}
+  While a property is stale, \l{get()} returns its last known value. \l{propertyChanged()} is emitted when the new
+  value arrives, if it is different.
 
-bool PropertyCache::event(QEvent* ev)
+  \sa {Invalidated properties}
+ */
+bool PropertyCache::isStale(const QString& property) const
 {
-    if (ev->type() == QEvent::ThreadChange) {
-        qCCritical(logPropertyCache) << "BUG: thread changed for" << this << "on" << d->data->m_target
-            << "- PropertyCache does not support moveToThread";
-    }
-    return QObject::event(ev);
+    if (!d->initialized)
+        return false;
+    return d->data->m_snapshot->stale.contains(property) && d->data->isWatched(property);
 }
 
-PropertyCachePrivate::PropertyCachePrivate(PropertyCache* q, const Target& target)
-    : q(q), data(PropertyCacheThreadData::localInstance(target))
-{
-    qCDebug(logCacheInternal) << "created PropertyCache for" << target << "on" << q->thread();
-    // If data is _not_ available, initializing just connects the signals, so it can happen immediately.
-    //
-    // If there's already data, pretend it doesn't exist yet and initialize on the next loop. This gives
-    // the caller time to connect their own signals and get consistent behavior.
-    if (!data->m_available && !data->m_error.isValid()) {
-        initialize();
-    } else {
-        QMetaObject::invokeMethod(q, [this]() { initialize(); }, Qt::QueuedConnection);
-    }
-}
+/*!
+  \brief Returns true if the properties were loaded from the snapshot store and the service hasn't confirmed them yet.
 
-PropertyCachePrivate::~PropertyCachePrivate()
+  \l{revalidated()} is emitted when that changes, after any signals for properties that were different.
+
+  \sa {Warm start}
+ */
+bool PropertyCache::isRevalidating() const
 {
-    qCDebug(logCacheInternal) << "destroyed PropertyCache for" << data->m_target;
+    if (!d->initialized)
+        return false;
+    return d->data->m_snapshot->revalidating;
 }
 
-void PropertyCachePrivate::initialize()
-{
-    if (initialized)
-        return;
+/*!
+  \brief Returns the interned handle for \a{property}.
 
-    QObject::connect(data.get(), &PropertyCacheThreadData::availableChanged, q, &PropertyCache::availableChanged);
-    QObject::connect(data.get(), &PropertyCacheThreadData::errorChanged, q, &PropertyCache::errorChanged);
-    QObject::connect(data.get(), &PropertyCacheThreadData::ready, q, &PropertyCache::ready);
-    QObject::connect(data.get(), &PropertyCacheThreadData::lost, q, &PropertyCache::lost);
-    QObject::connect(data.get(), &PropertyCacheThreadData::propertyChanged, q, &PropertyCache::propertyChanged);
-    QObject::connect(data.get(), &PropertyCacheThreadData::propertiesReset, q, &PropertyCache::propertiesReset);
-    initialized = true;
-    if (data->m_error.isValid())
-        emit q->errorChanged(data->m_error);
-    if (!data->m_available)
-        return;
+  Handles are the same for all instances of PropertyCache, so they can be created once (e.g. as a static) and
+  used with \l{get(PropertyHandle)} and \l{contains(PropertyHandle)} to avoid string comparisons on every lookup.
+  The \l{propertyHandleChanged} signal also carries the handle.
 
-    // Emit signals in the same order as PropertyCacheData::resetProperties
-    emit q->availableChanged(true);
-    emit q->propertiesReset(data->m_properties);
-    for (auto it = data->m_properties.constBegin(); it != data->m_properties.constEnd(); it++) {
-        emit q->propertyChanged(it.key(), it.value());
-    }
-    emit q->ready();
+  \code
+    static const auto brightness = DBusWrapper::PropertyCache::handle("Brightness");
+    int value = m_properties->get<int>(brightness);
+  \endcode
+ */
+PropertyHandle PropertyCache::handle(const QString& property)
+{
+    return PropertyHandle(property);
 }
 
-QSharedPointer<PropertyCacheThreadData> PropertyCacheThreadData::localInstance(const Target& target)
+QVariant PropertyCache::get(PropertyHandle property) const
 {
-    auto& instances = cacheThreadData.localData();
-    auto it = instances.find(target);
-    if (it != instances.end()) {
-        if (auto ref = it->toStrongRef())
-            return ref;
-    }
-    auto ref = QSharedPointer<PropertyCacheThreadData>::create(target);
-    instances.insert(target, ref.toWeakRef());
-    return ref;
+    if (!d->initialized)
+        return {};
+    return d->data->value(property);
 }
 
-PropertyCacheThreadData::PropertyCacheThreadData(const Target& target)
-    : m_backend(PropertyCacheBackend::instance(target)), m_target(target)
+/*!
+  \brief Returns the cached value of \a{property} as the metatype \a{type}.
+
+  \sa get(const QString&, int)
+ */
+QVariant PropertyCache::get(PropertyHandle property, int type) const
 {
-    qCDebug(logCacheInternal) << "created" << this << "for" << m_target << "on" << thread();
-    QMutexLocker lock(&m_backend->m_dataMutex);
-    connect(m_backend.get(), &PropertyCacheBackend::reset, this, &PropertyCacheThreadData::reset);
-    connect(m_backend.get(), &PropertyCacheBackend::changeProperties, this, &PropertyCacheThreadData::changeProperties);
-    m_properties = m_backend->m_properties;
-    m_error = m_backend->m_error;
-    m_available = m_backend->m_available;
-    lock.unlock();
+    const QVariant value = get(property);
+    if (value.userType() != qMetaTypeId<QDBusArgument>() || value.userType() == type)
+        return value;
+    return d->data->decode(property, value, type);
 }
 
-PropertyCacheThreadData::~PropertyCacheThreadData()
+bool PropertyCache::contains(PropertyHandle property) const
 {
-    qCDebug(logCacheInternal) << "destroyed" << this << "for" << m_target << "on" << thread();
-    auto weakRef = cacheThreadData.localData().take(m_target);
-    Q_ASSERT(weakRef.isNull());
-    Q_UNUSED(weakRef);
+    return get(property).isValid();
 }
 
-void PropertyCacheThreadData::reset(const QVariantMap& values, const QDBusError& error)
+quint64 PropertyCache::revision(PropertyHandle property) const
 {
-    bool available = !error.isValid();
-    Q_ASSERT(available || values.isEmpty());
-
-    // The order here is very specific:
-    //   1. Update state internally
-    //   2. Emit availableChanged and errorChanged if appropriate
-    //   3. Emit propertiesReset and lost
-    //   4. Emit propertyChanged as needed
-    //   5. Emit ready
-    bool wasAvailable = m_available;
-    QVariantMap before = m_properties;
-    bool errorChange = (m_error.type() != error.type());
+    if (!d->initialized)
+        return 0;
+    return d->data->revision(property);
+}
 
-    m_available = available;
-    m_error = error;
-    m_properties = values;
+/*!
+  \brief Requests that the service change \a{property} to \a{value}.
 
-    if (wasAvailable != m_available)
-        emit availableChanged(m_available);
-    if (errorChange)
-        emit errorChanged(error);
-    if (!values.isEmpty() || !before.isEmpty())
-        emit propertiesReset(m_properties);
+  Returns a \l{PendingSet} that finishes when the service replies. Failures are also logged as warnings.
 
-    for (auto it = m_properties.constBegin(); it != m_properties.constEnd(); it++) {
-        auto beforeIt = before.constFind(it.key());
-        if (beforeIt == before.constEnd() || beforeIt.value() != it.value()) {
-            emit propertyChanged(it.key(), it.value());
-        }
-    }
-    for (auto it = before.constBegin(); it != before.constEnd(); it++) {
-        if (!m_properties.contains(it.key())) {
-            emit propertyChanged(it.key(), QVariant());
-        }
-    }
+  With \l{SetMode::Coalesced}, at most one \c{Set} call is in flight for the property from this thread. Writes made
+  while a call is pending replace each other, and only the latest value is sent once the pending call finishes.
 
-    if (wasAvailable && !m_available)
-        emit lost();
-    if (!wasAvailable && m_available)
-        emit ready();
+  \sa {Setting properties}
+ */
+QSharedPointer<PendingSet> PropertyCache::set(const QString& property, const QVariant& value, SetMode mode)
+{
+    return d->data->set(property, value, mode);
 }
 
-void PropertyCacheThreadData::changeProperties(const QVariantMap& values)
+/*!
+  \brief Loads properties for \a{service} on \a{bus} from the ObjectManager at \a{path}.
+
+  PropertyCache instances for objects below \a{path} will share a single \c{GetManagedObjects} call instead of
+  loading properties separately. This must be called before any PropertyCache is created for \a{service}; it does
+  not affect caches that already exist. An empty \a{path} restores the default behavior.
+
+  \sa {Object managers}
+ */
+void PropertyCache::setObjectManager(const QDBusConnection& bus, const QString& service, const QString& path)
 {
-    // Update all values before sending any signals
-    for (auto it = values.constBegin(); it != values.constEnd(); it++)
-        m_properties[it.key()] = it.value();
-    for (auto it = values.constBegin(); it != values.constEnd(); it++)
-        emit propertyChanged(it.key(), it.value());
+    QMutexLocker l(&backendsMutex);
+    const auto key = qMakePair(bus.name(), service);
+    if (path.isEmpty())
+        objectManagerPaths.remove(key);
+    else
+        objectManagerPaths.insert(key, path);
 }
 
-static void backendReleased(DBusWrapper::PropertyCacheBackend* backend)
+/*!
+  \brief Fetches \a{properties} of \a{target} only on demand after the service invalidates them.
+
+  By default, a property invalidated by PropertiesChanged is fetched again immediately. Properties listed here stay
+  stale until they are read, so values that are never used are never transferred. This applies to invalidations
+  received after the call. An empty list restores the default behavior.
+
+  \sa {Invalidated properties}, isStale()
+ */
+void PropertyCache::setLazyProperties(const Target& target, const QStringList& properties)
 {
     QMutexLocker l(&backendsMutex);
-    qCDebug(logCacheInternal) << "released" << backend << "for" << backend->m_target << "to unreferenced cache";
-    // remove the dead weak pointer
-    auto it = cacheBackends.find(backend->m_target);
-    if (it != cacheBackends.end() && it->isNull())
-        cacheBackends.erase(it);
-    // transfer ownership of the instance to the unused list
-    while (unusedCacheBackends.size() >= unusedCacheCapacity) {
-        unusedCacheBackends.last()->deleteLater();
-        unusedCacheBackends.removeLast();
+    if (properties.isEmpty()) {
+        lazyProperties.remove(target);
+        return;
     }
-    unusedCacheBackends.prepend(backend);
+    QSet<QString>& lazy = lazyProperties[target];
+    lazy.clear();
+    for (const auto& property : properties)
+        lazy.insert(property);
 }
 
-QSharedPointer<PropertyCacheBackend> PropertyCacheBackend::instance(const Target& target)
+/*!
+  \brief Sets the limits for keeping data of targets that no PropertyCache uses anymore.
+
+  When the last instance for a target is destroyed, its data is kept (and kept up to date) for a while, so a new
+  instance for the same target can initialize immediately without any DBus calls. Unused targets are discarded,
+  least recently used first, when there are more than \c{capacity} of them or their approximate size exceeds
+  \c{memoryBudget}. They are also discarded when they have been unused for \c{idleTimeout} milliseconds.
+
+  By default, five unused targets are kept with no memory budget or idle timeout. Lowering the limits discards
+  unused targets immediately.
+
+  \sa retentionStatistics(), {Shared data}
+ */
+void PropertyCache::setRetentionLimits(const RetentionLimits& limits)
 {
     QMutexLocker l(&backendsMutex);
-    // Search the existing referenced backends
-    auto it = cacheBackends.find(target);
-    if (it != cacheBackends.end()) {
-        if (auto ref = it->toStrongRef())
-            return ref;
+    unusedCacheLimits = limits;
+    trimUnusedBackends();
+    if (limits.idleTimeout >= 0) {
+        for (const auto& unused : unusedCacheBackends)
+            scheduleExpiry(unused.backend, limits.idleTimeout - unused.released.elapsed());
     }
+}
 
-    // Search the cache of unreferenced backends and restore if found
-    for (int i = 0; i < unusedCacheBackends.size(); i++) {
-        auto cachedBackend = unusedCacheBackends[i];
-        if (cachedBackend->m_target == target) {
-            unusedCacheBackends.remove(i);
-            qCDebug(logCacheInternal) << "restored backend" << cachedBackend << "from unused cache for" << target;
-            QSharedPointer<PropertyCacheBackend> ref(cachedBackend, &backendReleased);
-            cacheBackends.insert(target, ref.toWeakRef());
-            return ref;
-        }
-    }
+static void saveSnapshotStore()
+{
+    QMutexLocker l(&backendsMutex);
+    if (snapshotStore)
+        snapshotStore->save();
+}
+
+/*!
+  \brief Keeps the last known properties of every target in \a{fileName}, to use them immediately at startup.
+
+  This should be called early, before any PropertyCache is created; it does not affect caches that already exist.
+  Changes are written shortly after they happen and when the application exits, from the thread that called this
+  function, which must run an event loop. An empty \a{fileName} disables the store.
+
+  \sa {Warm start}, isRevalidating()
+ */
+void PropertyCache::setSnapshotStore(const QString& fileName)
+{
+    QMutexLocker l(&backendsMutex);
+    if (snapshotStore && snapshotStore->m_fileName == fileName)
+        return;
+    if (snapshotStore)
+        snapshotStore->save();
+    static bool postRoutineAdded = false;
+    if (!fileName.isEmpty() && !postRoutineAdded) {
+        qAddPostRoutine(saveSnapshotStore);
+        postRoutineAdded = true;
+    }
+    snapshotStore.reset();
+    if (!fileName.isEmpty())
+        snapshotStore = QSharedPointer<PropertySnapshotStore>(new PropertySnapshotStore(fileName), &QObject::deleteLater);
+}
+
+/*!
+  \brief Starts loading all of \a{targets} at once, and returns an object that keeps them loaded.
+
+  The backends for all targets are created or restored from the retained data in one pass, and their GetAll calls
+  are sent together instead of one at a time as each PropertyCache is constructed. The returned object emits
+  \l{PropertyCachePreload::ready()} once every target has finished loading.
+
+  While the returned object exists, PropertyCache instances for these targets created on the calling thread with the
+  default CoalescingPolicy share its data, and \l{initialize()} succeeds immediately after it's ready. The object is
+  owned by \a{parent}, or by the caller if there is no parent.
+
+  \sa {Preloading}
+ */
+PropertyCachePreload* PropertyCache::preload(const QList<Target>& targets, QObject* parent)
+{
+    return new PropertyCachePreload(targets, parent);
+}
+
+PropertyCachePreload::PropertyCachePreload(const QList<Target>& targets, QObject* parent)
+    : QObject(parent)
+    , d(new PropertyCachePreloadPrivate)
+{
+    d->targets = targets;
+    d->data = PropertyCacheThreadData::localInstances(targets);
+    for (const auto& data : qAsConst(d->data)) {
+        connect(data.get(), &PropertyCacheThreadData::ready, this, &PropertyCachePreload::checkReady);
+        connect(data.get(), &PropertyCacheThreadData::errorChanged, this, &PropertyCachePreload::checkReady);
+    }
+    // Targets may already be loaded; ready() is still emitted from the event loop
+    QMetaObject::invokeMethod(this, &PropertyCachePreload::checkReady, Qt::QueuedConnection);
+}
+
+PropertyCachePreload::~PropertyCachePreload()
+{
+    delete d;
+}
+
+/*!
+  \brief Returns the targets being loaded.
+ */
+const QList<Target>& PropertyCachePreload::targets() const
+{
+    return d->targets;
+}
+
+/*!
+  \brief Returns true if \l{ready()} has been emitted.
+ */
+bool PropertyCachePreload::isReady() const
+{
+    return d->emitted;
+}
+
+/*!
+  \brief Returns the number of targets that have finished loading, successfully or not.
+ */
+int PropertyCachePreload::loadedCount() const
+{
+    return int(std::count_if(d->data.constBegin(), d->data.constEnd(),
+                             [](const QSharedPointer<PropertyCacheThreadData>& data) { return data->isLoaded(); }));
+}
+
+void PropertyCachePreload::checkReady()
+{
+    if (d->emitted || loadedCount() < d->data.size())
+        return;
+    d->emitted = true;
+    for (const auto& data : qAsConst(d->data))
+        disconnect(data.get(), nullptr, this, nullptr);
+    qCDebug(logPropertyCache) << "preloaded" << d->targets.size() << "targets";
+    emit ready();
+}
+
+/*!
+  \brief Creates a reader for \a{target}, holding its latest published snapshot.
+
+  If the target isn't loaded yet, this starts loading it, and the reader is unavailable until it is \l{update()}{updated}
+  after the load.
+ */
+PropertySnapshotReader::PropertySnapshotReader(const Target& target)
+    : d(new PropertySnapshotReaderPrivate)
+{
+    d->backend = PropertyCacheBackend::instance(target);
+    d->snapshot = d->backend->m_published.load();
+}
+
+PropertySnapshotReader::~PropertySnapshotReader()
+{
+    delete d;
+}
+
+const Target& PropertySnapshotReader::target() const
+{
+    return d->backend->m_target;
+}
+
+/*!
+  \brief Moves this reader to the latest published snapshot, and returns true if it changed.
+
+  This is cheap when nothing changed. Values read between updates are consistent with each other, even if the service
+  changes them in the meantime.
+ */
+bool PropertySnapshotReader::update()
+{
+    if (d->backend->m_published.version() == d->snapshot->version)
+        return false;
+    PropertySnapshotPtr snapshot = d->backend->m_published.load();
+    if (snapshot == d->snapshot)
+        return false;
+    d->snapshot = snapshot;
+    d->fetchRequested.clear();
+    d->handleValues.clear();
+    return true;
+}
+
+/*!
+  \brief Returns the version of the held snapshot, which increases with every change of the target.
+ */
+quint64 PropertySnapshotReader::version() const
+{
+    return d->snapshot->version;
+}
+
+bool PropertySnapshotReader::isAvailable() const
+{
+    return d->snapshot->available;
+}
+
+QDBusError PropertySnapshotReader::error() const
+{
+    return d->snapshot->error;
+}
+
+bool PropertySnapshotReader::contains(const QString& property) const
+{
+    return d->snapshot->properties.contains(property);
+}
+
+QVariant PropertySnapshotReader::get(const QString& property) const
+{
+    d->fetchIfStale(property);
+    return d->snapshot->properties.value(property);
+}
+
+/*!
+  \brief Returns the value of \a{property} as the metatype \a{type}, like \l{PropertyCache::get(const QString&, int)}.
+ */
+QVariant PropertySnapshotReader::get(const QString& property, int type) const
+{
+    const QVariant value = get(property);
+    if (value.userType() != qMetaTypeId<QDBusArgument>() || value.userType() == type)
+        return value;
+    return d->backend->decode(PropertyHandle(property), value, type, d->snapshot->version);
+}
+
+QVariant PropertySnapshotReader::get(PropertyHandle property) const
+{
+    auto it = d->handleValues.constFind(property);
+    if (it == d->handleValues.constEnd())
+        it = d->handleValues.insert(property, d->snapshot->properties.value(property.name()));
+    if (!d->snapshot->stale.isEmpty())
+        d->fetchIfStale(property.name());
+    return it.value();
+}
+
+QVariant PropertySnapshotReader::get(PropertyHandle property, int type) const
+{
+    const QVariant value = get(property);
+    if (value.userType() != qMetaTypeId<QDBusArgument>() || value.userType() == type)
+        return value;
+    return d->backend->decode(property, value, type, d->snapshot->version);
+}
+
+QVariantMap PropertySnapshotReader::getAll() const
+{
+    for (const auto& property : d->snapshot->stale)
+        d->fetchIfStale(property);
+    return d->snapshot->variantMap();
+}
+
+/*!
+  \brief Returns true if \a{property} was invalidated and its new value hasn't been fetched yet.
+
+  Reading a stale property asks the backend to fetch it; the new value is available after a later \l{update()}.
+ */
+bool PropertySnapshotReader::isStale(const QString& property) const
+{
+    return d->snapshot->stale.contains(property);
+}
+
+void PropertySnapshotReaderPrivate::fetchIfStale(const QString& property) const
+{
+    if (!snapshot->stale.contains(property) || fetchRequested.contains(property))
+        return;
+    fetchRequested.insert(property);
+    auto b = backend.get();
+    QMetaObject::invokeMethod(b, [b, property]() { b->fetch(property); }, Qt::QueuedConnection);
+}
+
+const QVariantMap& PropertySnapshot::variantMap() const
+{
+    std::call_once(m_variantMapOnce, [this]() { m_variantMap = properties.toVariantMap(); });
+    return m_variantMap;
+}
+
+void PublishedSnapshot::store(const PropertySnapshotPtr& snapshot)
+{
+    const int next = 1 - m_active.load();
+    Slot& slot = m_slots[next];
+    // Readers that picked this slot before it became inactive only hold it while they copy the pointer
+    while (slot.readers.load() != 0)
+        QThread::yieldCurrentThread();
+    slot.snapshot = snapshot;
+    m_active.store(next);
+    m_version.store(snapshot->version, std::memory_order_release);
+}
+
+PropertySnapshotPtr PublishedSnapshot::load() const
+{
+    // Sequentially consistent: either the writer sees this reader in the slot and waits, or this reader sees that
+    // the slot was made inactive and tries again.
+    for (;;) {
+        const int active = m_active.load();
+        const Slot& slot = m_slots[active];
+        slot.readers.fetch_add(1);
+        if (m_active.load() == active) {
+            PropertySnapshotPtr snapshot = slot.snapshot;
+            slot.readers.fetch_sub(1);
+            return snapshot;
+        }
+        slot.readers.fetch_sub(1);
+    }
+}
+
+/*!
+  \brief Sets the number of threads used for DBus activity of all PropertyCache instances to \a{count}.
+
+  Backends are assigned to a thread by hash of their bus and service, so all targets of a service share a thread and
+  different services are spread over \a{count} threads. Demarshalling and comparing values then scales across cores,
+  and a slow service only delays the other services that share its thread. The default is one thread.
+
+  This must be called before any PropertyCache is created; later calls have no effect.
+
+  \sa setServicePriority(), {Multi-threaded applications}
+ */
+void PropertyCache::setBackendThreadCount(int count)
+{
+    QMutexLocker l(&backendsMutex);
+    if (!backendThreadPool.isEmpty()) {
+        qCWarning(logPropertyCache) << "setBackendThreadCount must be called before creating any PropertyCache";
+        return;
+    }
+    backendThreadCount = qMax(count, 1);
+}
+
+/*!
+  \brief Runs the DBus activity for \a{service} on \a{bus} on a separate thread with \a{priority}.
+
+  All services with the same priority share one thread, which is not used by any other service. This keeps
+  latency-critical services responsive when other services flood signals or return large replies. Using
+  QThread::InheritPriority restores the default of sharing the thread pool.
+
+  This must be called before any PropertyCache is created for \a{service}; it does not affect caches that already
+  exist.
+
+  \sa setBackendThreadCount()
+ */
+void PropertyCache::setServicePriority(const QDBusConnection& bus, const QString& service, QThread::Priority priority)
+{
+    QMutexLocker l(&backendsMutex);
+    if (priority == QThread::InheritPriority)
+        servicePriorities.remove(qMakePair(bus.name(), service));
+    else
+        servicePriorities.insert(qMakePair(bus.name(), service), priority);
+}
+
+/*!
+  \brief Sets the number of recent versions of each target whose changes are remembered for \l{initialize()} to
+  resume from. The default is 64, and 0 disables resuming.
+
+  This only affects targets whose data is created after the call.
+
+  \sa {Resuming}
+ */
+void PropertyCache::setJournalCapacity(int capacity)
+{
+    QMutexLocker l(&backendsMutex);
+    backendJournalCapacity = qMax(capacity, 0);
+}
+
+/*!
+  \brief Returns the capacity set by \l{setJournalCapacity()}.
+ */
+int PropertyCache::journalCapacity()
+{
+    QMutexLocker l(&backendsMutex);
+    return backendJournalCapacity;
+}
+
+/*!
+  \brief Returns the limits set by \l{setRetentionLimits()}.
+ */
+PropertyCache::RetentionLimits PropertyCache::retentionLimits()
+{
+    QMutexLocker l(&backendsMutex);
+    return unusedCacheLimits;
+}
+
+/*!
+  \brief Returns counters for the data kept for unused targets, to help tune \l{setRetentionLimits()}.
+
+  The counters increase over the lifetime of the process.
+ */
+PropertyCache::RetentionStatistics PropertyCache::retentionStatistics()
+{
+    QMutexLocker l(&backendsMutex);
+    RetentionStatistics statistics = unusedCacheStatistics;
+    statistics.unusedCount = int(unusedCacheBackends.size());
+    statistics.unusedSize = unusedCacheSize;
+    return statistics;
+}
+
+/*!
+  \brief Sets how targets are loaded again after their service restarts or a load fails.
+
+  When a service appears on the bus, all of its targets load again after \c{restartDelay} milliseconds. At most
+  \c{burstSize} of them are loaded at once, and the rest follow in bursts every \c{burstInterval} milliseconds, so
+  that a service with many objects isn't flooded with GetAll calls. Targets using an \l{setObjectManager()}{object
+  manager} are always loaded together.
+
+  After a load fails, for example with \c{UnknownObject} because the service hasn't registered the object yet, a
+  target that receives PropertiesChanged loads again after a backoff. It starts at \c{initialBackoff} milliseconds
+  and is multiplied by \c{backoffFactor} for every consecutive failure, up to \c{maxBackoff}, with a random variation
+  of \c{jitter} to spread out the loads of many clients. Requests are merged while a load is scheduled.
+
+  This applies to loads scheduled after the call.
+ */
+void PropertyCache::setReloadPolicy(const ReloadPolicy& policy)
+{
+    QMutexLocker l(&backendsMutex);
+    backendReloadPolicy = policy;
+}
+
+/*!
+  \brief Returns the policy set by \l{setReloadPolicy()}.
+ */
+PropertyCache::ReloadPolicy PropertyCache::reloadPolicy()
+{
+    QMutexLocker l(&backendsMutex);
+    return backendReloadPolicy;
+}
+
+/*!
+  \brief Returns counters of the DBus activity of all PropertyCache instances in the process.
+
+  The counters are always collected and are cheap to read, so they're suitable for monitoring in production. Most
+  values increase over the lifetime of the process; \c{queuedDeliveries}, \c{liveTargets}, and \c{unusedTargets}
+  are the current state.
+
+  \sa statistics(const Target&), loadLatencyBounds(), retentionStatistics()
+ */
+PropertyCache::Statistics PropertyCache::statistics()
+{
+    Statistics statistics;
+    globalMetrics.fill(&statistics);
+    QMutexLocker l(&backendsMutex);
+    statistics.liveTargets = int(std::count_if(cacheBackends.constBegin(), cacheBackends.constEnd(),
+                                               [](const QWeakPointer<PropertyCacheBackend>& ref) { return !ref.isNull(); }));
+    statistics.unusedTargets = int(unusedCacheBackends.size());
+    const quint64 lookups = unusedCacheStatistics.hits + unusedCacheStatistics.misses;
+    if (lookups)
+        statistics.retentionHitRate = double(unusedCacheStatistics.hits) / double(lookups);
+    return statistics;
+}
+
+/*!
+  \brief Returns counters of the DBus activity for \a{target}.
+
+  Counters are kept while the target is used or retained as unused data, and start from zero when it's loaded
+  again.
+
+  \sa statistics()
+ */
+PropertyCache::Statistics PropertyCache::statistics(const Target& target)
+{
+    Statistics statistics;
+    QMutexLocker l(&backendsMutex);
+    auto backend = cacheBackends.value(target).toStrongRef();
+    PropertyCacheBackend* unused = nullptr;
+    if (!backend) {
+        auto it = unusedCacheIndex.constFind(target);
+        if (it != unusedCacheIndex.constEnd())
+            unused = it.value()->backend;
+    }
+    if (backend || unused)
+        (backend ? backend.get() : unused)->m_metrics.fill(&statistics);
+    else
+        statistics.loadLatency.resize(PropertyCacheMetrics::latencyBuckets);
+    return statistics;
+}
+
+/*!
+  \brief Returns the upper bounds in milliseconds of the buckets in \c{Statistics::loadLatency}.
+
+  The last bucket of \c{loadLatency} counts loads slower than every bound.
+ */
+QVector<int> PropertyCache::loadLatencyBounds()
+{
+    return QVector<int>(std::begin(PropertyCacheMetrics::latencyBounds), std::end(PropertyCacheMetrics::latencyBounds));
+}
+
+bool PropertyCache::event(QEvent* ev)
+{
+    if (ev->type() == QEvent::ThreadChange) {
+        qCCritical(logPropertyCache) << "BUG: thread changed for" << this << "on" << d->data->m_target
+            << "- PropertyCache does not support moveToThread";
+    }
+    return QObject::event(ev);
+}
+
+PropertyCachePrivate::PropertyCachePrivate(PropertyCache* q, const Target& target, CoalescingPolicy coalescing,
+                                           const QStringList& watched)
+    : q(q), data(PropertyCacheThreadData::localInstance(target, coalescing, watched))
+{
+    qCDebug(logCacheInternal) << "created PropertyCache for" << target << "on" << q->thread();
+    // If data is _not_ available, initializing just connects the signals, so it can happen immediately.
+    //
+    // If there's already data, pretend it doesn't exist yet and initialize on the next loop. This gives
+    // the caller time to connect their own signals and get consistent behavior.
+    if (!data->m_available && !data->m_error.isValid()) {
+        initialize();
+    } else {
+        QMetaObject::invokeMethod(q, [this]() { initialize(); }, Qt::QueuedConnection);
+    }
+}
+
+PropertyCachePrivate::~PropertyCachePrivate()
+{
+    qCDebug(logCacheInternal) << "destroyed PropertyCache for" << data->m_target;
+}
+
+void PropertyCachePrivate::initialize(quint64 resume)
+{
+    if (initialized)
+        return;
+
+    QObject::connect(data.get(), &PropertyCacheThreadData::availableChanged, q, &PropertyCache::availableChanged);
+    QObject::connect(data.get(), &PropertyCacheThreadData::errorChanged, q, &PropertyCache::errorChanged);
+    QObject::connect(data.get(), &PropertyCacheThreadData::ready, q, &PropertyCache::ready);
+    QObject::connect(data.get(), &PropertyCacheThreadData::lost, q, &PropertyCache::lost);
+    QObject::connect(data.get(), &PropertyCacheThreadData::propertyChanged, q, &PropertyCache::propertyChanged);
+    QObject::connect(data.get(), &PropertyCacheThreadData::propertyHandleChanged, q, &PropertyCache::propertyHandleChanged);
+    QObject::connect(data.get(), &PropertyCacheThreadData::propertiesReset, q, &PropertyCache::propertiesReset);
+    QObject::connect(data.get(), &PropertyCacheThreadData::revalidated, q, &PropertyCache::revalidated);
+    initialized = true;
+    if (data->m_error.isValid())
+        emit q->errorChanged(data->m_error);
+    if (!data->m_available)
+        return;
+
+    QVector<PropertyHandle> changed;
+    if (resume && data->changesSince(resume, &changed)) {
+        qCDebug(logPropertyCache) << "resumed" << data->m_target << "from" << resume << "with" << changed.size()
+                                  << "changes";
+        emit q->availableChanged(true);
+        for (auto handle : qAsConst(changed)) {
+            const QVariant value = data->m_properties.value(handle.name());
+            emit q->propertyChanged(handle.name(), value);
+            emit q->propertyHandleChanged(handle, value);
+        }
+        emit q->ready();
+        return;
+    }
+
+    // Emit signals in the same order as PropertyCacheData::resetProperties
+    emit q->availableChanged(true);
+    emit q->propertiesReset(data->propertiesMap());
+    for (auto it = data->m_properties.constBegin(); it != data->m_properties.constEnd(); it++) {
+        emit q->propertyChanged(it.key(), it.value());
+        emit q->propertyHandleChanged(PropertyHandle(it.key()), it.value());
+    }
+    emit q->ready();
+}
+
+QSharedPointer<PropertyCacheThreadData> PropertyCacheThreadData::localInstance(const Target& target, CoalescingPolicy coalescing,
+                                                                             const QStringList& watched)
+{
+    auto& instances = cacheThreadData.localData();
+    // Caches watching the same properties in any order share data
+    QStringList sorted = watched;
+    sorted.sort();
+    sorted.removeDuplicates();
+    const ThreadDataKey key{target, coalescing, sorted};
+    auto it = instances.find(key);
+    if (it != instances.end()) {
+        if (auto ref = it->toStrongRef())
+            return ref;
+    }
+    auto ref = QSharedPointer<PropertyCacheThreadData>::create(target, coalescing, sorted);
+    instances.insert(key, ref.toWeakRef());
+    return ref;
+}
+
+QVector<QSharedPointer<PropertyCacheThreadData>> PropertyCacheThreadData::localInstances(const QList<Target>& targets)
+{
+    auto& instances = cacheThreadData.localData();
+    QVector<QSharedPointer<PropertyCacheThreadData>> result(targets.size());
+    QList<Target> missing;
+    for (int i = 0; i < targets.size(); i++) {
+        auto it = instances.constFind(ThreadDataKey{targets[i], CoalescingPolicy(), QStringList()});
+        if (it != instances.constEnd())
+            result[i] = it->toStrongRef();
+        if (!result[i])
+            missing.append(targets[i]);
+    }
+
+    // Backends for the missing targets are created together, so their loads are sent in one burst
+    const auto backends = PropertyCacheBackend::instances(missing);
+    for (int i = 0, j = 0; i < targets.size(); i++) {
+        if (result[i])
+            continue;
+        const auto& backend = backends[j++];
+        // The same target may be listed more than once
+        const ThreadDataKey key{targets[i], CoalescingPolicy(), QStringList()};
+        auto it = instances.constFind(key);
+        if (it != instances.constEnd())
+            result[i] = it->toStrongRef();
+        if (result[i])
+            continue;
+        result[i] = QSharedPointer<PropertyCacheThreadData>::create(targets[i], CoalescingPolicy(), QStringList(), backend);
+        instances.insert(key, result[i].toWeakRef());
+    }
+    return result;
+}
+
+PropertyCacheThreadData::PropertyCacheThreadData(const Target& target, CoalescingPolicy coalescing,
+                                                 const QStringList& watched)
+    : PropertyCacheThreadData(target, coalescing, watched, PropertyCacheBackend::instance(target))
+{
+}
+
+PropertyCacheThreadData::PropertyCacheThreadData(const Target& target, CoalescingPolicy coalescing,
+                                                 const QStringList& watched,
+                                                 const QSharedPointer<PropertyCacheBackend>& backend)
+    : m_target(target), m_coalescing(coalescing), m_watched(watched), m_backend(backend)
+    , m_dispatcher(PropertyCacheDispatcher::localInstance())
+{
+    qCDebug(logCacheInternal) << "created" << this << "for" << m_target << "on" << thread();
+    for (const auto& property : m_watched)
+        m_watchedHandles.insert(PropertyHandle(property));
+    QMutexLocker lock(&m_backend->m_dataMutex);
+    if (m_coalescing.isEnabled()) {
+        // Snapshots are merged on the backend thread, so intermediate values are never posted to this thread
+        connect(m_backend.get(), &PropertyCacheBackend::reset, this, &PropertyCacheThreadData::queueSnapshot, Qt::DirectConnection);
+        connect(m_backend.get(), &PropertyCacheBackend::changeProperties, this, &PropertyCacheThreadData::queueSnapshot, Qt::DirectConnection);
+        m_flushTimer.setSingleShot(true);
+        connect(&m_flushTimer, &QTimer::timeout, this, &PropertyCacheThreadData::flush);
+    } else {
+        connect(m_backend.get(), &PropertyCacheBackend::reset, this, &PropertyCacheThreadData::post, Qt::DirectConnection);
+        connect(m_backend.get(), &PropertyCacheBackend::changeProperties, this, &PropertyCacheThreadData::post, Qt::DirectConnection);
+    }
+    adopt(m_backend->m_snapshot);
+    m_postedRevalidating = m_snapshot->revalidating;
+    m_postedStale = watchedStale(*m_snapshot);
+    m_backend->m_threadCount++;
+    lock.unlock();
+}
+
+PropertyCacheThreadData::~PropertyCacheThreadData()
+{
+    qCDebug(logCacheInternal) << "destroyed" << this << "for" << m_target << "on" << thread();
+    // Backend signals are emitted with the lock held; disconnecting under the lock guarantees that no direct call is
+    // in progress on the backend thread.
+    QMutexLocker lock(&m_backend->m_dataMutex);
+    disconnect(m_backend.get(), nullptr, this, nullptr);
+    m_backend->m_threadCount--;
+    // Snapshots that are still queued will never be received; skipped snapshots were already counted
+    QMutexLocker pendingLock(&m_pendingMutex);
+    const quint64 skipped = quint64(m_skippedVersions.size());
+    pendingLock.unlock();
+    m_backend->count(&PropertyCacheMetrics::snapshotsDelivered,
+                     m_backend->m_snapshot->version - m_snapshot->version - skipped);
+    lock.unlock();
+    m_dispatcher->cancel(this);
+
+    auto weakRef = cacheThreadData.localData().take(ThreadDataKey{m_target, m_coalescing, m_watched});
+    Q_ASSERT(weakRef.isNull());
+    Q_UNUSED(weakRef);
+
+    // Results of Set calls are still referenced by callers, but their watchers are destroyed with this object
+    const QDBusError canceled(QDBusError::Failed, QStringLiteral("PropertyCache was destroyed before the reply"));
+    for (const auto& call : qAsConst(m_setCalls)) {
+        for (const auto& result : call.results)
+            result->finish(canceled);
+    }
+    for (const auto& queued : qAsConst(m_queuedWrites)) {
+        for (const auto& result : queued.results)
+            result->finish(canceled);
+    }
+}
+
+void PropertyCacheThreadData::adopt(const PropertySnapshotPtr& snapshot)
+{
+    // Snapshots are connected and published under the backend's lock, so each thread receives every version after
+    // the one it was created with, in order. Coalescing and filtering skip intermediate versions.
+    Q_ASSERT(!m_snapshot || snapshot->version == m_snapshot->version + 1
+             || ((m_coalescing.isEnabled() || !m_watched.isEmpty()) && snapshot->version > m_snapshot->version));
+    if (m_snapshot) {
+        quint64 delivered = snapshot->version - m_snapshot->version;
+        if (!m_watched.isEmpty()) {
+            // Skipped versions were counted when they were dropped
+            QMutexLocker lock(&m_pendingMutex);
+            const int skipped = int(std::lower_bound(m_skippedVersions.constBegin(), m_skippedVersions.constEnd(),
+                                                     snapshot->version) - m_skippedVersions.constBegin());
+            m_skippedVersions.remove(0, skipped);
+            delivered -= quint64(skipped);
+        }
+        m_backend->count(&PropertyCacheMetrics::snapshotsDelivered, delivered);
+    }
+    m_snapshot = snapshot;
+    if (m_watched.isEmpty()) {
+        m_properties = snapshot->properties;
+    } else {
+        m_properties.clear();
+        for (const auto& property : m_watched) {
+            auto it = snapshot->properties.constFind(property);
+            if (it != snapshot->properties.constEnd())
+                m_properties.append(it.key(), it.value());
+        }
+        m_watchedMapValid = false;
+    }
+    m_error = snapshot->error;
+    m_available = snapshot->available;
+    m_fetchRequested.clear();
+}
+
+const PropertyCacheThreadData::HandleValue& PropertyCacheThreadData::handleValue(PropertyHandle property) const
+{
+    auto it = m_handleValues.constFind(property);
+    if (it != m_handleValues.constEnd())
+        return it.value();
+    // Also remember properties that don't exist; they'll be invalidated if they are added later. Revisions start
+    // at 1 so that 0 can mean 'uninitialized' in PropertyCache::revision.
+    return *m_handleValues.insert(property, {m_properties.value(property.name()), m_snapshot->version + 1});
+}
+
+const QVariantMap& PropertyCacheThreadData::propertiesMap() const
+{
+    if (m_watched.isEmpty())
+        return m_snapshot->variantMap();
+    if (!m_watchedMapValid) {
+        m_watchedMap = m_properties.toVariantMap();
+        m_watchedMapValid = true;
+    }
+    return m_watchedMap;
+}
+
+QVariant PropertyCacheThreadData::value(PropertyHandle property) const
+{
+    if (!m_snapshot->stale.isEmpty())
+        fetchIfStale(property.name());
+    return handleValue(property).value;
+}
+
+QVariant PropertyCacheThreadData::decode(PropertyHandle property, const QVariant& value, int type) const
+{
+    return m_backend->decode(property, value, type, m_snapshot->version);
+}
+
+quint64 PropertyCacheThreadData::revision(PropertyHandle property) const
+{
+    return handleValue(property).revision;
+}
+
+QSharedPointer<PendingSet> PropertyCacheThreadData::set(const QString& property, const QVariant& value, PropertyCache::SetMode mode)
+{
+    QSharedPointer<PendingSet> result(new PendingSet(property, value));
+    const bool coalesced = (mode == PropertyCache::SetMode::Coalesced);
+    if (coalesced) {
+        auto it = m_queuedWrites.find(property);
+        if (it != m_queuedWrites.end()) {
+            // Last write wins; it also finishes the writes it replaced
+            it->value = value;
+            it->results.append(result);
+            return result;
+        }
+        m_queuedWrites.insert(property, QueuedWrite());
+    }
+    sendSet(property, value, {result}, coalesced);
+    return result;
+}
+
+void PropertyCacheThreadData::sendSet(const QString& property, const QVariant& value,
+                                      const QVector<QSharedPointer<PendingSet>>& results, bool coalesced)
+{
+    auto msg = m_backend->m_propertiesTarget.createMethodCall("Set", m_target.interface(), property, value);
+    auto w = new QDBusPendingCallWatcher(m_target.bus().asyncCall(msg), this);
+    connect(w, &QDBusPendingCallWatcher::finished, this, &PropertyCacheThreadData::setReply);
+    m_setCalls.insert(w, {property, results, coalesced});
+}
+
+void PropertyCacheThreadData::setReply(QDBusPendingCallWatcher* w)
+{
+    w->deleteLater();
+    const SetCall call = m_setCalls.take(w);
+    QDBusPendingReply<> reply = *w;
+    if (reply.isError())
+        qCWarning(logPropertyCache) << "failed to set property" << call.property << "for" << m_target << "with error" << reply.error();
+    for (const auto& result : call.results)
+        result->finish(reply.error());
+
+    if (!call.coalesced)
+        return;
+    auto it = m_queuedWrites.find(call.property);
+    Q_ASSERT(it != m_queuedWrites.end());
+    if (it->results.isEmpty()) {
+        m_queuedWrites.erase(it);
+        return;
+    }
+    const QueuedWrite queued = std::exchange(*it, QueuedWrite());
+    sendSet(call.property, queued.value, queued.results, true);
+}
+
+void PropertyCacheThreadData::fetchIfStale(const QString& property) const
+{
+    // Requests are only sent once per snapshot; the backend ignores properties that are already being fetched
+    if (!m_snapshot->stale.contains(property) || m_fetchRequested.contains(property) || !isWatched(property))
+        return;
+    m_fetchRequested.insert(property);
+    auto backend = m_backend.get();
+    QMetaObject::invokeMethod(backend, [backend, property]() { backend->fetch(property); }, Qt::QueuedConnection);
+}
+
+void PropertyCacheThreadData::reset(const PropertySnapshotPtr& snapshot)
+{
+    DBUSWRAPPER_TRACE_SCOPE("thread", "reset", m_target, snapshot->properties.size());
+    Q_ASSERT(snapshot->available || snapshot->properties.isEmpty());
+    const QDBusError& error = snapshot->error;
+
+    // The order here is very specific:
+    //   1. Update state internally
+    //   2. Emit availableChanged and errorChanged if appropriate
+    //   3. Emit propertiesReset and lost
+    //   4. Emit propertyChanged as needed
+    //   5. Emit ready
+    bool wasAvailable = m_available;
+    bool wasRevalidating = m_snapshot && m_snapshot->revalidating;
+    bool hadProperties = !m_properties.isEmpty();
+    bool errorChange = (m_error.type() != error.type());
+
+    // The backend computed the changes from its previous version. If coalescing skipped versions, this thread's
+    // properties are older than that and have to be compared with the new properties instead.
+    const bool hasDiff = snapshot->isReset && m_snapshot && snapshot->version == m_snapshot->version + 1;
+    PropertyMap before;
+    if (!hasDiff)
+        before = m_properties;
+
+    adopt(snapshot);
+    if (hasDiff) {
+        for (auto handle : snapshot->changedHandles)
+            m_handleValues.remove(handle);
+    } else {
+        m_handleValues.clear();
+    }
+
+    if (wasAvailable != m_available)
+        emit availableChanged(m_available);
+    if (errorChange)
+        emit errorChanged(error);
+    if (!m_properties.isEmpty() || hadProperties)
+        emit propertiesReset(propertiesMap());
+
+    quint64 changed = 0;
+    if (hasDiff) {
+        // Changed and added properties are signalled before removed properties
+        const QVariantMap& changes = snapshot->changes;
+        for (bool removed : {false, true}) {
+            int i = 0;
+            for (auto it = changes.constBegin(); it != changes.constEnd(); it++, i++) {
+                const PropertyHandle handle = snapshot->changedHandles.at(i);
+                if (it.value().isValid() == removed || !isWatched(handle))
+                    continue;
+                changed++;
+                emit propertyChanged(it.key(), it.value());
+                emit propertyHandleChanged(handle, it.value());
+            }
+        }
+    } else {
+        for (auto it = m_properties.constBegin(); it != m_properties.constEnd(); it++) {
+            auto beforeIt = before.constFind(it.key());
+            if (beforeIt == before.constEnd() || beforeIt.value() != it.value()) {
+                changed++;
+                emit propertyChanged(it.key(), it.value());
+                emit propertyHandleChanged(PropertyHandle(it.key()), it.value());
+            }
+        }
+        for (auto it = before.constBegin(); it != before.constEnd(); it++) {
+            if (!m_properties.contains(it.key())) {
+                changed++;
+                emit propertyChanged(it.key(), QVariant());
+                emit propertyHandleChanged(PropertyHandle(it.key()), QVariant());
+            }
+        }
+    }
+    m_backend->count(&PropertyCacheMetrics::changesDelivered, changed);
+
+    if (wasAvailable && !m_available)
+        emit lost();
+    if (!wasAvailable && m_available)
+        emit ready();
+    if (wasRevalidating && !m_snapshot->revalidating)
+        emit revalidated();
+}
+
+void PropertyCacheThreadData::changeProperties(const PropertySnapshotPtr& snapshot)
+{
+    DBUSWRAPPER_TRACE_SCOPE("thread", "changeProperties", m_target, snapshot->changes.size());
+    // The snapshot already has all values applied, so adopting it updates everything before sending any signals.
+    const bool wasRevalidating = m_snapshot->revalidating;
+    adopt(snapshot);
+    for (auto handle : snapshot->changedHandles)
+        m_handleValues.remove(handle);
+    const QVariantMap& changes = snapshot->changes;
+    quint64 changed = 0;
+    int i = 0;
+    for (auto it = changes.constBegin(); it != changes.constEnd(); it++, i++) {
+        const PropertyHandle handle = snapshot->changedHandles.at(i);
+        if (!isWatched(handle))
+            continue;
+        changed++;
+        emit propertyChanged(it.key(), it.value());
+        emit propertyHandleChanged(handle, it.value());
+    }
+    m_backend->count(&PropertyCacheMetrics::changesDelivered, changed);
+    if (wasRevalidating && !m_snapshot->revalidating)
+        emit revalidated();
+}
+
+void PropertyCacheThreadData::queueSnapshot(const PropertySnapshotPtr& snapshot)
+{
+    // Called on the backend thread with the backend's lock held
+    if (skip(snapshot))
+        return;
+    QMutexLocker lock(&m_pendingMutex);
+    const bool scheduled = !m_pendingSnapshot.isNull();
+    m_pendingSnapshot = snapshot;
+    if (snapshot->isReset) {
+        m_pendingReset = true;
+        m_pendingChanges.clear();
+    } else if (!m_pendingReset) {
+        int i = 0;
+        const QVariantMap& changes = snapshot->changes;
+        for (auto it = changes.constBegin(); it != changes.constEnd(); it++, i++) {
+            if (isWatched(snapshot->changedHandles.at(i)))
+                m_pendingChanges.insert(it.key(), snapshot->changedHandles.at(i));
+        }
+    }
+    lock.unlock();
+
+    // Only the first snapshot of a batch wakes up the cache's thread
+    if (!scheduled)
+        m_dispatcher->post(this, PropertySnapshotPtr());
+}
+
+void PropertyCacheThreadData::post(const PropertySnapshotPtr& snapshot)
+{
+    if (!skip(snapshot))
+        m_dispatcher->post(this, snapshot);
+}
+
+bool PropertyCacheThreadData::isWatched(const QString& property) const
+{
+    return m_watched.isEmpty() || std::binary_search(m_watched.constBegin(), m_watched.constEnd(), property);
+}
+
+bool PropertyCacheThreadData::isWatched(PropertyHandle property) const
+{
+    return m_watched.isEmpty() || m_watchedHandles.contains(property);
+}
+
+bool PropertyCacheThreadData::changesSince(quint64 sequence, QVector<PropertyHandle>* changed) const
+{
+    QMutexLocker lock(&m_backend->m_dataMutex);
+    if (!m_backend->changesSince(sequence, m_snapshot->version, changed))
+        return false;
+    lock.unlock();
+    // Signalled in the same order as the changes of a snapshot
+    changed->erase(std::remove_if(changed->begin(), changed->end(),
+                                  [this](PropertyHandle handle) { return !isWatched(handle); }), changed->end());
+    std::sort(changed->begin(), changed->end(),
+              [](PropertyHandle a, PropertyHandle b) { return a.name() < b.name(); });
+    return true;
+}
+
+QSet<QString> PropertyCacheThreadData::watchedStale(const PropertySnapshot& snapshot) const
+{
+    QSet<QString> stale;
+    if (snapshot.stale.isEmpty())
+        return stale;
+    for (const auto& property : m_watched) {
+        if (snapshot.stale.contains(property))
+            stale.insert(property);
+    }
+    return stale;
+}
+
+bool PropertyCacheThreadData::skip(const PropertySnapshotPtr& snapshot)
+{
+    // Called on the backend thread with the backend's lock held. Resets are always delivered, because they can
+    // change availability and errors; so are changes of the revalidating state and of stale watched properties.
+    if (m_watched.isEmpty())
+        return false;
+    const QSet<QString> stale = watchedStale(*snapshot);
+    bool watched = snapshot->isReset || snapshot->revalidating != m_postedRevalidating || stale != m_postedStale;
+    for (int i = 0; !watched && i < snapshot->changedHandles.size(); i++)
+        watched = m_watchedHandles.contains(snapshot->changedHandles.at(i));
+    if (watched) {
+        m_postedRevalidating = snapshot->revalidating;
+        m_postedStale = stale;
+        return false;
+    }
+
+    QMutexLocker lock(&m_pendingMutex);
+    m_skippedVersions.append(snapshot->version);
+    lock.unlock();
+    m_backend->count(&PropertyCacheMetrics::snapshotsDelivered);
+    return true;
+}
+
+void PropertyCacheThreadData::deliver(const PropertySnapshotPtr& snapshot)
+{
+    if (!snapshot)
+        scheduleFlush();
+    else if (snapshot->isReset)
+        reset(snapshot);
+    else
+        changeProperties(snapshot);
+}
+
+QSharedPointer<PropertyCacheDispatcher> PropertyCacheDispatcher::localInstance()
+{
+    auto& instance = threadDispatchers.localData();
+    if (auto ref = instance.toStrongRef())
+        return ref;
+    // Deleted from the event loop, because releasing the last PropertyCache of the thread from a slot releases the
+    // dispatcher while it's dispatching
+    QSharedPointer<PropertyCacheDispatcher> ref(new PropertyCacheDispatcher, &QObject::deleteLater);
+    instance = ref.toWeakRef();
+    return ref;
+}
+
+void PropertyCacheDispatcher::post(PropertyCacheThreadData* data, const PropertySnapshotPtr& snapshot)
+{
+    DBUSWRAPPER_TRACE_FLOW_BEGIN("thread", "deliver",
+                                 TracePrivate::deliveryId(data, snapshot ? snapshot->version : 0));
+    QMutexLocker lock(&m_mutex);
+    const bool wake = m_queue.isEmpty();
+    m_queue.append({data, snapshot});
+    lock.unlock();
+    if (wake)
+        QMetaObject::invokeMethod(this, &PropertyCacheDispatcher::dispatch, Qt::QueuedConnection);
+}
+
+void PropertyCacheDispatcher::cancel(PropertyCacheThreadData* data)
+{
+    for (int i = m_batchIndex; i < m_batch.size(); i++) {
+        if (m_batch[i].data == data)
+            m_batch[i].data = nullptr;
+    }
+    QMutexLocker lock(&m_mutex);
+    for (auto& delivery : m_queue) {
+        if (delivery.data == data)
+            delivery.data = nullptr;
+    }
+}
+
+void PropertyCacheDispatcher::dispatch()
+{
+    // A slot may run a nested event loop and dispatch again; the nested call continues the same batch, so
+    // deliveries are still applied in order
+    for (;;) {
+        while (m_batchIndex < m_batch.size()) {
+            const Delivery delivery = m_batch[m_batchIndex++];
+            if (!delivery.data)
+                continue;
+            // A slot may destroy the last PropertyCache using the data, which must outlive its signals
+            const auto data = delivery.data->sharedFromThis();
+            DBUSWRAPPER_TRACE_SCOPE("thread", "deliver", delivery.data->m_target,
+                                    delivery.snapshot ? delivery.snapshot->changes.size() : -1);
+            DBUSWRAPPER_TRACE_FLOW_END("thread", "deliver",
+                                       TracePrivate::deliveryId(delivery.data,
+                                                                delivery.snapshot ? delivery.snapshot->version : 0));
+            delivery.data->deliver(delivery.snapshot);
+        }
+        m_batch.clear();
+        m_batchIndex = 0;
+        QMutexLocker lock(&m_mutex);
+        if (m_queue.isEmpty())
+            return;
+        // Keeps the capacity of both vectors, so steady traffic doesn't allocate
+        m_batch.swap(m_queue);
+    }
+}
+
+void PropertyCacheThreadData::scheduleFlush()
+{
+    const int interval = m_coalescing.interval();
+    if (interval == 0) {
+        flush();
+        return;
+    }
+    if (m_flushTimer.isActive())
+        return;
+    const qint64 delay = m_lastFlush.isValid() ? interval - m_lastFlush.elapsed() : 0;
+    m_flushTimer.start(int(qMax<qint64>(delay, 0)));
+}
+
+void PropertyCacheThreadData::flush()
+{
+    // Signals may destroy the last PropertyCache using this data
+    const auto self = sharedFromThis();
+    QMutexLocker lock(&m_pendingMutex);
+    const PropertySnapshotPtr snapshot = std::exchange(m_pendingSnapshot, {});
+    const bool isReset = std::exchange(m_pendingReset, false);
+    const QMap<QString, PropertyHandle> changes = std::exchange(m_pendingChanges, {});
+    lock.unlock();
+    if (!snapshot)
+        return;
+
+    DBUSWRAPPER_TRACE_SCOPE("thread", "flush", m_target, isReset ? -1 : changes.size());
+    m_lastFlush.start();
+    if (isReset) {
+        reset(snapshot);
+        return;
+    }
+
+    // Apply the latest snapshot, then signal each property that ended up with a different value than before
+    const PropertyMap before = m_properties;
+    const bool wasRevalidating = m_snapshot->revalidating;
+    adopt(snapshot);
+    for (auto handle : changes)
+        m_handleValues.remove(handle);
+    quint64 changed = 0;
+    for (auto it = changes.constBegin(); it != changes.constEnd(); it++) {
+        const QVariant value = m_properties.value(it.key());
+        if (value == before.value(it.key()))
+            continue;
+        changed++;
+        emit propertyChanged(it.key(), value);
+        emit propertyHandleChanged(it.value(), value);
+    }
+    m_backend->count(&PropertyCacheMetrics::changesDelivered, changed);
+    if (wasRevalidating && !m_snapshot->revalidating)
+        emit revalidated();
+}
+
+// Rough size of a property value in memory, for the unused cache's memory budget
+static qint64 approximateSize(const QVariant& value)
+{
+    qint64 size = sizeof(QVariant);
+    switch (value.userType()) {
+    case QMetaType::QString:
+        size += value.toString().size() * qint64(sizeof(QChar));
+        break;
+    case QMetaType::QByteArray:
+        size += value.toByteArray().size();
+        break;
+    case QMetaType::QStringList:
+        for (const auto& str : value.toStringList())
+            size += sizeof(QString) + str.size() * qint64(sizeof(QChar));
+        break;
+    case QMetaType::QVariantList:
+        for (const auto& v : value.toList())
+            size += approximateSize(v);
+        break;
+    case QMetaType::QVariantMap: {
+        const QVariantMap map = value.toMap();
+        for (auto it = map.constBegin(); it != map.constEnd(); it++)
+            size += it.key().size() * qint64(sizeof(QChar)) + approximateSize(it.value());
+        break;
+    }
+    default:
+        // Complex types are still marshalled; the size of a QDBusArgument is unknown without demarshalling it, so
+        // count it as a fixed amount
+        if (value.userType() == qMetaTypeId<QDBusArgument>())
+            size += 256;
+        break;
+    }
+    return size;
+}
+
+static qint64 approximateSize(const PropertySnapshotPtr& snapshot)
+{
+    qint64 size = sizeof(PropertyCacheBackend) + sizeof(PropertySnapshot);
+    // Names are shared by every target with the same property, so only the entries are counted
+    const PropertyMap& properties = snapshot->properties;
+    for (auto it = properties.constBegin(); it != properties.constEnd(); it++)
+        size += sizeof(QString) + approximateSize(it.value());
+    return size;
+}
+
+// Removes a backend from the unused cache without deleting it. Must hold backendsMutex.
+static PropertyCacheBackend* takeUnusedBackend(UnusedBackendList::iterator it)
+{
+    auto backend = it->backend;
+    unusedCacheSize -= it->size;
+    unusedCacheIndex.remove(backend->m_target);
+    unusedCacheBackends.erase(it);
+    return backend;
+}
+
+// Deletes the least recently used backends until the unused cache is within its limits. Must hold backendsMutex.
+static void trimUnusedBackends()
+{
+    const auto& limits = unusedCacheLimits;
+    while (!unusedCacheBackends.empty()
+           && (int(unusedCacheBackends.size()) > qMax(limits.capacity, 0)
+               || (limits.memoryBudget >= 0 && unusedCacheSize > limits.memoryBudget))) {
+        auto backend = takeUnusedBackend(std::prev(unusedCacheBackends.end()));
+        qCDebug(logCacheInternal) << "evicted backend" << backend << "for" << backend->m_target << "from unused cache";
+        unusedCacheStatistics.evictions++;
+        backend->deleteLater();
+    }
+}
+
+static void expireUnusedBackend(PropertyCacheBackend* backend)
+{
+    QMutexLocker l(&backendsMutex);
+    auto it = unusedCacheIndex.find(backend->m_target);
+    if (it == unusedCacheIndex.end() || it.value()->backend != backend)
+        return;
+    // If the backend was restored and released again, or the timeout changed, another check is scheduled
+    const int timeout = unusedCacheLimits.idleTimeout;
+    if (timeout < 0 || it.value()->released.elapsed() < timeout)
+        return;
+    takeUnusedBackend(it.value());
+    qCDebug(logCacheInternal) << "expired backend" << backend << "for" << backend->m_target << "from unused cache";
+    unusedCacheStatistics.expirations++;
+    backend->deleteLater();
+}
+
+// Checks the backend's idle timeout after msec. Must hold backendsMutex.
+static void scheduleExpiry(PropertyCacheBackend* backend, qint64 msec)
+{
+    const int delay = int(qBound<qint64>(0, msec, std::numeric_limits<int>::max()));
+    // The timer must be started on the backend thread
+    QMetaObject::invokeMethod(backend, [backend, delay]() {
+        QTimer::singleShot(delay, backend, [backend]() { expireUnusedBackend(backend); });
+    }, Qt::QueuedConnection);
+}
+
+static void backendReleased(DBusWrapper::PropertyCacheBackend* backend)
+{
+    PropertySnapshotPtr snapshot;
+    {
+        QMutexLocker lock(&backend->m_dataMutex);
+        snapshot = backend->m_snapshot;
+    }
+    const qint64 size = approximateSize(snapshot);
+
+    QMutexLocker l(&backendsMutex);
+    qCDebug(logCacheInternal) << "released" << backend << "for" << backend->m_target << "to unreferenced cache";
+    // remove the dead weak pointer
+    auto it = cacheBackends.find(backend->m_target);
+    if (it != cacheBackends.end() && it->isNull())
+        cacheBackends.erase(it);
+    // a replacement may have been created and released while this one was being released; keep only the newer one
+    auto unusedIt = unusedCacheIndex.find(backend->m_target);
+    if (unusedIt != unusedCacheIndex.end())
+        takeUnusedBackend(unusedIt.value())->deleteLater();
+
+    // transfer ownership of the instance to the front of the unused list
+    unusedCacheBackends.push_front({backend, size, QElapsedTimer()});
+    unusedCacheBackends.front().released.start();
+    unusedCacheIndex.insert(backend->m_target, unusedCacheBackends.begin());
+    unusedCacheSize += size;
+    trimUnusedBackends();
+    if (unusedCacheLimits.idleTimeout >= 0 && unusedCacheIndex.contains(backend->m_target))
+        scheduleExpiry(backend, unusedCacheLimits.idleTimeout);
+}
+
+QSharedPointer<PropertyCacheBackend> PropertyCacheBackend::instance(const Target& target)
+{
+    QMutexLocker l(&backendsMutex);
+    return instanceLocked(target);
+}
+
+QVector<QSharedPointer<PropertyCacheBackend>> PropertyCacheBackend::instances(const QList<Target>& targets)
+{
+    QVector<QSharedPointer<PropertyCacheBackend>> result;
+    result.reserve(targets.size());
+    QMutexLocker l(&backendsMutex);
+    for (const auto& target : targets)
+        result.append(instanceLocked(target));
+    return result;
+}
+
+QSharedPointer<PropertyCacheBackend> PropertyCacheBackend::instanceLocked(const Target& target)
+{
+    // Search the existing referenced backends
+    auto it = cacheBackends.find(target);
+    if (it != cacheBackends.end()) {
+        if (auto ref = it->toStrongRef())
+            return ref;
+    }
+
+    // Search the cache of unreferenced backends and restore if found
+    auto unusedIt = unusedCacheIndex.find(target);
+    if (unusedIt != unusedCacheIndex.end()) {
+        auto cachedBackend = takeUnusedBackend(unusedIt.value());
+        unusedCacheStatistics.hits++;
+        qCDebug(logCacheInternal) << "restored backend" << cachedBackend << "from unused cache for" << target;
+        QSharedPointer<PropertyCacheBackend> ref(cachedBackend, &backendReleased);
+        cacheBackends.insert(target, ref.toWeakRef());
+        return ref;
+    }
 
     // Create a new backend
+    unusedCacheStatistics.misses++;
     QSharedPointer<PropertyCacheBackend> ref(new PropertyCacheBackend(target), &backendReleased);
     cacheBackends.insert(target, ref.toWeakRef());
     return ref;
 }
 
-static void cleanupBackendThread()
+// Deletes all unreferenced backends. Must hold backendsMutex.
+static void clearUnusedBackends()
+{
+    for (const auto& unused : unusedCacheBackends)
+        unused.backend->deleteLater();
+    unusedCacheBackends.clear();
+    unusedCacheIndex.clear();
+    unusedCacheSize = 0;
+}
+
+static void cleanupBackendThreads()
 {
-    qCDebug(logCacheInternal) << "cleaning up DBusWrapper backend thread";
+    qCDebug(logCacheInternal) << "cleaning up DBusWrapper backend threads";
     {
         QMutexLocker lock(&backendsMutex);
-        for (auto b : unusedCacheBackends)
-            b->deleteLater();
-        unusedCacheBackends.clear();
+        clearUnusedBackends();
     }
-    backendThread->quit();
-    backendThread->wait(5000);
-    backendThread.reset();
+    for (const auto& thread : backendThreads)
+        thread->quit();
+    for (const auto& thread : backendThreads)
+        thread->wait(5000);
+    backendThreads.clear();
+    backendThreadPool.clear();
+    priorityThreads.clear();
 }
 
-PropertyCacheBackend::PropertyCacheBackend(const Target& target)
-    : m_target(target)
+// Must hold backendsMutex
+static QThread* startBackendThread(const QString& name, QThread::Priority priority)
 {
-    // backend lock is held
-    if (!backendThread) {
-        backendThread = std::make_unique<QThread>();
-        backendThread->setObjectName("DBusWrapper");
-        backendThread->moveToThread(qApp->thread());
-        qAddPostRoutine(cleanupBackendThread);
-        backendThread->start();
+    if (backendThreads.empty()) {
+        qRegisterMetaType<PropertySnapshotPtr>();
+        qRegisterMetaType<PropertyHandle>();
+        qAddPostRoutine(cleanupBackendThreads);
+    }
+    auto thread = std::make_unique<QThread>();
+    thread->setObjectName(name);
+    thread->moveToThread(qApp->thread());
+    thread->start(priority);
+    qCDebug(logCacheInternal) << "started backend thread" << name;
+    backendThreads.push_back(std::move(thread));
+    return backendThreads.back().get();
+}
+
+// Returns the thread for the backends of a service, starting it if necessary. Must hold backendsMutex.
+static QThread* backendThreadFor(const QDBusConnection& bus, const QString& service)
+{
+    const auto key = qMakePair(bus.name(), service);
+    auto priority = servicePriorities.constFind(key);
+    if (priority != servicePriorities.constEnd()) {
+        QThread*& thread = priorityThreads[int(priority.value())];
+        if (!thread)
+            thread = startBackendThread(QStringLiteral("DBusWrapper-p%1").arg(int(priority.value())), priority.value());
+        return thread;
     }
 
+    if (backendThreadPool.isEmpty())
+        backendThreadPool.resize(backendThreadCount);
+    const int index = int(qHash(key) % uint(backendThreadPool.size()));
+    QThread*& thread = backendThreadPool[index];
+    if (!thread) {
+        const QString name = index ? QStringLiteral("DBusWrapper-%1").arg(index) : QStringLiteral("DBusWrapper");
+        thread = startBackendThread(name, QThread::InheritPriority);
+    }
+    return thread;
+}
+
+PropertyCacheBackend::PropertyCacheBackend(const Target& target)
+    : m_target(target), m_propertiesTarget(target.withInterface(k_property_interface))
+    , m_journalCapacity(backendJournalCapacity)
+{
+    // backend lock is held
     qCDebug(logCacheInternal) << "created" << this << "for" << target;
 
-    moveToThread(backendThread.get());
+    auto snapshot = new PropertySnapshot;
+    snapshot->version = quint64(++backendEpoch) << 32;
+    m_store = snapshotStore;
+    QVariantMap stored;
+    if (m_store && m_store->lookup(target, &stored)) {
+        qCDebug(logPropertyCache) << "using stored properties for" << target << "until they're loaded";
+        snapshot->available = true;
+        snapshot->properties = PropertyMap::fromVariantMap(stored);
+        snapshot->revalidating = true;
+    }
+    m_snapshot = PropertySnapshotPtr(snapshot);
+    m_published.store(m_snapshot);
+
+    m_service = PropertyCacheService::instance(target.bus(), target.service());
+    moveToThread(m_service->thread());
     bool ok = QMetaObject::invokeMethod(this, &PropertyCacheBackend::load, Qt::QueuedConnection);
     Q_ASSERT(ok);
     Q_UNUSED(ok);
@@ -542,8 +2171,7 @@ PropertyCacheBackend::~PropertyCacheBackend()
 {
     // NOTE: backend lock may or may not be held; don't use it or rely on it here
     qCDebug(logCacheInternal) << "destroyed" << this << "for" << m_target;
-    m_target.bus().disconnect(m_target.service(), m_target.path(), k_property_interface, k_properties_changed_signal_name,
-                              {m_target.interface()}, QString(), this, SLOT(propertiesChanged(QString,QVariantMap)));
+    m_service->detach(this);
 }
 
 bool PropertyCacheBackend::test_backendsEmpty()
@@ -555,32 +2183,51 @@ bool PropertyCacheBackend::test_backendsEmpty()
 void PropertyCacheBackend::test_clearCache()
 {
     QMutexLocker lock(&backendsMutex);
-    for (auto b : unusedCacheBackends)
-        b->deleteLater();
-    unusedCacheBackends.clear();
+    clearUnusedBackends();
 }
 
-Target PropertyCacheBackend::propertiesTarget() const
+QThread* PropertyCacheBackend::test_backendThread(const Target& target)
 {
-    return m_target.withInterface(k_property_interface);
+    QMutexLocker lock(&backendsMutex);
+    auto backend = cacheBackends.value(target).toStrongRef();
+    return backend ? backend->thread() : nullptr;
 }
 
 void PropertyCacheBackend::load()
 {
-    if (m_pendingLoad)
+    if (isLoading())
         return;
-    if (logPropertyCache().isDebugEnabled())
-        m_loadTimer.start();
+    // This load replaces any that was scheduled
+    m_service->unscheduleLoad(this);
+    if (!m_attached) {
+        m_attached = true;
+        m_service->attach(this);
+    }
 
-    if (!m_watcher) {
-        m_watcher = std::make_unique<QDBusServiceWatcher>(m_target.service(), m_target.bus(), QDBusServiceWatcher::WatchForOwnerChange, this);
-        connect(m_watcher.get(), &QDBusServiceWatcher::serviceOwnerChanged, this, &PropertyCacheBackend::serviceOwnerChanged);
-        m_target.bus().connect(m_target.service(), m_target.path(), k_property_interface, k_properties_changed_signal_name, {m_target.interface()}, QString(),
-                    this, SLOT(propertiesChanged(QString,QVariantMap)));
+    // There's no point calling a service that isn't on the bus; it will be loaded when it appears
+    if (m_service->isAbsent()) {
+        qCInfo(logPropertyCache) << "service" << m_target.service() << "is unavailable, waiting to load properties from" << m_target;
+        if (!m_snapshot->revalidating && m_snapshot->error.type() != QDBusError::ServiceUnknown)
+            doReset(QVariantMap(), QDBusError(QDBusError::ServiceUnknown, "DBus service is not available"));
+        return;
     }
 
-    auto msg = propertiesTarget().createMethodCall("GetAll", m_target.interface());
+    count(&PropertyCacheMetrics::loads);
+    // The timer is only invalid before the first load
+    if (m_loadTimer.isValid())
+        count(&PropertyCacheMetrics::retries);
+    m_loadTimer.start();
+
+    if (m_service->loadFromObjectManager(this))
+        return;
+    sendGetAll();
+}
+
+void PropertyCacheBackend::sendGetAll()
+{
+    auto msg = m_propertiesTarget.createMethodCall("GetAll", m_target.interface());
     auto reply = m_target.bus().asyncCall(msg);
+    DBUSWRAPPER_TRACE_ASYNC_BEGIN("backend", "GetAll", quintptr(this), m_target);
     m_pendingLoad = new QDBusPendingCallWatcher(reply, this);
     connect(m_pendingLoad, &QDBusPendingCallWatcher::finished, this, &PropertyCacheBackend::loadReply);
 }
@@ -591,32 +2238,97 @@ void PropertyCacheBackend::loadReply(QDBusPendingCallWatcher *w)
     if (w != m_pendingLoad)
         return;
     m_pendingLoad = nullptr;
+    DBUSWRAPPER_TRACE_ASYNC_END("backend", "GetAll", quintptr(this));
+    DBUSWRAPPER_TRACE_SCOPE("backend", "loadReply", m_target, -1);
+    m_service->noteReply(w->reply());
     QDBusPendingReply<QVariantMap> reply = *w;
+    loadFinished(reply.isError() ? QVariantMap() : reply.value(), reply.error());
+}
 
-    if (reply.isError()) {
-        if (reply.error().type() == QDBusError::ServiceUnknown) {
+void PropertyCacheBackend::loadFinished(const QVariantMap& properties, const QDBusError& error)
+{
+    const quint64 loadTime = quint64(m_loadTimer.elapsed());
+    m_metrics.recordLoadTime(loadTime);
+    globalMetrics.recordLoadTime(loadTime);
+    if (error.isValid())
+        count(&PropertyCacheMetrics::loadErrors);
+    // The service appearing on the bus is already a reason to load, so only other errors back off
+    if (!error.isValid())
+        m_loadFailures = 0;
+    else if (error.type() != QDBusError::ServiceUnknown)
+        m_loadFailures++;
+
+    if (error.isValid()) {
+        if (error.type() == QDBusError::ServiceUnknown) {
             qCInfo(logPropertyCache) << "service" << m_target.service() << "is unavailable, waiting to load properties from" << m_target;
         } else {
-            qCWarning(logPropertyCache) << "loading properties from" << m_target << "failed:" << reply.error();
+            qCWarning(logPropertyCache) << "loading properties from" << m_target << "failed:" << error;
         }
 
-        doReset(QVariantMap(), reply.error());
+        // Keep serving stored properties while the service starts; it will be loaded when it appears on the bus
+        if (m_snapshot->revalidating && error.type() == QDBusError::ServiceUnknown)
+            return;
+        doReset(QVariantMap(), error);
     } else {
-        qCDebug(logPropertyCache) << "received properties from" << m_target << "in" << m_loadTimer.elapsed() << "ms";
-        doReset(reply.value());
+        qCDebug(logPropertyCache) << "received properties from" << m_target << "in" << loadTime << "ms";
+        if (m_snapshot->revalidating)
+            revalidate(properties);
+        else
+            doReset(properties);
     }
 }
 
-void PropertyCacheBackend::serviceOwnerChanged(const QString& service, const QString& oldOwner, const QString& newOwner)
+void PropertyCacheBackend::revalidate(const QVariantMap& properties)
 {
-    Q_UNUSED(service)
-    Q_UNUSED(oldOwner)
+    DBUSWRAPPER_TRACE_SCOPE("backend", "revalidate", m_target, properties.size());
+    cancelGets();
+    QMutexLocker lock(&m_dataMutex);
+    // Stored values are already in use, so only publish the differences instead of a reset. Properties that the
+    // service no longer has change to an invalid value.
+    const PropertyMap& stored = m_snapshot->properties;
+    const PropertyMap loaded = PropertyMap::fromVariantMap(properties);
+    QVariantMap changes;
+    for (auto it = loaded.constBegin(); it != loaded.constEnd(); it++) {
+        auto storedIt = stored.constFind(it.key());
+        if (storedIt == stored.constEnd() || storedIt.value() != it.value())
+            changes.insert(it.key(), it.value());
+    }
+    for (auto it = stored.constBegin(); it != stored.constEnd(); it++) {
+        if (!loaded.contains(it.key()))
+            changes.insert(it.key(), QVariant());
+    }
+    qCDebug(logPropertyCache) << "revalidated stored properties for" << m_target << "with" << changes.size() << "changes";
+
+    auto snapshot = new PropertySnapshot;
+    snapshot->version = m_snapshot->version + 1;
+    snapshot->available = true;
+    snapshot->properties = loaded;
+    snapshot->changes = changes;
+    snapshot->changedHandles.reserve(changes.size());
+    for (auto it = changes.constBegin(); it != changes.constEnd(); it++)
+        snapshot->changedHandles.append(PropertyHandle(it.key()));
+    m_snapshot = PropertySnapshotPtr(snapshot);
+    forgetDecoded();
+    m_published.store(m_snapshot);
+    emit changeProperties(m_snapshot);
+    recordPublished();
+    lock.unlock();
+
+    if (m_store)
+        m_store->update(m_target, properties);
+}
 
+void PropertyCacheBackend::serviceOwnerChanged(const QString& newOwner)
+{
     if (m_pendingLoad) {
         qCDebug(logPropertyCache) << "service owner changed, canceling pending property load from" << m_target;
         m_pendingLoad->deleteLater();
         m_pendingLoad = nullptr;
     }
+    m_service->cancelLoad(this);
+    m_service->unscheduleLoad(this);
+    // Failures of the previous instance of the service don't say anything about the new one
+    m_loadFailures = 0;
 
     if (newOwner.isEmpty()) {
         qCInfo(logPropertyCache) << "service disconnected, resetting properties for" << m_target;
@@ -626,55 +2338,661 @@ void PropertyCacheBackend::serviceOwnerChanged(const QString& service, const QSt
         // Delay the call slightly to give the service a chance to finish starting up and make it more likely that
         // we'll get a useful result the first time. If a PropertiesChanged signal arrives first, that will trigger
         // an immediate load.
-        QTimer::singleShot(50, this, &PropertyCacheBackend::load);
+        m_service->scheduleLoad(this, PropertyCache::reloadPolicy().restartDelay);
+    }
+}
+
+int PropertyCacheBackend::backoff() const
+{
+    if (m_loadFailures == 0)
+        return 0;
+    const auto policy = PropertyCache::reloadPolicy();
+    double delay = policy.initialBackoff * std::pow(qMax(policy.backoffFactor, 1.0), m_loadFailures - 1);
+    delay = qMin(delay, double(policy.maxBackoff));
+    const double jitter = qBound(0.0, policy.jitter, 1.0);
+    delay *= 1 + jitter * (2 * QRandomGenerator::global()->generateDouble() - 1);
+    return qMax(int(delay), 0);
+}
+
+void PropertyCacheBackend::fetch(const QString& property)
+{
+    if (isLoading() || m_pendingGets.contains(property) || !m_snapshot->stale.contains(property))
+        return;
+    qCDebug(logPropertyCache) << "fetching invalidated property" << property << "from" << m_target;
+    auto msg = m_propertiesTarget.createMethodCall("Get", m_target.interface(), property);
+    auto watcher = new QDBusPendingCallWatcher(m_target.bus().asyncCall(msg), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, &PropertyCacheBackend::getReply);
+    m_pendingGets.insert(property, watcher);
+}
+
+void PropertyCacheBackend::getReply(QDBusPendingCallWatcher *w)
+{
+    w->deleteLater();
+    auto it = std::find(m_pendingGets.begin(), m_pendingGets.end(), w);
+    if (it == m_pendingGets.end())
+        return;
+    const QString property = it.key();
+    m_pendingGets.erase(it);
+
+    if (m_refetch.remove(property)) {
+        // Invalidated again while this call was pending, so the reply may already be outdated
+        fetch(property);
+        return;
+    }
+    QDBusPendingReply<QDBusVariant> reply = *w;
+    if (reply.isError()) {
+        qCWarning(logPropertyCache) << "fetching invalidated property" << property << "from" << m_target << "failed:" << reply.error();
+        return;
+    }
+    propertiesChanged({{property, reply.value().variant()}});
+}
+
+QVariant PropertyCacheBackend::decode(PropertyHandle property, const QVariant& value, int type, quint64 version)
+{
+    if (value.userType() != qMetaTypeId<QDBusArgument>())
+        return value;
+    QMutexLocker lock(&m_decodedMutex);
+    // Older snapshots may have a different value than the one that was decoded
+    const bool current = version >= qMax(m_decodedReset, m_decodedChanged.value(property));
+    auto it = m_decoded.constFind(property);
+    if (current && it != m_decoded.constEnd() && it->type == type)
+        return it->value;
+    lock.unlock();
+
+    // Threads may race to decode the same value; the results are equal, and the last one is kept
+    const QDBusArgument arg = value.value<QDBusArgument>();
+    const char* signature = QDBusMetaType::typeToSignature(type);
+    if (!signature || arg.currentSignature() != QLatin1String(signature))
+        return value;
+    QVariant decoded(type, nullptr);
+    if (!QDBusMetaType::demarshall(arg, type, decoded.data()))
+        return value;
+    if (current) {
+        lock.relock();
+        // The property may have changed while decoding
+        if (version >= qMax(m_decodedReset, m_decodedChanged.value(property)))
+            m_decoded.insert(property, {type, decoded});
+    }
+    return decoded;
+}
+
+void PropertyCacheBackend::forgetDecoded()
+{
+    QMutexLocker lock(&m_decodedMutex);
+    if (m_snapshot->isReset) {
+        m_decoded.clear();
+        m_decodedChanged.clear();
+        m_decodedReset = m_snapshot->version;
+        return;
+    }
+    for (auto handle : m_snapshot->changedHandles) {
+        m_decoded.remove(handle);
+        m_decodedChanged.insert(handle, m_snapshot->version);
+    }
+}
+
+void PropertyCacheBackend::count(PropertyCacheMetrics::Counter PropertyCacheMetrics::*counter, quint64 n)
+{
+    if (!n)
+        return;
+    (m_metrics.*counter).fetch_add(n, std::memory_order_relaxed);
+    (globalMetrics.*counter).fetch_add(n, std::memory_order_relaxed);
+}
+
+void PropertyCacheBackend::recordPublished()
+{
+    count(&PropertyCacheMetrics::snapshotsPublished);
+    count(&PropertyCacheMetrics::snapshotsQueued, quint64(m_threadCount));
+    DBUSWRAPPER_TRACE_INSTANT("backend", "publish", m_target, m_snapshot->changedHandles.size());
+
+    if (m_journalCapacity <= 0)
+        return;
+    JournalEntry entry{m_snapshot->version, m_snapshot->changedHandles};
+    if (m_journal.size() < m_journalCapacity) {
+        m_journal.append(std::move(entry));
+    } else {
+        m_journal[m_journalHead] = std::move(entry);
+        m_journalHead = (m_journalHead + 1) % m_journal.size();
+    }
+}
+
+bool PropertyCacheBackend::changesSince(quint64 since, quint64 until, QVector<PropertyHandle>* changed) const
+{
+    changed->clear();
+    if (since == until)
+        return true;
+    // The version before the oldest entry is the last one that can be resumed from
+    if (since > until || m_journal.isEmpty() || since + 1 < m_journal.at(m_journalHead).version)
+        return false;
+
+    QSet<PropertyHandle> seen;
+    for (int i = 0; i < m_journal.size(); i++) {
+        const JournalEntry& entry = m_journal.at((m_journalHead + i) % m_journal.size());
+        if (entry.version <= since)
+            continue;
+        if (entry.version > until)
+            break;
+        for (auto handle : entry.changed) {
+            if (!seen.contains(handle)) {
+                seen.insert(handle);
+                changed->append(handle);
+            }
+        }
+    }
+    return true;
+}
+
+void PropertyCacheMetrics::recordLoadTime(quint64 msec)
+{
+    const int bucket = int(std::lower_bound(std::begin(latencyBounds), std::end(latencyBounds), qint64(msec))
+                           - std::begin(latencyBounds));
+    loadLatency[bucket].fetch_add(1, std::memory_order_relaxed);
+    totalLoadTime.fetch_add(msec, std::memory_order_relaxed);
+    quint64 max = maxLoadTime.load(std::memory_order_relaxed);
+    while (msec > max && !maxLoadTime.compare_exchange_weak(max, msec, std::memory_order_relaxed)) { }
+}
+
+void PropertyCacheMetrics::fill(PropertyCache::Statistics* statistics) const
+{
+    auto get = [](const Counter& counter) { return counter.load(std::memory_order_relaxed); };
+    statistics->loads = get(loads);
+    statistics->retries = get(retries);
+    statistics->loadErrors = get(loadErrors);
+    statistics->loadLatency.resize(latencyBuckets);
+    for (int i = 0; i < latencyBuckets; i++)
+        statistics->loadLatency[i] = get(loadLatency[i]);
+    statistics->totalLoadTime = get(totalLoadTime);
+    statistics->maxLoadTime = get(maxLoadTime);
+    statistics->signalsReceived = get(signalsReceived);
+    statistics->signalsIgnored = get(signalsIgnored);
+    statistics->snapshotsPublished = get(snapshotsPublished);
+    // Delivered is read first, so a concurrent delivery can't make it larger than queued
+    statistics->snapshotsDelivered = get(snapshotsDelivered);
+    statistics->queuedDeliveries = get(snapshotsQueued) - statistics->snapshotsDelivered;
+    statistics->changesDelivered = get(changesDelivered);
+}
+
+void PropertyCacheBackend::cancelGets()
+{
+    for (auto w : qAsConst(m_pendingGets))
+        w->deleteLater();
+    m_pendingGets.clear();
+    m_refetch.clear();
+}
+
+// Sets the changes of snapshot to the differences from before to after, in a single pass over both maps
+static void diffProperties(const PropertyMap& before, const PropertyMap& after, PropertySnapshot* snapshot)
+{
+    QVariantMap& changes = snapshot->changes;
+    auto add = [&](const QString& key, const QVariant& value) {
+        changes.insert(changes.constEnd(), key, value);
+        snapshot->changedHandles.append(PropertyHandle(key));
+    };
+
+    auto a = before.constBegin(), b = after.constBegin();
+    while (a != before.constEnd() || b != after.constEnd()) {
+        if (b == after.constEnd() || (a != before.constEnd() && a.key() < b.key())) {
+            add(a.key(), QVariant());
+            a++;
+        } else if (a == before.constEnd() || b.key() < a.key()) {
+            add(b.key(), b.value());
+            b++;
+        } else {
+            if (a.value() != b.value())
+                add(b.key(), b.value());
+            a++;
+            b++;
+        }
     }
 }
 
 void PropertyCacheBackend::doReset(const QVariantMap& properties, QDBusError error)
 {
+    DBUSWRAPPER_TRACE_SCOPE("backend", "doReset", m_target, properties.size());
+    // Pending Gets are superseded by the new properties
+    cancelGets();
+    // Decoded values would keep the previous replies alive; readers of older snapshots just decode them again
+    {
+        QMutexLocker lock(&m_decodedMutex);
+        m_decoded.clear();
+    }
     QMutexLocker lock(&m_dataMutex);
-    if (logPropertyCacheData().isDebugEnabled() && (!m_properties.isEmpty() || !properties.isEmpty())) {
-        qCDebug(logPropertyCacheData) << "reset" << m_target << m_properties.keys();
+    if (logPropertyCacheData().isDebugEnabled() && (!m_snapshot->properties.isEmpty() || !properties.isEmpty())) {
+        qCDebug(logPropertyCacheData) << "reset" << m_target << m_snapshot->properties.keys();
         for (auto it = properties.constBegin(); it != properties.constEnd(); it++)
             qCDebug(logPropertyCacheData) << m_target << it.key() << "=" << it.value();
     }
-    m_properties = properties;
-    m_error = error;
-    m_available = !error.isValid();
-    emit reset(properties, error);
+    auto snapshot = new PropertySnapshot;
+    snapshot->version = m_snapshot->version + 1;
+    snapshot->isReset = true;
+    snapshot->available = !error.isValid();
+    snapshot->error = error;
+    snapshot->properties = PropertyMap::fromVariantMap(properties);
+    // Computed once here instead of by every thread
+    diffProperties(m_snapshot->properties, snapshot->properties, snapshot);
+    m_snapshot = PropertySnapshotPtr(snapshot);
+    forgetDecoded();
+    m_published.store(m_snapshot);
+    emit reset(m_snapshot);
+    recordPublished();
+    lock.unlock();
+
+    if (m_store && !error.isValid())
+        m_store->update(m_target, properties);
 }
 
-void PropertyCacheBackend::propertiesChanged(const QString&, QVariantMap values)
+void PropertyCacheBackend::propertiesChanged(QVariantMap values, const QStringList& invalidated)
 {
     // Ignore changes while waiting for a reply to GetAll. Emitting any signals would break API
     // guarantees, and any values here will also be in the reply.
-    if (m_pendingLoad) {
+    if (isLoading()) {
+        count(&PropertyCacheMetrics::signalsIgnored);
         qCDebug(logPropertyCache) << "ignored property change signal while loading properties from" << m_target;
         return;
     }
     QMutexLocker lock(&m_dataMutex);
-    if (!m_available) {
+    if (!m_snapshot->available) {
         qCDebug(logPropertyCache) << "retrying load after receiving unexpected PropertiesChanged from" << m_target
-                                  << "which was unavailable because" << m_error;
+                                  << "which was unavailable because" << m_snapshot->error;
         lock.unlock();
-        load();
+        m_service->scheduleLoad(this, backoff());
         return;
     }
 
+    // The previous snapshot's map is shared, so it's only copied (once, here) if something actually changed
+    PropertyMap properties = m_snapshot->properties;
+    QSet<QString> stale = m_snapshot->stale;
     for (auto it = values.begin(); it != values.end(); ) {
         qCDebug(logPropertyCacheData) << "change" << m_target << it.key() << "=" << it.value();
-        auto cacheIt = m_properties.find(it.key());
-        if (cacheIt == m_properties.end()) {
-            m_properties.insert(it.key(), it.value());
-            it++;
-        } else if (cacheIt.value() != it.value()) {
-            cacheIt.value() = it.value();
+        stale.remove(it.key());
+        auto cacheIt = properties.constFind(it.key());
+        if (cacheIt != properties.constEnd() && cacheIt.value() == it.value()) {
+            it = values.erase(it);
+        } else {
+            properties.insert(it.key(), it.value());
             it++;
+        }
+    }
+    for (const auto& property : invalidated) {
+        qCDebug(logPropertyCacheData) << "invalidate" << m_target << property;
+        stale.insert(property);
+    }
+    if (values.isEmpty() && stale == m_snapshot->stale)
+        return;
+
+    auto snapshot = new PropertySnapshot;
+    snapshot->version = m_snapshot->version + 1;
+    snapshot->available = true;
+    snapshot->properties = properties;
+    snapshot->changes = values;
+    snapshot->changedHandles.reserve(values.size());
+    for (auto it = values.constBegin(); it != values.constEnd(); it++)
+        snapshot->changedHandles.append(PropertyHandle(it.key()));
+    snapshot->stale = stale;
+    m_snapshot = PropertySnapshotPtr(snapshot);
+    forgetDecoded();
+    m_published.store(m_snapshot);
+    emit changeProperties(m_snapshot);
+    recordPublished();
+    lock.unlock();
+
+    if (m_store && !values.isEmpty())
+        m_store->change(m_target, values);
+
+    if (invalidated.isEmpty())
+        return;
+    QSet<QString> lazy;
+    {
+        QMutexLocker l(&backendsMutex);
+        lazy = lazyProperties.value(m_target);
+    }
+    for (const auto& property : invalidated) {
+        if (m_pendingGets.contains(property))
+            m_refetch.insert(property);
+        else if (!lazy.contains(property))
+            fetch(property);
+    }
+}
+
+PropertyCacheService::PropertyCacheService(const QDBusConnection& bus, const QString& service, const QString& objectManagerPath)
+    : m_bus(bus), m_service(service), m_objectManagerPath(objectManagerPath)
+{
+    // backend lock is held
+    qCDebug(logCacheInternal) << "created" << this << "for service" << m_service;
+    m_clock.start();
+    m_loadTimer.setSingleShot(true);
+    connect(&m_loadTimer, &QTimer::timeout, this, &PropertyCacheService::startScheduledLoads);
+    moveToThread(backendThreadFor(bus, service));
+}
+
+PropertyCacheService::~PropertyCacheService()
+{
+    qCDebug(logCacheInternal) << "destroyed" << this << "for service" << m_service;
+    if (m_propertiesChangedConnected) {
+        m_bus.disconnect(m_service, QString(), k_property_interface, k_properties_changed_signal_name,
+                         this, SLOT(propertiesChanged(QString,QVariantMap,QStringList,QDBusMessage)));
+    }
+    if (m_objectManagerConnected) {
+        m_bus.disconnect(m_service, m_objectManagerPath, k_object_manager_interface, QStringLiteral("InterfacesAdded"),
+                         this, SLOT(interfacesAdded(QDBusMessage)));
+        m_bus.disconnect(m_service, m_objectManagerPath, k_object_manager_interface, QStringLiteral("InterfacesRemoved"),
+                         this, SLOT(interfacesRemoved(QDBusMessage)));
+    }
+
+    QMutexLocker lock(&backendsMutex);
+    auto it = cacheServices.find(qMakePair(m_bus.name(), m_service));
+    if (it != cacheServices.end() && it->isNull())
+        cacheServices.erase(it);
+}
+
+QSharedPointer<PropertyCacheService> PropertyCacheService::instance(const QDBusConnection& bus, const QString& service)
+{
+    // backend lock is held
+    const auto key = qMakePair(bus.name(), service);
+    auto it = cacheServices.find(key);
+    if (it != cacheServices.end()) {
+        if (auto ref = it->toStrongRef())
+            return ref;
+    }
+
+    QSharedPointer<PropertyCacheService> ref(new PropertyCacheService(bus, service, objectManagerPaths.value(key)),
+                                             &QObject::deleteLater);
+    cacheServices.insert(key, ref.toWeakRef());
+    return ref;
+}
+
+QThread* PropertyCacheService::threadFor(const QDBusConnection& bus, const QString& service)
+{
+    QMutexLocker lock(&backendsMutex);
+    return backendThreadFor(bus, service);
+}
+
+void PropertyCacheService::attach(PropertyCacheBackend* backend)
+{
+    // Like the match rule below, the owner watch is shared by every backend and must exist before the first load
+    if (!m_watcher) {
+        m_watcher = std::make_unique<QDBusServiceWatcher>(m_service, m_bus, QDBusServiceWatcher::WatchForOwnerChange, this);
+        connect(m_watcher.get(), &QDBusServiceWatcher::serviceOwnerChanged, this, &PropertyCacheService::serviceOwnerChanged);
+    }
+    // A single match rule for every path and interface of the service, instead of one for each backend. This must
+    // be installed before the backend loads properties to avoid missing changes.
+    if (!m_propertiesChangedConnected) {
+        m_propertiesChangedConnected = m_bus.connect(m_service, QString(), k_property_interface, k_properties_changed_signal_name,
+                                                     this, SLOT(propertiesChanged(QString,QVariantMap,QStringList,QDBusMessage)));
+        if (!m_propertiesChangedConnected)
+            qCWarning(logPropertyCache) << "failed to connect to PropertiesChanged for service" << m_service;
+    }
+    m_backends.insert(qMakePair(backend->m_target.path(), backend->m_target.interface()), backend);
+}
+
+void PropertyCacheService::detach(PropertyCacheBackend* backend)
+{
+    auto it = m_backends.find(qMakePair(backend->m_target.path(), backend->m_target.interface()));
+    if (it != m_backends.end() && it.value() == backend)
+        m_backends.erase(it);
+    cancelLoad(backend);
+    unscheduleLoad(backend);
+}
+
+void PropertyCacheService::scheduleLoad(PropertyCacheBackend* backend, int delay)
+{
+    const qint64 due = m_clock.elapsed() + qMax(delay, 0);
+    auto it = m_scheduledLoads.find(backend);
+    if (it == m_scheduledLoads.end())
+        m_scheduledLoads.insert(backend, due);
+    else if (due < it.value())
+        it.value() = due;
+    else
+        return;
+    qCDebug(logCacheInternal) << "scheduled load of" << backend->m_target << "in" << delay << "ms";
+    const int remaining = int(qMax<qint64>(due - m_clock.elapsed(), 0));
+    if (!m_loadTimer.isActive() || m_loadTimer.remainingTime() > remaining)
+        m_loadTimer.start(remaining);
+}
+
+void PropertyCacheService::unscheduleLoad(PropertyCacheBackend* backend)
+{
+    m_scheduledLoads.remove(backend);
+    if (m_scheduledLoads.isEmpty())
+        m_loadTimer.stop();
+}
+
+void PropertyCacheService::startScheduledLoads()
+{
+    const auto policy = PropertyCache::reloadPolicy();
+    const qint64 now = m_clock.elapsed();
+    QVector<QPair<qint64, PropertyCacheBackend*>> due;
+    qint64 next = -1;
+    for (auto it = m_scheduledLoads.constBegin(); it != m_scheduledLoads.constEnd(); it++) {
+        if (it.value() <= now)
+            due.append({it.value(), it.key()});
+        else if (next < 0 || it.value() < next)
+            next = it.value();
+    }
+    std::sort(due.begin(), due.end());
+
+    // Managed objects are loaded with a single call, so they don't count towards the burst
+    int started = 0;
+    const int burstSize = qMax(policy.burstSize, 1);
+    for (const auto& load : qAsConst(due)) {
+        PropertyCacheBackend* backend = load.second;
+        const bool managed = isManaged(backend->m_target.path());
+        if (!managed && started == burstSize) {
+            const qint64 burst = now + qMax(policy.burstInterval, 0);
+            next = (next < 0) ? burst : qMin(next, burst);
+            continue;
+        }
+        m_scheduledLoads.remove(backend);
+        if (!managed)
+            started++;
+        backend->load();
+    }
+    if (next >= 0)
+        m_loadTimer.start(int(qMax<qint64>(next - now, 0)));
+}
+
+void PropertyCacheService::serviceOwnerChanged(const QString& service, const QString& oldOwner, const QString& newOwner)
+{
+    Q_UNUSED(service)
+    Q_UNUSED(oldOwner)
+    m_owner = newOwner;
+    m_ownerKnown = true;
+    qCDebug(logCacheInternal) << "owner of" << m_service << "changed to" << newOwner << "for" << m_backends.size() << "caches";
+    // Backends don't attach or detach while handling the change, but copy them to be safe
+    const auto backends = m_backends.values();
+    for (auto backend : backends)
+        backend->serviceOwnerChanged(newOwner);
+}
+
+void PropertyCacheService::noteReply(const QDBusMessage& reply)
+{
+    if (m_ownerKnown)
+        return;
+    if (reply.type() == QDBusMessage::ReplyMessage) {
+        m_owner = reply.service();
+        m_ownerKnown = true;
+    } else if (reply.type() == QDBusMessage::ErrorMessage && QDBusError(reply).type() == QDBusError::ServiceUnknown) {
+        m_owner.clear();
+        m_ownerKnown = true;
+    }
+}
+
+void PropertyCacheService::propertiesChanged(const QString& interface, const QVariantMap& values,
+                                             const QStringList& invalidated, const QDBusMessage& msg)
+{
+    auto backend = m_backends.value(qMakePair(msg.path(), interface));
+    if (!backend)
+        return;
+    backend->count(&PropertyCacheMetrics::signalsReceived);
+    DBUSWRAPPER_TRACE_SCOPE("backend", "PropertiesChanged", backend->m_target, values.size() + invalidated.size());
+    backend->propertiesChanged(values, invalidated);
+}
+
+bool PropertyCacheService::isManaged(const QString& path) const
+{
+    // Note that ObjectManager only reports objects _below_ its path, not the manager object itself.
+    if (m_objectManagerPath.isEmpty() || m_objectManagerUnsupported || path == m_objectManagerPath)
+        return false;
+    if (m_objectManagerPath == QLatin1String("/"))
+        return true;
+    return path.startsWith(m_objectManagerPath + QLatin1Char('/'));
+}
+
+bool PropertyCacheService::loadFromObjectManager(PropertyCacheBackend* backend)
+{
+    if (!isManaged(backend->m_target.path()))
+        return false;
+
+    if (!m_objectManagerConnected) {
+        m_bus.connect(m_service, m_objectManagerPath, k_object_manager_interface, QStringLiteral("InterfacesAdded"),
+                      this, SLOT(interfacesAdded(QDBusMessage)));
+        m_bus.connect(m_service, m_objectManagerPath, k_object_manager_interface, QStringLiteral("InterfacesRemoved"),
+                      this, SLOT(interfacesRemoved(QDBusMessage)));
+        m_objectManagerConnected = true;
+    }
+
+    m_waiting.insert(backend);
+    backend->m_pendingManagedLoad = true;
+    if (!m_pendingLoad) {
+        qCDebug(logPropertyCache) << "loading managed objects from" << m_service << "at" << m_objectManagerPath;
+        auto msg = QDBusMessage::createMethodCall(m_service, m_objectManagerPath, k_object_manager_interface,
+                                                  QStringLiteral("GetManagedObjects"));
+        m_pendingLoad = new QDBusPendingCallWatcher(m_bus.asyncCall(msg), this);
+        DBUSWRAPPER_TRACE_ASYNC_BEGIN("service", "GetManagedObjects", quintptr(this),
+                                      Target(m_bus, m_service, m_objectManagerPath, k_object_manager_interface));
+        connect(m_pendingLoad, &QDBusPendingCallWatcher::finished, this, &PropertyCacheService::managedObjectsReply);
+    }
+    return true;
+}
+
+void PropertyCacheService::cancelLoad(PropertyCacheBackend* backend)
+{
+    if (!m_waiting.remove(backend))
+        return;
+    backend->m_pendingManagedLoad = false;
+
+    // If nobody is waiting anymore, the reply is useless (e.g. the service owner changed)
+    if (m_waiting.isEmpty() && m_pendingLoad) {
+        qCDebug(logPropertyCache) << "canceling pending managed objects load from" << m_service;
+        m_pendingLoad->deleteLater();
+        m_pendingLoad = nullptr;
+    }
+}
+
+static QHash<QString, InterfaceProperties> readManagedObjects(const QDBusArgument& arg)
+{
+    QHash<QString, InterfaceProperties> objects;
+    arg.beginMap();
+    while (!arg.atEnd()) {
+        QDBusObjectPath path;
+        InterfaceProperties interfaces;
+        arg.beginMapEntry();
+        arg >> path >> interfaces;
+        arg.endMapEntry();
+        objects.insert(path.path(), interfaces);
+    }
+    arg.endMap();
+    return objects;
+}
+
+void PropertyCacheService::managedObjectsReply(QDBusPendingCallWatcher* w)
+{
+    w->deleteLater();
+    if (w != m_pendingLoad)
+        return;
+    m_pendingLoad = nullptr;
+    DBUSWRAPPER_TRACE_ASYNC_END("service", "GetManagedObjects", quintptr(this));
+    DBUSWRAPPER_TRACE_SCOPE("service", "managedObjectsReply",
+                            Target(m_bus, m_service, m_objectManagerPath, k_object_manager_interface), m_waiting.size());
+    noteReply(w->reply());
+    const auto waiting = std::exchange(m_waiting, {});
+    for (auto backend : waiting)
+        backend->m_pendingManagedLoad = false;
+
+    QDBusError error = w->error();
+    QHash<QString, InterfaceProperties> objects;
+    if (!w->isError()) {
+        const QDBusMessage reply = w->reply();
+        if (reply.signature() == QLatin1String("a{oa{sa{sv}}}")) {
+            objects = readManagedObjects(qvariant_cast<QDBusArgument>(reply.arguments().constFirst()));
         } else {
-            it = values.erase(it);
+            error = QDBusError(QDBusError::InvalidSignature,
+                               QStringLiteral("Unexpected signature '%1' from GetManagedObjects").arg(reply.signature()));
+        }
+    }
+
+    switch (error.type()) {
+    case QDBusError::UnknownMethod:
+    case QDBusError::UnknownInterface:
+    case QDBusError::UnknownObject:
+        qCWarning(logPropertyCache) << "service" << m_service << "does not implement ObjectManager at" << m_objectManagerPath
+                                    << "- loading properties individually instead:" << error;
+        m_objectManagerUnsupported = true;
+        // Continues the same loads, which were already counted and timed
+        for (auto backend : waiting)
+            backend->sendGetAll();
+        return;
+    default:
+        break;
+    }
+
+    qCDebug(logPropertyCache) << "received" << objects.size() << "managed objects from" << m_service << "for" << waiting.size() << "caches";
+    for (auto backend : waiting) {
+        if (error.isValid()) {
+            backend->loadFinished(QVariantMap(), error);
+            continue;
+        }
+
+        const QString path = backend->m_target.path();
+        const QString interface = backend->m_target.interface();
+        auto objectIt = objects.constFind(path);
+        if (objectIt == objects.constEnd()) {
+            backend->loadFinished(QVariantMap(), QDBusError(QDBusError::UnknownObject,
+                                  QStringLiteral("No such object path '%1'").arg(path)));
+        } else if (!objectIt->contains(interface)) {
+            backend->loadFinished(QVariantMap(), QDBusError(QDBusError::UnknownInterface,
+                                  QStringLiteral("No such interface '%1' at object path '%2'").arg(interface, path)));
+        } else {
+            backend->loadFinished(objectIt->value(interface), QDBusError());
         }
     }
-    emit changeProperties(values);
+}
+
+void PropertyCacheService::interfacesAdded(const QDBusMessage& msg)
+{
+    if (msg.signature() != QLatin1String("oa{sa{sv}}"))
+        return;
+    const QString path = qvariant_cast<QDBusObjectPath>(msg.arguments().at(0)).path();
+    InterfaceProperties interfaces;
+    qvariant_cast<QDBusArgument>(msg.arguments().at(1)) >> interfaces;
+
+    for (auto it = interfaces.constBegin(); it != interfaces.constEnd(); it++) {
+        auto backend = m_backends.value(qMakePair(path, it.key()));
+        // If a load is pending, the reply will include these values
+        if (!backend || backend->isLoading())
+            continue;
+        qCDebug(logPropertyCache) << "interface added, resetting properties for" << backend->m_target;
+        unscheduleLoad(backend);
+        backend->m_loadFailures = 0;
+        backend->doReset(it.value());
+    }
+}
+
+void PropertyCacheService::interfacesRemoved(const QDBusMessage& msg)
+{
+    if (msg.signature() != QLatin1String("oas"))
+        return;
+    const QString path = qvariant_cast<QDBusObjectPath>(msg.arguments().at(0)).path();
+    const QStringList interfaces = msg.arguments().at(1).toStringList();
+
+    for (const auto& interface : interfaces) {
+        auto backend = m_backends.value(qMakePair(path, interface));
+        if (!backend || backend->isLoading())
+            continue;
+        qCInfo(logPropertyCache) << "interface removed, resetting properties for" << backend->m_target;
+        backend->doReset(QVariantMap(), QDBusError(QDBusError::UnknownInterface,
+                         QStringLiteral("Interface '%1' was removed from object path '%2'").arg(interface, path)));
+    }
 }
 
 } // namespace DBusWrapper
@@ -1,17 +1,174 @@
 #pragma once
 
 #include "dbuspropertycache.h"
+#include "dbussnapshotstore_p.h"
+#include "dbuspropertymap_p.h"
 #include <QMutex>
 #include <QThread>
 #include <QVariantMap>
+#include <QVector>
 #include <QElapsedTimer>
+#include <QTimer>
 #include <QSharedPointer>
+#include <QSet>
 #include <QDBusConnection>
+#include <QDBusMessage>
 #include <QDBusServiceWatcher>
 #include <QDBusPendingCallWatcher>
+#include <atomic>
+#include <mutex>
 
 namespace DBusWrapper {
 
+class PropertyCacheBackend;
+class PropertyCacheThreadData;
+
+// Immutable view of a backend's properties at one point in time. The backend publishes a new snapshot for each reset
+// and each PropertiesChanged message; snapshots are shared by the backend and every thread without copying.
+class PropertySnapshot
+{
+public:
+    // Incremented for every snapshot published by a backend. The high 32 bits are different for every backend created
+    // in the process, so versions of one backend are never mistaken for another's.
+    quint64 version = 0;
+    // True if this snapshot replaces all properties, rather than applying changes from the previous version
+    bool isReset = false;
+    bool available = false;
+    QDBusError error;
+    PropertyMap properties;
+    // Properties that changed from the previous version, with an invalid value for properties that were removed
+    QVariantMap changes;
+    // Handles for the keys of changes, in the same order
+    QVector<PropertyHandle> changedHandles;
+    // Properties invalidated by the service that haven't been fetched again; their values in properties are outdated
+    QSet<QString> stale;
+    // True if properties were loaded from the PropertySnapshotStore and haven't been confirmed by the service yet
+    bool revalidating = false;
+
+    // properties as a QVariantMap, built once when first needed and shared by every reader of the snapshot
+    const QVariantMap& variantMap() const;
+
+private:
+    mutable std::once_flag m_variantMapOnce;
+    mutable QVariantMap m_variantMap;
+};
+using PropertySnapshotPtr = QSharedPointer<const PropertySnapshot>;
+
+// Holds the latest snapshot of a backend for readers on any thread, without locks. There are two slots: the writer
+// fills the inactive slot and then makes it active, after waiting for readers that are still copying the pointer
+// out of it. Readers never block, and retry if the slot they picked is being replaced.
+class PublishedSnapshot
+{
+public:
+    // Must only be called by one thread at a time; the backend holds m_dataMutex
+    void store(const PropertySnapshotPtr& snapshot);
+    PropertySnapshotPtr load() const;
+    // The version of the active snapshot, to check for changes without copying it
+    quint64 version() const { return m_version.load(std::memory_order_acquire); }
+
+private:
+    struct Slot
+    {
+        PropertySnapshotPtr snapshot;
+        mutable std::atomic<int> readers{0};
+    };
+    Slot m_slots[2];
+    std::atomic<int> m_active{0};
+    std::atomic<quint64> m_version{0};
+};
+
+// Always-on counters for PropertyCache::statistics(). Each backend has its own, and every count is also added to a
+// process-wide instance. Counters are only ever incremented, so relaxed atomics are enough.
+class PropertyCacheMetrics
+{
+public:
+    // Upper bounds of the load latency buckets in milliseconds; one more bucket counts slower loads
+    static constexpr int latencyBounds[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+    static constexpr int latencyBuckets = int(sizeof(latencyBounds) / sizeof(latencyBounds[0])) + 1;
+
+    using Counter = std::atomic<quint64>;
+    Counter loads{0};
+    Counter retries{0};
+    Counter loadErrors{0};
+    Counter loadLatency[latencyBuckets] = {};
+    Counter totalLoadTime{0};
+    Counter maxLoadTime{0};
+    Counter signalsReceived{0};
+    Counter signalsIgnored{0};
+    Counter snapshotsPublished{0};
+    // Snapshots published multiplied by the number of threads using the backend at that time
+    Counter snapshotsQueued{0};
+    Counter snapshotsDelivered{0};
+    Counter changesDelivered{0};
+
+    void recordLoadTime(quint64 msec);
+    void fill(PropertyCache::Statistics* statistics) const;
+};
+
+// Properties of each interface on an object, as returned by ObjectManager.GetManagedObjects
+using InterfaceProperties = QMap<QString, QVariantMap>;
+
+class PropertyCacheService : public QObject
+{
+    Q_OBJECT
+
+public:
+    PropertyCacheService(const QDBusConnection& bus, const QString& service, const QString& objectManagerPath);
+    ~PropertyCacheService();
+
+    static QSharedPointer<PropertyCacheService> instance(const QDBusConnection& bus, const QString& service);
+    // Returns the backend thread for the service, starting it if necessary. Safe to call from any thread.
+    static QThread* threadFor(const QDBusConnection& bus, const QString& service);
+
+    // Not const because QDBusConnection::connect() isn't
+    QDBusConnection m_bus;
+    const QString m_service;
+    const QString m_objectManagerPath;
+
+    void attach(PropertyCacheBackend* backend);
+    void detach(PropertyCacheBackend* backend);
+
+    bool loadFromObjectManager(PropertyCacheBackend* backend);
+    void cancelLoad(PropertyCacheBackend* backend);
+
+    // Loads the backend after delay milliseconds, or earlier if it was already scheduled
+    void scheduleLoad(PropertyCacheBackend* backend, int delay);
+    void unscheduleLoad(PropertyCacheBackend* backend);
+
+    // True if the service is known not to be on the bus, so calls to it would fail
+    bool isAbsent() const { return m_ownerKnown && m_owner.isEmpty(); }
+    // Learns whether the service is on the bus from a reply to a call to it, until the owner is known
+    void noteReply(const QDBusMessage& reply);
+
+private slots:
+    void serviceOwnerChanged(const QString& service, const QString& oldOwner, const QString& newOwner);
+    void propertiesChanged(const QString& interface, const QVariantMap& values, const QStringList& invalidated,
+                           const QDBusMessage& msg);
+    void managedObjectsReply(QDBusPendingCallWatcher* w);
+    void interfacesAdded(const QDBusMessage& msg);
+    void interfacesRemoved(const QDBusMessage& msg);
+
+private:
+    QHash<QPair<QString, QString>, PropertyCacheBackend*> m_backends;
+    // A single owner watch for all backends, created when the first one attaches. The owner is the unique name of
+    // the service, or empty while it isn't on the bus, and is only known once a reply or an owner change was seen.
+    std::unique_ptr<QDBusServiceWatcher> m_watcher;
+    QString m_owner;
+    bool m_ownerKnown = false;
+    QSet<PropertyCacheBackend*> m_waiting;
+    QDBusPendingCallWatcher* m_pendingLoad = nullptr;
+    bool m_propertiesChangedConnected = false;
+    bool m_objectManagerConnected = false;
+    bool m_objectManagerUnsupported = false;
+    // Time at which each scheduled load is due, from m_clock
+    QHash<PropertyCacheBackend*, qint64> m_scheduledLoads;
+    QElapsedTimer m_clock;
+    QTimer m_loadTimer{this};
+
+    bool isManaged(const QString& path) const;
+    void startScheduledLoads();
+};
+
 class PropertyCacheBackend : public QObject
 {
     Q_OBJECT
@@ -21,49 +178,181 @@ public:
     ~PropertyCacheBackend();
 
     static QSharedPointer<PropertyCacheBackend> instance(const Target& target);
+    // Returns the backends for all of the targets, created or restored under a single lock
+    static QVector<QSharedPointer<PropertyCacheBackend>> instances(const QList<Target>& targets);
+    // Must hold backendsMutex
+    static QSharedPointer<PropertyCacheBackend> instanceLocked(const Target& target);
 
     const Target m_target;
+    // m_target with the properties interface, interned once for every Get, GetAll, and Set call
+    const Target m_propertiesTarget;
     QMutex m_dataMutex;
-    QVariantMap m_properties;
-    QDBusError m_error;
-    bool m_available = false;
+    // The latest published snapshot. Must hold m_dataMutex to access from other threads.
+    PropertySnapshotPtr m_snapshot;
+    // The same snapshot for PropertySnapshotReader, which doesn't lock. Updated with m_snapshot.
+    PublishedSnapshot m_published;
+    // Number of PropertyCacheThreadData using this backend. Must hold m_dataMutex to access.
+    int m_threadCount = 0;
+    PropertyCacheMetrics m_metrics;
+
+    // Sets changed to the properties that changed after version since, up to version until, and returns true, or
+    // returns false if the journal no longer has every version in between. Must hold m_dataMutex.
+    bool changesSince(quint64 since, quint64 until, QVector<PropertyHandle>* changed) const;
+
+    // Adds n to a counter of this backend and to the process-wide counters
+    void count(PropertyCacheMetrics::Counter PropertyCacheMetrics::*counter, quint64 n = 1);
+
+    // Fetches a stale property, unless it's already being fetched
+    void fetch(const QString& property);
+    // Returns value demarshalled as type if it's a QDBusArgument with the matching signature, or value otherwise.
+    // value must be the property's value in the snapshot with the given version. Safe to call from any thread.
+    QVariant decode(PropertyHandle property, const QVariant& value, int type, quint64 version);
+    // Drops decoded values that m_snapshot changed. Must be called before m_snapshot is published.
+    void forgetDecoded();
 
     static bool test_backendsEmpty();
     static void test_clearCache();
+    static QThread* test_backendThread(const Target& target);
 
 signals:
-    void reset(const QVariantMap& values, QDBusError error = QDBusError());
-    void changeProperties(const QVariantMap& values);
+    void reset(const DBusWrapper::PropertySnapshotPtr& snapshot);
+    void changeProperties(const DBusWrapper::PropertySnapshotPtr& snapshot);
 
 private slots:
-    void serviceOwnerChanged(const QString& service, const QString& oldOwner, const QString& newOwner);
     void loadReply(QDBusPendingCallWatcher* w);
-    void propertiesChanged(const QString& interface, QVariantMap values);
+    void getReply(QDBusPendingCallWatcher* w);
 
 private:
-    std::unique_ptr<QDBusServiceWatcher> m_watcher;
+    friend class PropertyCacheService;
+
+    QSharedPointer<PropertyCacheService> m_service;
+    QSharedPointer<PropertySnapshotStore> m_store;
+    bool m_attached = false;
     QDBusPendingCallWatcher* m_pendingLoad = nullptr;
+    bool m_pendingManagedLoad = false;
     QElapsedTimer m_loadTimer;
+    // Consecutive failed loads, for the backoff before loading again
+    int m_loadFailures = 0;
+    // Pending Get calls for stale properties
+    QHash<QString, QDBusPendingCallWatcher*> m_pendingGets;
+    // Properties invalidated again while a Get was pending, which must be fetched again when it finishes
+    QSet<QString> m_refetch;
+
+    // The last value decoded for each property, shared by all threads. Entries are removed when their property
+    // changes, and are only used for snapshots that are at least as new as that change. Must hold m_decodedMutex to
+    // access these.
+    struct DecodedValue
+    {
+        int type;
+        QVariant value;
+    };
+    QMutex m_decodedMutex;
+    QHash<PropertyHandle, DecodedValue> m_decoded;
+    // Version of the latest snapshot that changed each property, and of the latest reset, which changed all of them
+    QHash<PropertyHandle, quint64> m_decodedChanged;
+    quint64 m_decodedReset = 0;
+
+    // Ring buffer of the properties changed by the latest published versions, oldest at m_journalHead once it's
+    // full. Must hold m_dataMutex to access.
+    struct JournalEntry
+    {
+        quint64 version;
+        QVector<PropertyHandle> changed;
+    };
+    QVector<JournalEntry> m_journal;
+    int m_journalHead = 0;
+    int m_journalCapacity = 0;
 
-    Target propertiesTarget() const;
+    bool isLoading() const { return m_pendingLoad || m_pendingManagedLoad; }
     void load();
+    // Sends the GetAll call of a load
+    void sendGetAll();
+    // Returns the delay before loading again after the consecutive failures
+    int backoff() const;
+    void loadFinished(const QVariantMap& properties, const QDBusError& error);
+    void revalidate(const QVariantMap& properties);
+    void propertiesChanged(QVariantMap values, const QStringList& invalidated = QStringList());
+    void cancelGets();
+    // Called by the service when its owner changes
+    void serviceOwnerChanged(const QString& newOwner);
     void doReset(const QVariantMap& properties, QDBusError error = QDBusError());
+    // Counts a new snapshot for every thread using this backend and adds it to the journal. Must hold m_dataMutex.
+    void recordPublished();
+};
+
+// Delivers snapshots from all backends to the PropertyCacheThreadData of one thread. Backends queue snapshots from
+// their threads, and only the first snapshot queued after a delivery wakes up this thread, so a burst of updates to
+// many targets costs a single posted event. Snapshots are applied one at a time in the order they were published.
+class PropertyCacheDispatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    static QSharedPointer<PropertyCacheDispatcher> localInstance();
+
+    // Called on a backend thread with the backend's lock held. A null snapshot asks a coalescing cache to flush.
+    void post(PropertyCacheThreadData* data, const PropertySnapshotPtr& snapshot);
+    // Drops everything queued for data, which must not be posted again. Called on this thread.
+    void cancel(PropertyCacheThreadData* data);
+
+private:
+    struct Delivery
+    {
+        PropertyCacheThreadData* data;
+        PropertySnapshotPtr snapshot;
+    };
+    // Posted deliveries; must hold m_mutex to access
+    QMutex m_mutex;
+    QVector<Delivery> m_queue;
+    // Deliveries taken from the queue and being applied on this thread
+    QVector<Delivery> m_batch;
+    int m_batchIndex = 0;
+
+    void dispatch();
 };
 
-class PropertyCacheThreadData : public QObject
+// Always owned by QSharedPointer, so that deliveries can keep it alive while its signals are emitted
+class PropertyCacheThreadData : public QObject, public QEnableSharedFromThis<PropertyCacheThreadData>
 {
     Q_OBJECT
 
 public:
-    explicit PropertyCacheThreadData(const Target& target);
+    PropertyCacheThreadData(const Target& target, CoalescingPolicy coalescing, const QStringList& watched);
+    PropertyCacheThreadData(const Target& target, CoalescingPolicy coalescing, const QStringList& watched,
+                            const QSharedPointer<PropertyCacheBackend>& backend);
     ~PropertyCacheThreadData();
 
     const Target m_target;
-    QVariantMap m_properties;
+    const CoalescingPolicy m_coalescing;
+    // Sorted names of the properties the caches are interested in, or empty for all properties. Other properties are
+    // left out of m_properties and never signalled.
+    const QStringList m_watched;
+    // The snapshot this thread has adopted; m_properties, m_error, and m_available are copied from it
+    PropertySnapshotPtr m_snapshot;
+    PropertyMap m_properties;
+    // m_properties as a QVariantMap when only some properties are watched, built when first needed after each adopt
+    mutable QVariantMap m_watchedMap;
+    mutable bool m_watchedMapValid = false;
     QDBusError m_error;
     bool m_available = false;
 
-    static QSharedPointer<PropertyCacheThreadData> localInstance(const Target& target);
+    static QSharedPointer<PropertyCacheThreadData> localInstance(const Target& target, CoalescingPolicy coalescing,
+                                                                 const QStringList& watched = QStringList());
+    static QVector<QSharedPointer<PropertyCacheThreadData>> localInstances(const QList<Target>& targets);
+
+    // True once the initial load has finished, whether or not it was successful
+    bool isLoaded() const { return m_available || m_error.isValid(); }
+    bool isWatched(const QString& property) const;
+    bool isWatched(PropertyHandle property) const;
+    // Sets changed to the properties that changed after the version sequence, or returns false if that is unknown
+    bool changesSince(quint64 sequence, QVector<PropertyHandle>* changed) const;
+
+    QVariant value(PropertyHandle property) const;
+    QVariant decode(PropertyHandle property, const QVariant& value, int type) const;
+    quint64 revision(PropertyHandle property) const;
+    QSharedPointer<PendingSet> set(const QString& property, const QVariant& value, PropertyCache::SetMode mode);
+    // Asks the backend to fetch the property if it is stale; called when the property is read
+    void fetchIfStale(const QString& property) const;
 
 signals:
     void availableChanged(bool available);
@@ -72,26 +361,118 @@ signals:
     void lost();
 
     void propertyChanged(const QString& property, const QVariant& value);
+    void propertyHandleChanged(DBusWrapper::PropertyHandle property, const QVariant& value);
     void propertiesReset(const QVariantMap& properties);
+    void revalidated();
 
 private:
+    friend class PropertyCacheDispatcher;
+
     QSharedPointer<PropertyCacheBackend> m_backend;
+    QSharedPointer<PropertyCacheDispatcher> m_dispatcher;
+    QSet<PropertyHandle> m_watchedHandles;
+    // Values of properties that have been read by handle, invalidated as they change. The revision is different
+    // every time an entry is recreated.
+    struct HandleValue
+    {
+        QVariant value;
+        quint64 revision;
+    };
+    mutable QHash<PropertyHandle, HandleValue> m_handleValues;
+    // Stale properties that have been requested from the backend since the current snapshot was adopted
+    mutable QSet<QString> m_fetchRequested;
+
+    // Set calls in flight, with the results they finish. Coalesced calls finish every write they replaced.
+    struct SetCall
+    {
+        QString property;
+        QVector<QSharedPointer<PendingSet>> results;
+        bool coalesced;
+    };
+    QHash<QDBusPendingCallWatcher*, SetCall> m_setCalls;
+    // Coalesced writes waiting for the call in flight, for each property that has one; results is empty if nothing
+    // is waiting. Only the latest value is sent.
+    struct QueuedWrite
+    {
+        QVariant value;
+        QVector<QSharedPointer<PendingSet>> results;
+    };
+    QHash<QString, QueuedWrite> m_queuedWrites;
+
+    void sendSet(const QString& property, const QVariant& value, const QVector<QSharedPointer<PendingSet>>& results,
+                 bool coalesced);
+    void setReply(QDBusPendingCallWatcher* w);
+
+    const HandleValue& handleValue(PropertyHandle property) const;
+    // m_properties as a QVariantMap, for getAll() and propertiesReset
+    const QVariantMap& propertiesMap() const;
+
+    void adopt(const PropertySnapshotPtr& snapshot);
+    // Called on the backend thread to deliver a snapshot through the dispatcher
+    void post(const PropertySnapshotPtr& snapshot);
+    void deliver(const PropertySnapshotPtr& snapshot);
+    void reset(const PropertySnapshotPtr& snapshot);
+    void changeProperties(const PropertySnapshotPtr& snapshot);
+
+    // Coalescing: snapshots are queued directly from the backend thread, merged, and delivered later. Must hold
+    // m_pendingMutex to access the pending members.
+    QMutex m_pendingMutex;
+    PropertySnapshotPtr m_pendingSnapshot;
+    bool m_pendingReset = false;
+    QMap<QString, PropertyHandle> m_pendingChanges;
+    QTimer m_flushTimer;
+    QElapsedTimer m_lastFlush;
+
+    void queueSnapshot(const PropertySnapshotPtr& snapshot);
+    void scheduleFlush();
+    void flush();
+
+    // Filtering: snapshots that don't change anything watched are dropped on the backend thread. m_posted* describe
+    // the last snapshot that wasn't, and must hold the backend's lock to access. Must hold m_pendingMutex to access
+    // the versions that were dropped and haven't been passed by an adopted snapshot yet.
+    bool m_postedRevalidating = false;
+    QSet<QString> m_postedStale;
+    QVector<quint64> m_skippedVersions;
 
-    void reset(const QVariantMap& values, const QDBusError& error);
-    void changeProperties(const QVariantMap& values);
+    QSet<QString> watchedStale(const PropertySnapshot& snapshot) const;
+    bool skip(const PropertySnapshotPtr& snapshot);
 };
 
 class PropertyCachePrivate
 {
 public:
-    PropertyCachePrivate(PropertyCache* q, const Target& target);
+    PropertyCachePrivate(PropertyCache* q, const Target& target, CoalescingPolicy coalescing, const QStringList& watched);
     ~PropertyCachePrivate();
 
     PropertyCache* q;
     QSharedPointer<PropertyCacheThreadData> data;
     bool initialized = false;
 
-    void initialize();
+    // Resumes from the version resume if it's not 0, signalling only the changes since then
+    void initialize(quint64 resume = 0);
+};
+
+class PropertySnapshotReaderPrivate
+{
+public:
+    QSharedPointer<PropertyCacheBackend> backend;
+    PropertySnapshotPtr snapshot;
+    // Stale properties that have been requested from the backend since the snapshot was updated
+    mutable QSet<QString> fetchRequested;
+    // Values read by handle from the snapshot, so that names are only looked up once per update
+    mutable QHash<PropertyHandle, QVariant> handleValues;
+
+    void fetchIfStale(const QString& property) const;
+};
+
+class PropertyCachePreloadPrivate
+{
+public:
+    QList<Target> targets;
+    QVector<QSharedPointer<PropertyCacheThreadData>> data;
+    bool emitted = false;
 };
 
 } // namespace DBusWrapper
+
+Q_DECLARE_METATYPE(DBusWrapper::PropertySnapshotPtr)
@@ -0,0 +1,51 @@
+#include "dbuspropertyhandle.h"
+#include <QReadWriteLock>
+#include <QVector>
+
+namespace DBusWrapper {
+
+namespace {
+
+// Process-wide table of interned property names. Names are never removed, so IDs stay valid forever.
+struct HandleRegistry
+{
+    QReadWriteLock lock;
+    QHash<QString, int> ids;
+    QVector<QString> names;
+};
+
+} // namespace
+
+Q_GLOBAL_STATIC(HandleRegistry, handleRegistry)
+
+PropertyHandle::PropertyHandle(const QString& name)
+{
+    auto registry = handleRegistry();
+    {
+        QReadLocker lock(&registry->lock);
+        auto it = registry->ids.constFind(name);
+        if (it != registry->ids.constEnd()) {
+            m_id = it.value();
+            return;
+        }
+    }
+
+    QWriteLocker lock(&registry->lock);
+    auto it = registry->ids.find(name);
+    if (it == registry->ids.end()) {
+        it = registry->ids.insert(name, registry->names.size());
+        registry->names.append(name);
+    }
+    m_id = it.value();
+}
+
+QString PropertyHandle::name() const
+{
+    if (m_id < 0)
+        return {};
+    auto registry = handleRegistry();
+    QReadLocker lock(&registry->lock);
+    return registry->names.at(m_id);
+}
+
+} // namespace DBusWrapper
@@ -0,0 +1,91 @@
+#include "dbuspropertymap_p.h"
+#include <algorithm>
+
+namespace DBusWrapper {
+
+// Returns the shared copy of a property name
+static QString intern(const QString& key)
+{
+    return PropertyHandle(key).name();
+}
+
+PropertyMap PropertyMap::fromVariantMap(const QVariantMap& map)
+{
+    PropertyMap result;
+    result.m_entries.reserve(map.size());
+    for (auto it = map.constBegin(); it != map.constEnd(); it++)
+        result.m_entries.append({intern(it.key()), it.value()});
+    return result;
+}
+
+QVariantMap PropertyMap::toVariantMap() const
+{
+    QVariantMap map;
+    for (const auto& entry : m_entries)
+        map.insert(map.constEnd(), entry.key, entry.value);
+    return map;
+}
+
+int PropertyMap::lowerBound(const QString& key) const
+{
+    auto it = std::lower_bound(m_entries.constBegin(), m_entries.constEnd(), key,
+                               [](const Entry& entry, const QString& key) { return entry.key < key; });
+    return int(it - m_entries.constBegin());
+}
+
+PropertyMap::const_iterator PropertyMap::constFind(const QString& key) const
+{
+    const int i = lowerBound(key);
+    if (i < m_entries.size() && m_entries.at(i).key == key)
+        return const_iterator(m_entries.constData() + i);
+    return constEnd();
+}
+
+QVariant PropertyMap::value(const QString& key) const
+{
+    auto it = constFind(key);
+    return it != constEnd() ? it.value() : QVariant();
+}
+
+QStringList PropertyMap::keys() const
+{
+    QStringList keys;
+    keys.reserve(m_entries.size());
+    for (const auto& entry : m_entries)
+        keys.append(entry.key);
+    return keys;
+}
+
+void PropertyMap::insert(const QString& key, const QVariant& value)
+{
+    const int i = lowerBound(key);
+    if (i < m_entries.size() && m_entries.at(i).key == key)
+        m_entries[i].value = value;
+    else
+        m_entries.insert(i, {intern(key), value});
+}
+
+void PropertyMap::append(const QString& key, const QVariant& value)
+{
+    Q_ASSERT(m_entries.isEmpty() || m_entries.constLast().key < key);
+    m_entries.append({key, value});
+}
+
+void PropertyMap::remove(const QString& key)
+{
+    const int i = lowerBound(key);
+    if (i < m_entries.size() && m_entries.at(i).key == key)
+        m_entries.remove(i);
+}
+
+bool PropertyMap::operator==(const PropertyMap& other) const
+{
+    if (m_entries.constData() == other.m_entries.constData())
+        return m_entries.size() == other.m_entries.size();
+    return std::equal(m_entries.constBegin(), m_entries.constEnd(), other.m_entries.constBegin(),
+                      other.m_entries.constEnd(), [](const Entry& a, const Entry& b) {
+        return a.key == b.key && a.value == b.value;
+    });
+}
+
+} // namespace DBusWrapper
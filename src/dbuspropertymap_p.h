@@ -0,0 +1,88 @@
+#pragma once
+
+#include "dbuspropertyhandle.h"
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QVariantMap>
+#include <QVector>
+
+namespace DBusWrapper {
+
+struct PropertyMapEntry
+{
+    QString key;
+    QVariant value;
+};
+
+} // namespace DBusWrapper
+
+Q_DECLARE_TYPEINFO(DBusWrapper::PropertyMapEntry, Q_MOVABLE_TYPE);
+
+namespace DBusWrapper {
+
+// Compact map of property names to values, used for the properties of snapshots and threads instead of QVariantMap.
+//
+// Entries are kept in a flat vector sorted in the same order as QVariantMap, so the whole map is a single allocation
+// rather than one node per property. Names are interned through PropertyHandle, so every target with the same
+// property (usually all objects of an interface) shares a single copy of its name. Values are QVariant, which stores
+// small types inline. Copies are implicitly shared, like QVariantMap.
+class PropertyMap
+{
+public:
+    using Entry = PropertyMapEntry;
+
+    class const_iterator
+    {
+    public:
+        const_iterator() = default;
+        explicit const_iterator(const Entry* entry) : m_entry(entry) {}
+
+        const QString& key() const { return m_entry->key; }
+        const QVariant& value() const { return m_entry->value; }
+
+        const_iterator& operator++() { ++m_entry; return *this; }
+        const_iterator operator++(int) { return const_iterator(m_entry++); }
+        bool operator==(const const_iterator& other) const { return m_entry == other.m_entry; }
+        bool operator!=(const const_iterator& other) const { return m_entry != other.m_entry; }
+
+    private:
+        const Entry* m_entry = nullptr;
+    };
+
+    PropertyMap() = default;
+    static PropertyMap fromVariantMap(const QVariantMap& map);
+    QVariantMap toVariantMap() const;
+
+    int size() const { return m_entries.size(); }
+    bool isEmpty() const { return m_entries.isEmpty(); }
+    void clear() { m_entries.clear(); }
+    void reserve(int size) { m_entries.reserve(size); }
+
+    const_iterator constBegin() const { return const_iterator(m_entries.constData()); }
+    const_iterator constEnd() const { return const_iterator(m_entries.constData() + m_entries.size()); }
+    const_iterator begin() const { return constBegin(); }
+    const_iterator end() const { return constEnd(); }
+
+    const_iterator constFind(const QString& key) const;
+    bool contains(const QString& key) const { return constFind(key) != constEnd(); }
+    QVariant value(const QString& key) const;
+    QStringList keys() const;
+
+    // Sets the value of key, interning the name if it's new
+    void insert(const QString& key, const QVariant& value);
+    // Adds key after every existing key, which it must sort after. The name is used as is, so it should come from
+    // another PropertyMap.
+    void append(const QString& key, const QVariant& value);
+    void remove(const QString& key);
+
+    bool operator==(const PropertyMap& other) const;
+    bool operator!=(const PropertyMap& other) const { return !(*this == other); }
+
+private:
+    QVector<Entry> m_entries;
+
+    int lowerBound(const QString& key) const;
+};
+
+} // namespace DBusWrapper
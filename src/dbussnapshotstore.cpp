@@ -0,0 +1,226 @@
+#include "dbussnapshotstore_p.h"
+#include <QDataStream>
+#include <QLoggingCategory>
+#include <QSaveFile>
+
+namespace DBusWrapper {
+
+Q_LOGGING_CATEGORY(logSnapshotStore, "dbuswrapper.propertycache.store", QtWarningMsg)
+
+// File layout, in QDataStream format: magic, format version, entry count, then for each entry the key, the size of
+// the encoded properties, and the encoded properties. The size prefix allows indexing entries without decoding them.
+static constexpr quint32 storeMagic = 0x44425753; // "DBWS"
+static constexpr quint32 storeFormatVersion = 1;
+static constexpr QDataStream::Version storeStreamVersion = QDataStream::Qt_5_12;
+// Delay between an update and writing it to the file, to write many updates at once
+static constexpr int saveDelay = 2000;
+
+static QString storeKey(const Target& target)
+{
+    return target.bus().name() + QLatin1Char('\n') + target.service() + QLatin1Char('\n') + target.path()
+           + QLatin1Char('\n') + target.interface();
+}
+
+PropertySnapshotStore::PropertySnapshotStore(const QString& fileName)
+    : m_fileName(fileName), m_file(fileName)
+{
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(saveDelay);
+    connect(&m_saveTimer, &QTimer::timeout, this, &PropertySnapshotStore::save);
+    open();
+}
+
+PropertySnapshotStore::~PropertySnapshotStore()
+{
+    save();
+}
+
+void PropertySnapshotStore::open()
+{
+    if (!m_file.exists())
+        return;
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qCWarning(logSnapshotStore) << "failed to open property store" << m_fileName << "-" << m_file.errorString();
+        return;
+    }
+    const qint64 size = m_file.size();
+    const uchar* data = size > 0 ? m_file.map(0, size) : nullptr;
+    if (!data) {
+        m_file.close();
+        return;
+    }
+
+    // Entries stay in the mapped memory; QSaveFile replaces the file rather than writing into it
+    const QByteArray mapped = QByteArray::fromRawData(reinterpret_cast<const char*>(data), int(size));
+    QDataStream in(mapped);
+    in.setVersion(storeStreamVersion);
+    quint32 magic = 0, version = 0, count = 0;
+    in >> magic >> version >> count;
+    if (in.status() != QDataStream::Ok || magic != storeMagic || version != storeFormatVersion) {
+        qCWarning(logSnapshotStore) << "ignoring property store" << m_fileName << "with unknown format";
+        return;
+    }
+
+    for (quint32 i = 0; i < count; i++) {
+        QString key;
+        quint32 entrySize = 0;
+        in >> key >> entrySize;
+        const qint64 offset = in.device()->pos();
+        if (in.status() != QDataStream::Ok || offset + entrySize > size) {
+            qCWarning(logSnapshotStore) << "property store" << m_fileName << "is truncated after" << i << "entries";
+            break;
+        }
+        m_entries.insert(key, QByteArray::fromRawData(mapped.constData() + offset, int(entrySize)));
+        in.skipRawData(int(entrySize));
+    }
+    qCDebug(logSnapshotStore) << "loaded" << m_entries.size() << "entries from property store" << m_fileName;
+}
+
+bool PropertySnapshotStore::isStorable(const QVariant& value)
+{
+    switch (value.userType()) {
+    case QMetaType::QVariantList:
+        for (const auto& v : value.toList()) {
+            if (!isStorable(v))
+                return false;
+        }
+        return true;
+    case QMetaType::QVariantMap: {
+        const QVariantMap map = value.toMap();
+        for (auto it = map.constBegin(); it != map.constEnd(); it++) {
+            if (!isStorable(it.value()))
+                return false;
+        }
+        return true;
+    }
+    default:
+        // Types registered by QtDBus (e.g. QDBusArgument and QDBusObjectPath) have no stream operators
+        return value.isValid() && value.userType() < QMetaType::User;
+    }
+}
+
+bool PropertySnapshotStore::lookup(const Target& target, QVariantMap* properties)
+{
+    const QString key = storeKey(target);
+    QMutexLocker lock(&m_mutex);
+    auto update = m_updates.constFind(key);
+    if (update != m_updates.constEnd()) {
+        *properties = update.value();
+        return true;
+    }
+
+    auto it = m_entries.constFind(key);
+    if (it == m_entries.constEnd())
+        return false;
+    QDataStream in(it.value());
+    in.setVersion(storeStreamVersion);
+    QVariantMap decoded;
+    in >> decoded;
+    if (in.status() != QDataStream::Ok) {
+        qCWarning(logSnapshotStore) << "failed to decode stored properties for" << target;
+        return false;
+    }
+    *properties = decoded;
+    return true;
+}
+
+void PropertySnapshotStore::update(const Target& target, const QVariantMap& properties)
+{
+    const QString key = storeKey(target);
+    bool storable = true;
+    for (auto it = properties.constBegin(); it != properties.constEnd() && storable; it++)
+        storable = isStorable(it.value());
+
+    QMutexLocker lock(&m_mutex);
+    if (storable) {
+        m_updates.insert(key, properties);
+    } else {
+        // Partial values would break the guarantee that every property has a value, so don't store the target at all
+        qCDebug(logSnapshotStore) << "not storing properties for" << target << "because some types can't be stored";
+        m_updates.remove(key);
+        if (!m_entries.remove(key))
+            return;
+    }
+    if (m_saveScheduled)
+        return;
+    m_saveScheduled = true;
+    QMetaObject::invokeMethod(&m_saveTimer, static_cast<void (QTimer::*)()>(&QTimer::start), Qt::QueuedConnection);
+}
+
+void PropertySnapshotStore::change(const Target& target, const QVariantMap& changes)
+{
+    const QString key = storeKey(target);
+    bool storable = true;
+    for (auto it = changes.constBegin(); it != changes.constEnd() && storable; it++)
+        storable = isStorable(it.value());
+
+    QMutexLocker lock(&m_mutex);
+    auto update = m_updates.find(key);
+    if (update == m_updates.end()) {
+        // Targets that aren't stored stay that way until they're loaded again
+        auto it = m_entries.constFind(key);
+        if (it == m_entries.constEnd())
+            return;
+        if (!storable) {
+            qCDebug(logSnapshotStore) << "not storing properties for" << target << "because some types can't be stored";
+            m_entries.erase(it);
+        } else {
+            // Decoded once after each save, and later changes are merged into the pending update
+            QDataStream in(it.value());
+            in.setVersion(storeStreamVersion);
+            QVariantMap decoded;
+            in >> decoded;
+            if (in.status() != QDataStream::Ok)
+                return;
+            update = m_updates.insert(key, decoded);
+        }
+    } else if (!storable) {
+        qCDebug(logSnapshotStore) << "not storing properties for" << target << "because some types can't be stored";
+        m_updates.erase(update);
+        m_entries.remove(key);
+    }
+    if (storable) {
+        for (auto it = changes.constBegin(); it != changes.constEnd(); it++)
+            update.value().insert(it.key(), it.value());
+    }
+    if (m_saveScheduled)
+        return;
+    m_saveScheduled = true;
+    QMetaObject::invokeMethod(&m_saveTimer, static_cast<void (QTimer::*)()>(&QTimer::start), Qt::QueuedConnection);
+}
+
+void PropertySnapshotStore::save()
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_saveScheduled)
+        return;
+    m_saveScheduled = false;
+
+    for (auto it = m_updates.constBegin(); it != m_updates.constEnd(); it++) {
+        QByteArray encoded;
+        QDataStream out(&encoded, QIODevice::WriteOnly);
+        out.setVersion(storeStreamVersion);
+        out << it.value();
+        m_entries.insert(it.key(), encoded);
+    }
+    m_updates.clear();
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(logSnapshotStore) << "failed to write property store" << m_fileName << "-" << file.errorString();
+        return;
+    }
+    QDataStream out(&file);
+    out.setVersion(storeStreamVersion);
+    out << storeMagic << storeFormatVersion << quint32(m_entries.size());
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); it++) {
+        out << it.key() << quint32(it.value().size());
+        out.writeRawData(it.value().constData(), it.value().size());
+    }
+    if (!file.commit())
+        qCWarning(logSnapshotStore) << "failed to write property store" << m_fileName << "-" << file.errorString();
+    else
+        qCDebug(logSnapshotStore) << "saved" << m_entries.size() << "entries to property store" << m_fileName;
+}
+
+} // namespace DBusWrapper
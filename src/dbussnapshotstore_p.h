@@ -0,0 +1,53 @@
+#pragma once
+
+#include "dbustarget.h"
+#include <QObject>
+#include <QMutex>
+#include <QHash>
+#include <QFile>
+#include <QTimer>
+#include <QVariantMap>
+
+namespace DBusWrapper {
+
+// Persistent store of the last known properties of each target, used to serve values immediately at startup while
+// the service is loaded again. The file is memory-mapped when the store is opened, and entries are only decoded when
+// they're looked up.
+//
+// Updates are kept in memory and written to the file (replacing it atomically) shortly after they happen, and when the
+// application exits. This is safe to use from any thread.
+class PropertySnapshotStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PropertySnapshotStore(const QString& fileName);
+    ~PropertySnapshotStore();
+
+    const QString m_fileName;
+
+    bool lookup(const Target& target, QVariantMap* properties);
+    void update(const Target& target, const QVariantMap& properties);
+    // Merges changed values into the stored properties of a target, if it's stored
+    void change(const Target& target, const QVariantMap& changes);
+
+    // Returns true if the value can be written to the store
+    static bool isStorable(const QVariant& value);
+
+public slots:
+    void save();
+
+private:
+    QMutex m_mutex;
+    QFile m_file;
+    // Encoded properties for each target. Entries loaded from the file point into the mapped memory.
+    QHash<QString, QByteArray> m_entries;
+    // Updates that haven't been encoded and saved yet
+    QHash<QString, QVariantMap> m_updates;
+    bool m_saveScheduled = false;
+    QTimer m_saveTimer;
+
+    void open();
+};
+
+} // namespace DBusWrapper
@@ -0,0 +1,93 @@
+#include "dbustarget.h"
+#include <QReadWriteLock>
+
+namespace DBusWrapper {
+
+namespace {
+
+struct TargetKey
+{
+    QString busName, service, path, interface;
+
+    bool operator==(const TargetKey& other) const
+    {
+        return busName == other.busName && service == other.service && path == other.path &&
+                interface == other.interface;
+    }
+};
+
+uint qHash(const TargetKey& key, uint seed = 0) noexcept
+{
+    QtPrivate::QHashCombine hash;
+    seed = hash(seed, key.busName);
+    seed = hash(seed, key.service);
+    seed = hash(seed, key.path);
+    seed = hash(seed, key.interface);
+    return seed;
+}
+
+// Process-wide table of the identities of live targets
+struct TargetRegistry
+{
+    QReadWriteLock lock;
+    QHash<TargetKey, Detail::TargetIdentity*> identities;
+};
+
+// Adds a reference unless the identity was already released, or belongs to an earlier connection with the same name
+bool tryRef(Detail::TargetIdentity* identity, const QDBusConnection& bus)
+{
+    if (!(identity->bus == bus))
+        return false;
+    int ref = identity->ref.load(std::memory_order_relaxed);
+    while (ref > 0) {
+        if (identity->ref.compare_exchange_weak(ref, ref + 1, std::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+Q_GLOBAL_STATIC(TargetRegistry, targetRegistry)
+
+Detail::TargetIdentity* Detail::TargetIdentity::intern(const QDBusConnection& bus, const QString& service,
+                                                       const QString& path, const QString& interface)
+{
+    TargetKey key{bus.name(), service, path, interface};
+    if (key.busName.isEmpty() && service.isEmpty() && path.isEmpty() && interface.isEmpty())
+        return nullptr;
+    const uint hash = qHash(key);
+
+    auto registry = targetRegistry();
+    if (!registry)
+        return new TargetIdentity{bus, key.busName, service, path, interface, hash, {1}};
+    {
+        QReadLocker lock(&registry->lock);
+        auto it = registry->identities.constFind(key);
+        if (it != registry->identities.constEnd() && tryRef(it.value(), bus))
+            return it.value();
+    }
+
+    QWriteLocker lock(&registry->lock);
+    TargetIdentity*& identity = registry->identities[key];
+    if (identity && tryRef(identity, bus))
+        return identity;
+    // An identity that was released but hasn't unregistered yet is replaced, as is one for a connection that was
+    // closed and reopened under the same name; neither removes its replacement
+    identity = new TargetIdentity{bus, key.busName, service, path, interface, hash, {1}};
+    return identity;
+}
+
+void Detail::TargetIdentity::release(TargetIdentity* identity)
+{
+    // Nothing can reference the identity again, because tryRef() fails once the count reaches zero
+    if (auto registry = targetRegistry()) {
+        QWriteLocker lock(&registry->lock);
+        auto it = registry->identities.find({identity->busName, identity->service, identity->path, identity->interface});
+        if (it != registry->identities.end() && it.value() == identity)
+            registry->identities.erase(it);
+    }
+    delete identity;
+}
+
+} // namespace DBusWrapper
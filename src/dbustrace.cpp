@@ -0,0 +1,249 @@
+#include "dbustrace_p.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace DBusWrapper {
+
+Q_LOGGING_CATEGORY(logTrace, "dbuswrapper.trace", QtWarningMsg)
+
+#ifdef DBUSWRAPPER_TRACING
+
+namespace {
+
+struct Event
+{
+    const char* category;
+    const char* name;
+    char phase;
+    qint64 timestamp;
+    qint64 duration;
+    quint64 id;
+    // Only the names of the target are kept, because a Target would keep its bus connected
+    QString service, path, interface;
+    qint64 count;
+};
+
+// Events of one thread. Only that thread records into it, so its lock is uncontended except while the trace is
+// started or exported.
+struct ThreadBuffer
+{
+    QMutex mutex;
+    QVector<Event> events;
+    int capacity = 0;
+    // Events that didn't fit since the trace was started
+    quint64 dropped = 0;
+    int tid = 0;
+    QString name;
+};
+
+// Buffers are kept for the lifetime of the process, so events of threads that have finished can still be exported
+struct TraceRegistry
+{
+    QMutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    int capacity = 0;
+    qint64 startTime = 0;
+};
+
+} // namespace
+
+Q_GLOBAL_STATIC(TraceRegistry, traceRegistry)
+static thread_local ThreadBuffer* localBuffer = nullptr;
+
+std::atomic<bool> TracePrivate::recording{false};
+
+qint64 TracePrivate::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ThreadBuffer* registerThread()
+{
+    auto registry = traceRegistry();
+    if (!registry)
+        return nullptr;
+    QMutexLocker lock(&registry->mutex);
+    auto buffer = std::make_unique<ThreadBuffer>();
+    buffer->capacity = registry->capacity;
+    buffer->tid = int(registry->buffers.size()) + 1;
+    QThread* thread = QThread::currentThread();
+    buffer->name = thread->objectName();
+    if (buffer->name.isEmpty() && QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+        buffer->name = QStringLiteral("main");
+    else if (buffer->name.isEmpty())
+        buffer->name = QStringLiteral("Thread %1").arg(buffer->tid);
+    registry->buffers.push_back(std::move(buffer));
+    return registry->buffers.back().get();
+}
+
+void TracePrivate::record(const char* category, const char* name, char phase, qint64 timestamp, qint64 duration,
+                          quint64 id, const Target& target, qint64 count)
+{
+    if (traceRegistry.isDestroyed())
+        return;
+    if (!localBuffer)
+        localBuffer = registerThread();
+    if (!localBuffer)
+        return;
+    QMutexLocker lock(&localBuffer->mutex);
+    if (localBuffer->events.size() >= localBuffer->capacity) {
+        localBuffer->dropped++;
+        return;
+    }
+    localBuffer->events.append({category, name, phase, timestamp, duration, id, target.service(), target.path(),
+                                target.interface(), count});
+}
+
+#endif
+
+/*!
+  \brief Returns true if the library was built with tracepoints.
+ */
+bool Trace::isSupported()
+{
+#ifdef DBUSWRAPPER_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*!
+  \brief Discards any previous events and starts recording, keeping up to \a{eventsPerThread} events for each
+  thread.
+
+  Events beyond the limit are dropped, and their number is reported in the exported trace. Each event takes about
+  80 bytes.
+ */
+void Trace::start(int eventsPerThread)
+{
+#ifdef DBUSWRAPPER_TRACING
+    auto registry = traceRegistry();
+    QMutexLocker lock(&registry->mutex);
+    registry->capacity = qMax(eventsPerThread, 0);
+    for (const auto& buffer : registry->buffers) {
+        QMutexLocker bufferLock(&buffer->mutex);
+        buffer->events.clear();
+        buffer->capacity = registry->capacity;
+        buffer->dropped = 0;
+    }
+    registry->startTime = TracePrivate::now();
+    TracePrivate::recording.store(true, std::memory_order_relaxed);
+#else
+    Q_UNUSED(eventsPerThread);
+    qCWarning(logTrace) << "tracing is not supported; configure the library with -DDBUSWRAPPER_TRACING=ON";
+#endif
+}
+
+/*!
+  \brief Stops recording. The events recorded since \l{start()} are kept until it's called again.
+ */
+void Trace::stop()
+{
+#ifdef DBUSWRAPPER_TRACING
+    TracePrivate::recording.store(false, std::memory_order_relaxed);
+#endif
+}
+
+/*!
+  \brief Returns true between \l{start()} and \l{stop()}.
+ */
+bool Trace::isRecording()
+{
+#ifdef DBUSWRAPPER_TRACING
+    return TracePrivate::isRecording();
+#else
+    return false;
+#endif
+}
+
+/*!
+  \brief Returns the recorded events in the Chrome trace event JSON format, which Perfetto also reads.
+
+  It can be called while recording, and includes the events recorded so far.
+ */
+QByteArray Trace::toChromeTrace()
+{
+    QJsonArray events;
+    quint64 dropped = 0;
+#ifdef DBUSWRAPPER_TRACING
+    const qint64 pid = QCoreApplication::applicationPid();
+    auto registry = traceRegistry();
+    QMutexLocker lock(&registry->mutex);
+    const qint64 startTime = registry->startTime;
+    // Timestamps are in microseconds
+    auto micros = [](qint64 nsec) { return double(nsec) / 1000; };
+    for (const auto& buffer : registry->buffers) {
+        QMutexLocker bufferLock(&buffer->mutex);
+        const QVector<Event> recorded = buffer->events;
+        dropped += buffer->dropped;
+        bufferLock.unlock();
+
+        events.append(QJsonObject{{"name", "thread_name"}, {"ph", "M"}, {"pid", pid}, {"tid", buffer->tid},
+                                  {"args", QJsonObject{{"name", buffer->name}}}});
+        for (const auto& event : recorded) {
+            QJsonObject json{{"name", QString::fromLatin1(event.name)}, {"cat", QString::fromLatin1(event.category)},
+                             {"ph", QString(QLatin1Char(event.phase))}, {"ts", micros(event.timestamp - startTime)},
+                             {"pid", pid}, {"tid", buffer->tid}};
+            switch (event.phase) {
+            case 'X':
+                json.insert("dur", micros(event.duration));
+                break;
+            case 'i':
+                json.insert("s", "t");
+                break;
+            case 'f':
+                // Binds to the slice that encloses the end, rather than the next one to begin
+                json.insert("bp", "e");
+                Q_FALLTHROUGH();
+            case 's':
+            case 'b':
+            case 'e':
+                json.insert("id", QStringLiteral("0x%1").arg(event.id, 0, 16));
+                break;
+            }
+            QJsonObject args;
+            if (!event.service.isEmpty())
+                args.insert("service", event.service);
+            if (!event.path.isEmpty())
+                args.insert("path", event.path);
+            if (!event.interface.isEmpty())
+                args.insert("interface", event.interface);
+            if (event.count >= 0)
+                args.insert("count", event.count);
+            if (!args.isEmpty())
+                json.insert("args", args);
+            events.append(json);
+        }
+    }
+#endif
+    QJsonObject trace{{"traceEvents", events}, {"displayTimeUnit", "ns"}};
+    trace.insert("otherData", QJsonObject{{"droppedEvents", double(dropped)}});
+    return QJsonDocument(trace).toJson(QJsonDocument::Compact);
+}
+
+/*!
+  \brief Writes \l{toChromeTrace()} to \a{fileName}, returning false if the file can't be written.
+ */
+bool Trace::saveChromeTrace(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(toChromeTrace()) < 0) {
+        qCWarning(logTrace) << "failed to write trace to" << fileName << ":" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+} // namespace DBusWrapper
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "dbustrace.h"
+#include "dbustarget.h"
+
+// Tracepoints for Trace. They are only compiled with DBUSWRAPPER_TRACING; otherwise every macro expands to nothing
+// and its arguments are never evaluated, so they can construct targets and count values freely.
+//
+//   DBUSWRAPPER_TRACE_SCOPE(category, name, target, count)  a slice from here to the end of the enclosing scope
+//   DBUSWRAPPER_TRACE_INSTANT(category, name, target, count)
+//   DBUSWRAPPER_TRACE_ASYNC_BEGIN(category, name, id, target) / DBUSWRAPPER_TRACE_ASYNC_END(category, name, id)
+//     an operation in flight, such as a call waiting for its reply
+//   DBUSWRAPPER_TRACE_FLOW_BEGIN(category, name, id) / DBUSWRAPPER_TRACE_FLOW_END(category, name, id)
+//     an arrow from the enclosing slice to a slice on another thread
+//
+// Names and categories must be string literals. A count of -1 is left out of the trace.
+
+#ifdef DBUSWRAPPER_TRACING
+
+#include <atomic>
+
+namespace DBusWrapper {
+namespace TracePrivate {
+
+extern std::atomic<bool> recording;
+
+inline bool isRecording()
+{
+    return recording.load(std::memory_order_relaxed);
+}
+
+// Nanoseconds on a monotonic clock
+qint64 now();
+void record(const char* category, const char* name, char phase, qint64 timestamp, qint64 duration, quint64 id,
+            const Target& target, qint64 count);
+
+// Id of the flow for delivering one snapshot to one thread
+inline quint64 deliveryId(const void* data, quint64 version)
+{
+    return quint64(quintptr(data)) * Q_UINT64_C(0x9E3779B97F4A7C15) ^ version;
+}
+
+class Scope
+{
+public:
+    Scope(const char* category, const char* name)
+        : m_category(category), m_name(name), m_start(isRecording() ? now() : -1)
+    {
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope()
+    {
+        if (m_start >= 0)
+            record(m_category, m_name, 'X', m_start, now() - m_start, 0, m_target, m_count);
+    }
+
+    bool isActive() const { return m_start >= 0; }
+    void setArgs(const Target& target, qint64 count)
+    {
+        m_target = target;
+        m_count = count;
+    }
+
+private:
+    const char* m_category;
+    const char* m_name;
+    qint64 m_start;
+    Target m_target;
+    qint64 m_count = -1;
+};
+
+} // namespace TracePrivate
+} // namespace DBusWrapper
+
+#define DBUSWRAPPER_TRACE_CONCAT2(a, b) a##b
+#define DBUSWRAPPER_TRACE_CONCAT(a, b) DBUSWRAPPER_TRACE_CONCAT2(a, b)
+#define DBUSWRAPPER_TRACE_VAR DBUSWRAPPER_TRACE_CONCAT(dbuswrapperTraceScope, __LINE__)
+
+#define DBUSWRAPPER_TRACE_SCOPE(category, name, target, count) \
+    DBusWrapper::TracePrivate::Scope DBUSWRAPPER_TRACE_VAR(category, name); \
+    if (DBUSWRAPPER_TRACE_VAR.isActive()) \
+        DBUSWRAPPER_TRACE_VAR.setArgs(target, count)
+
+#define DBUSWRAPPER_TRACE_EVENT(category, name, phase, id, target, count) \
+    do { \
+        if (Q_UNLIKELY(DBusWrapper::TracePrivate::isRecording())) \
+            DBusWrapper::TracePrivate::record(category, name, phase, DBusWrapper::TracePrivate::now(), 0, id, \
+                                              target, count); \
+    } while (false)
+
+#else
+
+#define DBUSWRAPPER_TRACE_SCOPE(category, name, target, count) do { } while (false)
+#define DBUSWRAPPER_TRACE_EVENT(category, name, phase, id, target, count) do { } while (false)
+
+#endif
+
+#define DBUSWRAPPER_TRACE_INSTANT(category, name, target, count) \
+    DBUSWRAPPER_TRACE_EVENT(category, name, 'i', 0, target, count)
+#define DBUSWRAPPER_TRACE_ASYNC_BEGIN(category, name, id, target) \
+    DBUSWRAPPER_TRACE_EVENT(category, name, 'b', id, target, -1)
+#define DBUSWRAPPER_TRACE_ASYNC_END(category, name, id) \
+    DBUSWRAPPER_TRACE_EVENT(category, name, 'e', id, DBusWrapper::Target(), -1)
+#define DBUSWRAPPER_TRACE_FLOW_BEGIN(category, name, id) \
+    DBUSWRAPPER_TRACE_EVENT(category, name, 's', id, DBusWrapper::Target(), -1)
+#define DBUSWRAPPER_TRACE_FLOW_END(category, name, id) \
+    DBUSWRAPPER_TRACE_EVENT(category, name, 'f', id, DBusWrapper::Target(), -1)
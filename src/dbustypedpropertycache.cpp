@@ -0,0 +1,20 @@
+#include "dbustypedpropertycache.h"
+#include <QLoggingCategory>
+#include <QDBusMetaType>
+
+namespace DBusWrapper {
+
+Q_LOGGING_CATEGORY(logTypedPropertyCache, "dbuswrapper.propertycache.typed", QtWarningMsg)
+
+void Detail::reportTypeMismatch(const Target& target, const char* property, const char* signature, const QVariant& value)
+{
+    QString actual;
+    if (value.userType() == qMetaTypeId<QDBusArgument>())
+        actual = value.value<QDBusArgument>().currentSignature();
+    else
+        actual = QString::fromLatin1(QDBusMetaType::typeToSignature(value.userType()));
+    qCWarning(logTypedPropertyCache) << "property" << property << "from" << target << "has signature" << actual
+                                     << "instead of" << signature;
+}
+
+} // namespace DBusWrapper
@@ -4,5 +4,6 @@ namespace DBusWrapper {
 
 const QString k_property_interface = QStringLiteral("org.freedesktop.DBus.Properties");
 const QString k_properties_changed_signal_name = QStringLiteral("PropertiesChanged");
+const QString k_object_manager_interface = QStringLiteral("org.freedesktop.DBus.ObjectManager");
 
 } // namespace DBusWrapper
@@ -0,0 +1,155 @@
+#include <QTest>
+#include "../src/dbuspropertycache_p.h"
+#include "dbuscoroutines.h"
+#include "dbusadaptorutilities.h"
+#include "dbusutilities.h"
+#include "testbus.h"
+#include "testservice.h"
+#include <exception>
+#include <memory>
+
+static const QString testService = QStringLiteral("test.service");
+static const QString testPath = QStringLiteral("/test/store");
+static const QString testInterface = QStringLiteral("test.service");
+
+using namespace DBusWrapper;
+
+class StoreService : public QObject
+{
+    Q_OBJECT
+
+public:
+    QDBusConnection m_bus;
+    PropertyStore store;
+
+    StoreService(const QDBusConnection& bus, QObject* parent = nullptr)
+        : QObject(parent), m_bus(bus), store(bus, testPath, testInterface)
+    {
+        store.setValues({{"str", "hello"}, {"number", 1}});
+        store.setWritable("str", true);
+        m_bus.registerService(testService);
+    }
+    ~StoreService() {
+        m_bus.unregisterService(testService);
+    }
+};
+
+// Starts running immediately and destroys itself when it returns
+struct Task
+{
+    struct promise_type
+    {
+        Task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+class TestCoroutines : public QObject
+{
+    Q_OBJECT
+
+    std::unique_ptr<DBusTest::TestBus> dbus;
+
+    Target target() const { return Target(dbus->client(), testService, testPath, testInterface); }
+
+private slots:
+    void init()
+    {
+        dbus = std::make_unique<DBusTest::TestBus>();
+        QVERIFY(dbus->isValid());
+    }
+
+    void cleanup()
+    {
+        auto bus = std::move(dbus);
+        PropertyCacheBackend::test_clearCache();
+        QTRY_VERIFY(PropertyCacheBackend::test_backendsEmpty());
+        QVERIFY(bus->waitForAllDisconnected());
+    }
+
+    void readyAndSet()
+    {
+        DBusTest::TestService<StoreService> service(*dbus);
+        PropertyCache cache(target());
+
+        bool done = false, available = false;
+        QThread* resumedOn = nullptr;
+        QDBusError setError, readOnlyError;
+        QString value;
+        auto flow = [&]() -> Task {
+            available = co_await untilReady(cache);
+            resumedOn = QThread::currentThread();
+            setError = co_await cache.set("str", "world");
+            readOnlyError = co_await cache.set("number", 2);
+            value = cache.get<QString>("str");
+            done = true;
+        };
+        flow();
+        QVERIFY(!available);
+        QTRY_VERIFY(done);
+        QVERIFY(available);
+        QCOMPARE(resumedOn, QThread::currentThread());
+        QVERIFY(!setError.isValid());
+        QVERIFY(readOnlyError.isValid());
+        QCOMPARE(value, "world");
+
+        // An initialized cache doesn't suspend
+        done = false;
+        available = false;
+        flow();
+        QVERIFY(available);
+        QTRY_VERIFY(done);
+    }
+
+    void readyWithoutService()
+    {
+        PropertyCache cache(target());
+        bool done = false, available = true;
+        auto flow = [&]() -> Task {
+            available = co_await untilReady(cache);
+            done = true;
+        };
+        flow();
+        QTRY_VERIFY(done);
+        QVERIFY(!available);
+        QVERIFY(cache.error().isValid());
+    }
+
+    void callsAndWhenAll()
+    {
+        DBusTest::TestService<StoreService> service(*dbus);
+        PropertyCache cache(target());
+        const Target properties = target().withInterface(k_property_interface);
+
+        bool done = false, available = false;
+        QVariant str, number;
+        QDBusError missingError, setError;
+        auto flow = [&]() -> Task {
+            auto reply = co_await properties.callAsync<QVariant>("Get", testInterface, QStringLiteral("str"));
+            str = reply.value();
+            auto [ready, numberReply, missing, set] = co_await whenAll(
+                        untilReady(cache),
+                        properties.callAsync<QVariant>("Get", testInterface, QStringLiteral("number")),
+                        properties.callAsync<QVariant>("Get", testInterface, QStringLiteral("missing")),
+                        cache.set("str", "again"));
+            available = ready;
+            number = numberReply.value();
+            missingError = missing.error();
+            setError = set;
+            done = true;
+        };
+        flow();
+        QTRY_VERIFY(done);
+        QCOMPARE(str, QVariant("hello"));
+        QVERIFY(available);
+        QCOMPARE(number, QVariant(1));
+        QVERIFY(missingError.isValid());
+        QVERIFY(!setError.isValid());
+    }
+};
+
+QTEST_MAIN(TestCoroutines)
+#include "tst_coroutines.moc"
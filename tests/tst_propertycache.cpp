@@ -1,10 +1,22 @@
 #include <QTest>
 #include <QSignalSpy>
 #include <QRegularExpression>
+#include <QDBusMetaType>
+#include <QDBusReply>
+#include <QTemporaryDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <atomic>
+#include <memory>
+#include <numeric>
 #include "../src/dbuspropertycache_p.h"
 #include "dbusadaptorutilities.h"
+#include "dbustrace.h"
+#include "dbustypedpropertycache.h"
 #include "testbus.h"
 #include "testservice.h"
+#include "loadservice.h"
 
 static const QString testService = QStringLiteral("test.service");
 static const QString testPath = QStringLiteral("/test/service");
@@ -42,6 +54,7 @@ public:
     }
 
     int strGetCount = 0;
+    int strSetCount = 0;
 
     Q_PROPERTY(QString str READ getStr WRITE setStr)
     QString str = "hello";
@@ -52,10 +65,17 @@ public:
     }
     void setStr(const QString& value)
     {
+        strSetCount++;
         str = value;
         DBusWrapper::emitPropertiesChanged(m_bus, testPath, testInterface, "str", value);
     }
 
+    void invalidateStr(const QString& value)
+    {
+        str = value;
+        DBusWrapper::emitPropertiesChanged(m_bus, testPath, testInterface, QVariantMap(), {"str"});
+    }
+
     Q_PROPERTY(QVariant variant MEMBER variant WRITE setVariant)
     QVariant variant;
     void setVariant(const QVariant& value)
@@ -70,6 +90,105 @@ public:
         str = s;
         DBusWrapper::emitPropertiesChanged(m_bus, testPath, testInterface, {{"variant", v}, {"str", s}});
     }
+
+    DBusWrapper::PropertiesChangedEmitter emitter{m_bus, testPath, testInterface};
+    // Changes str several times and invalidates variant, sending everything through the emitter
+    void setBatched(const QStringList& values, const QVariant& v)
+    {
+        for (const auto& value : values) {
+            str = value;
+            emitter.change("str", value);
+        }
+        emitter.change("variant", variant);
+        variant = v;
+        emitter.invalidate("variant");
+    }
+};
+
+static const QString storePath = QStringLiteral("/test/store");
+
+class StoreService : public QObject
+{
+    Q_OBJECT
+
+public:
+    QDBusConnection m_bus;
+    DBusWrapper::PropertyStore store;
+
+    StoreService(const QDBusConnection& bus, QObject* parent = nullptr)
+        : QObject(parent), m_bus(bus), store(bus, storePath, testInterface)
+    {
+        store.setValues({{"str", "hello"}, {"list", QStringList{"a", "b"}}});
+        store.setWritable("str", true);
+        m_bus.registerService(testService);
+    }
+    ~StoreService() {
+        m_bus.unregisterService(testService);
+    }
+};
+
+using ManagedObjects = QMap<QDBusObjectPath, DBusWrapper::InterfaceProperties>;
+
+class ObjectManagerService : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.freedesktop.DBus.ObjectManager")
+
+public:
+    QDBusConnection m_bus;
+    ManagedObjects objects;
+    int getManagedObjectsCount = 0;
+
+    ObjectManagerService(const QDBusConnection& bus, QObject* parent = nullptr)
+        : QObject(parent), m_bus(bus)
+    {
+        qDBusRegisterMetaType<DBusWrapper::InterfaceProperties>();
+        qDBusRegisterMetaType<ManagedObjects>();
+        for (int i = 0; i < 3; i++) {
+            objects.insert(QDBusObjectPath(QString("/test/path/%1").arg(i)),
+                           {{testInterface, {{"str", QString("hello %1").arg(i)}}}});
+        }
+        m_bus.registerObject("/", this, QDBusConnection::ExportScriptableSlots);
+        m_bus.registerService(testService);
+    }
+    ~ObjectManagerService() {
+        m_bus.unregisterService(testService);
+        m_bus.unregisterObject("/");
+    }
+
+    void addInterface(const QString& path, const QString& interface, const QVariantMap& properties)
+    {
+        objects[QDBusObjectPath(path)].insert(interface, properties);
+        auto signal = QDBusMessage::createSignal("/", DBusWrapper::k_object_manager_interface, "InterfacesAdded");
+        signal << QVariant::fromValue(QDBusObjectPath(path))
+               << QVariant::fromValue(DBusWrapper::InterfaceProperties{{interface, properties}});
+        m_bus.send(signal);
+    }
+
+    void removeInterface(const QString& path, const QString& interface)
+    {
+        objects[QDBusObjectPath(path)].remove(interface);
+        auto signal = QDBusMessage::createSignal("/", DBusWrapper::k_object_manager_interface, "InterfacesRemoved");
+        signal << QVariant::fromValue(QDBusObjectPath(path)) << QStringList{interface};
+        m_bus.send(signal);
+    }
+
+public slots:
+    // Replies manually to avoid registering the return type by name
+    Q_SCRIPTABLE void GetManagedObjects(const QDBusMessage& msg)
+    {
+        getManagedObjectsCount++;
+        msg.setDelayedReply(true);
+        m_bus.send(msg.createReply(QVariant::fromValue(objects)));
+    }
+};
+
+struct PropertyServiceSchema
+{
+    DBUSWRAPPER_PROPERTY(Str, QString, "str", "s");
+    // Deliberately the wrong type for "str"
+    DBUSWRAPPER_PROPERTY(StrAsInt, int, "str", "i");
+    using Properties = std::tuple<Str, StrAsInt>;
 };
 
 class TestPropertyCache : public QObject
@@ -244,6 +363,37 @@ private slots:
         QVERIFY(thread->isFinished());
     }
 
+    void preload()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        // Targets that fail to load are also counted as loaded
+        const DBusWrapper::Target missingTarget(dbus->client(), testService, "/test/missing", testInterface);
+
+        std::unique_ptr<DBusWrapper::PropertyCachePreload> preload(
+            DBusWrapper::PropertyCache::preload({target, missingTarget, target}));
+        QSignalSpy spyReady(preload.get(), &DBusWrapper::PropertyCachePreload::ready);
+        QCOMPARE(preload->targets().size(), 3);
+        QVERIFY(!preload->isReady());
+        QVERIFY(spyReady.wait());
+        QCOMPARE(spyReady.count(), 1);
+        QVERIFY(preload->isReady());
+        QCOMPARE(preload->loadedCount(), 3);
+
+        DBusWrapper::PropertyCache cache(target);
+        QVERIFY(expectInitialization(&cache, InitializeImmediately));
+        DBusWrapper::PropertyCache missingCache(missingTarget);
+        QVERIFY(missingCache.initialize());
+        QVERIFY(missingCache.error().isValid());
+
+        // Preloading targets that are already loaded still signals from the event loop
+        std::unique_ptr<DBusWrapper::PropertyCachePreload> again(DBusWrapper::PropertyCache::preload({target}));
+        QSignalSpy spyAgain(again.get(), &DBusWrapper::PropertyCachePreload::ready);
+        QCOMPARE(spyAgain.count(), 0);
+        QVERIFY(spyAgain.wait());
+        service.sync([](auto s) { QCOMPARE(s->strGetCount, 1); });
+    }
+
     void cachePersistence()
     {
         DBusTest::TestService<PropertyService> service(*dbus);
@@ -271,6 +421,370 @@ private slots:
         QVERIFY(!cache0.initialize());
     }
 
+    void retentionLimits()
+    {
+        using DBusWrapper::PropertyCache;
+        DBusTest::TestService<PropertyService> service(*dbus);
+        const auto defaults = PropertyCache::retentionLimits();
+        QCOMPARE(defaults.capacity, 5);
+        const auto before = PropertyCache::retentionStatistics();
+
+        // Restoring an unused target counts as a hit
+        PropertyCache::setRetentionLimits({5, -1, 100});
+        {
+            PropertyCache cache0(dbus->client(), testService, testPath, testInterface);
+            QTRY_VERIFY(cache0.isAvailable());
+        }
+        QCOMPARE(PropertyCache::retentionStatistics().unusedCount, 1);
+        QVERIFY(PropertyCache::retentionStatistics().unusedSize > 0);
+        {
+            PropertyCache cache0(dbus->client(), testService, testPath, testInterface);
+            QVERIFY(expectInitialization(&cache0, InitializeImmediately));
+        }
+        auto stats = PropertyCache::retentionStatistics();
+        QCOMPARE(stats.hits, before.hits + 1);
+        QCOMPARE(stats.misses, before.misses + 1);
+
+        // Unused targets expire after the idle timeout
+        QTRY_COMPARE(PropertyCache::retentionStatistics().unusedCount, 0);
+        QCOMPARE(PropertyCache::retentionStatistics().expirations, before.expirations + 1);
+
+        // Targets larger than the memory budget are evicted immediately
+        PropertyCache::setRetentionLimits({5, 0, -1});
+        {
+            PropertyCache cache0(dbus->client(), testService, testPath, testInterface);
+            QTRY_VERIFY(cache0.isAvailable());
+        }
+        stats = PropertyCache::retentionStatistics();
+        QCOMPARE(stats.unusedCount, 0);
+        QCOMPARE(stats.evictions, before.evictions + 1);
+        QCOMPARE(stats.misses, before.misses + 2);
+
+        PropertyCache::setRetentionLimits(defaults);
+    }
+
+    void resumeFromSequence()
+    {
+        using DBusWrapper::PropertyCache;
+        DBusTest::TestService<PropertyService> service(*dbus);
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        const int defaultCapacity = PropertyCache::journalCapacity();
+        QCOMPARE(defaultCapacity, 64);
+
+        quint64 first = 0, sequence = 0;
+        {
+            // The reader keeps the data while there is no cache
+            DBusWrapper::PropertySnapshotReader reader(target);
+            {
+                PropertyCache cache(target);
+                QCOMPARE(cache.sequence(), quint64(0));
+                QTRY_VERIFY(cache.isAvailable());
+                first = sequence = cache.sequence();
+                QVERIFY(sequence > 0);
+            }
+
+            // Only the property that changed in between is signalled, with its current value
+            service.invoke([](auto s) { s->setStr("one"); s->setStr("two"); });
+            QTRY_VERIFY((reader.update(), reader.get<QString>("str") == "two"));
+            {
+                PropertyCache cache(target);
+                QSignalSpy spyReset(&cache, &PropertyCache::propertiesReset);
+                QSignalSpy spyChanged(&cache, &PropertyCache::propertyChanged);
+                QSignalSpy spyReady(&cache, &PropertyCache::ready);
+                QVERIFY(cache.initialize(sequence));
+                QCOMPARE(spyReset.count(), 0);
+                QCOMPARE(spyChanged.count(), 1);
+                QCOMPARE(spyChanged.at(0).at(0).toString(), "str");
+                QCOMPARE(spyChanged.at(0).at(1), QVariant("two"));
+                QCOMPARE(spyReady.count(), 1);
+                QCOMPARE(cache.sequence(), sequence + 2);
+                sequence = cache.sequence();
+            }
+
+            // Nothing changed since the current sequence
+            PropertyCache cache(target);
+            QSignalSpy spyChanged(&cache, &PropertyCache::propertyChanged);
+            QSignalSpy spyReady(&cache, &PropertyCache::ready);
+            QVERIFY(cache.initialize(sequence));
+            QCOMPARE(spyChanged.count(), 0);
+            QCOMPARE(spyReady.count(), 1);
+        }
+        DBusWrapper::PropertyCacheBackend::test_clearCache();
+        QTRY_VERIFY(DBusWrapper::PropertyCacheBackend::test_backendsEmpty());
+
+        // Once the journal has wrapped, or for a sequence of data that was discarded, everything is signalled again
+        PropertyCache::setJournalCapacity(1);
+        PropertyCache cache(target);
+        QTRY_VERIFY(cache.isAvailable());
+        QVERIFY(cache.sequence() > sequence);
+        sequence = cache.sequence();
+        service.invoke([](auto s) { s->setStr("three"); s->setStr("four"); });
+        QTRY_COMPARE(cache.get<QString>("str"), "four");
+        for (quint64 resume : {sequence, first}) {
+            PropertyCache resumed(target);
+            QSignalSpy spyReset(&resumed, &PropertyCache::propertiesReset);
+            QVERIFY(resumed.initialize(resume));
+            QCOMPARE(spyReset.count(), 1);
+        }
+        PropertyCache::setJournalCapacity(defaultCapacity);
+    }
+
+    void loadService()
+    {
+        DBusTest::LoadService::Profile profile;
+        profile.paths = 3;
+        profile.properties = 4;
+        profile.payloadSize = 32;
+        profile.batchSize = 4;
+        DBusTest::TestService<DBusTest::LoadService> service(*dbus, [=](auto bus) {
+            return new DBusTest::LoadService(bus, profile);
+        });
+
+        std::vector<std::unique_ptr<DBusWrapper::PropertyCache>> caches;
+        for (int i = 0; i < profile.paths; i++) {
+            caches.push_back(std::make_unique<DBusWrapper::PropertyCache>(dbus->client(), profile.service,
+                                                                          QString("/load/%1").arg(i), profile.interface));
+        }
+        for (const auto& cache : caches) {
+            QTRY_VERIFY(cache->isAvailable());
+            QCOMPARE(cache->getAll().size(), profile.properties);
+            QCOMPARE(cache->get<QByteArray>("property0").size(), profile.payloadSize);
+        }
+
+        // Changes cycle through every property of every object, batched by object
+        service.invoke([](auto s) { s->emitChanges(12); });
+        for (const auto& cache : caches)
+            QTRY_VERIFY(cache->get<QByteArray>("property3").startsWith("1."));
+        service.sync([](auto s) {
+            QCOMPARE(s->changesEmitted(), quint64(12));
+            QCOMPARE(s->signalsEmitted(), quint64(3));
+        });
+
+        // Restarts reload every object
+        QSignalSpy spyLost(caches[0].get(), &DBusWrapper::PropertyCache::lost);
+        service.invoke([](auto s) { s->restart(50); });
+        QVERIFY(spyLost.wait());
+        for (const auto& cache : caches)
+            QTRY_VERIFY(cache->isAvailable());
+        service.sync([](auto s) { QCOMPARE(s->getAllCount(), quint64(6)); });
+
+        // Changes are emitted continuously at the rate
+        service.invoke([](auto s) { s->setRate(1000); });
+        QTRY_VERIFY(!caches[1]->get<QByteArray>("property0").startsWith("1."));
+        service.sync([](auto s) { s->stop(); });
+    }
+
+    void dispatchOrder()
+    {
+        DBusTest::LoadService::Profile profile;
+        profile.paths = 5;
+        profile.properties = 1;
+        DBusTest::TestService<DBusTest::LoadService> service(*dbus, [=](auto bus) {
+            return new DBusTest::LoadService(bus, profile);
+        });
+
+        std::vector<std::unique_ptr<DBusWrapper::PropertyCache>> caches;
+        QVector<int> order;
+        for (int i = 0; i < profile.paths; i++) {
+            caches.push_back(std::make_unique<DBusWrapper::PropertyCache>(dbus->client(), profile.service,
+                                                                          QString("/load/%1").arg(i), profile.interface));
+            QTRY_VERIFY(caches.back()->isAvailable());
+            connect(caches.back().get(), &DBusWrapper::PropertyCache::propertyChanged, [&, i] {
+                order.append(i);
+                // Updates already queued for a destroyed cache are dropped
+                if (i == 1)
+                    caches[3].reset();
+            });
+        }
+
+        // Changes to different targets on the same thread are delivered in the order they were sent
+        service.invoke([](auto s) { s->emitChanges(5); });
+        QTRY_COMPARE(order.size(), 4);
+        QCOMPARE(order, (QVector<int>{0, 1, 2, 4}));
+    }
+
+    void destroyFromSlot()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+
+        // Destroying the only cache on this thread from its signal releases its data and the dispatcher while they
+        // are still delivering the rest of the change
+        auto cache = std::make_unique<DBusWrapper::PropertyCache>(target);
+        QTRY_VERIFY(cache->isAvailable());
+        int changes = 0;
+        connect(cache.get(), &DBusWrapper::PropertyCache::propertyChanged, [&] {
+            changes++;
+            cache.reset();
+        });
+        service.invoke([](auto s) { s->setBoth(1, "destroyed"); });
+        QTRY_VERIFY(!cache);
+        QCOMPARE(changes, 1);
+
+        // A new cache on the same thread still receives changes
+        DBusWrapper::PropertyCache again(target);
+        QTRY_VERIFY(again.isAvailable());
+        QSignalSpy spyChanged(&again, &DBusWrapper::PropertyCache::propertyChanged);
+        service.invoke([](auto s) { s->setStr("again"); });
+        QVERIFY(spyChanged.wait());
+        QCOMPARE(again.get<QString>("str"), "again");
+    }
+
+    void statistics()
+    {
+        using DBusWrapper::PropertyCache;
+        DBusTest::TestService<PropertyService> service(*dbus);
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        const auto before = PropertyCache::statistics();
+        QCOMPARE(before.loadLatency.size(), PropertyCache::loadLatencyBounds().size() + 1);
+
+        PropertyCache cache(target);
+        QTRY_VERIFY(cache.isAvailable());
+        auto stats = PropertyCache::statistics(target);
+        QCOMPARE(stats.loads, quint64(1));
+        QCOMPARE(stats.retries, quint64(0));
+        QCOMPARE(std::accumulate(stats.loadLatency.begin(), stats.loadLatency.end(), quint64(0)), quint64(1));
+        QVERIFY(PropertyCache::statistics().liveTargets >= 1);
+        QCOMPARE(PropertyCache::statistics().loads, before.loads + 1);
+
+        service.invoke([](auto s) { s->setStr("one"); s->setStr("two"); });
+        QTRY_COMPARE(cache.get<QString>("str"), "two");
+        QTRY_COMPARE(PropertyCache::statistics(target).queuedDeliveries, quint64(0));
+        const auto changed = PropertyCache::statistics(target);
+        QCOMPARE(changed.signalsReceived, stats.signalsReceived + 2);
+        QCOMPARE(changed.snapshotsPublished, stats.snapshotsPublished + 2);
+        QCOMPARE(changed.snapshotsDelivered, changed.snapshotsPublished);
+        QCOMPARE(changed.changesDelivered, stats.changesDelivered + 2);
+
+        // Unknown targets have no activity
+        const auto unknown = PropertyCache::statistics(target.withInterface("test.unknown"));
+        QCOMPARE(unknown.loads, quint64(0));
+    }
+
+    void tracing()
+    {
+        using DBusWrapper::Trace;
+        if (!Trace::isSupported()) {
+            // Without tracepoints, starting does nothing and the trace is empty
+            QTest::ignoreMessage(QtWarningMsg,
+                                 "tracing is not supported; configure the library with -DDBUSWRAPPER_TRACING=ON");
+            Trace::start();
+            QVERIFY(!Trace::isRecording());
+            const auto trace = QJsonDocument::fromJson(Trace::toChromeTrace()).object();
+            QVERIFY(trace.contains("traceEvents"));
+            QVERIFY(trace.value("traceEvents").toArray().isEmpty());
+            QSKIP("the library was built without DBUSWRAPPER_TRACING");
+        }
+
+        DBusTest::TestService<PropertyService> service(*dbus);
+        Trace::start();
+        QVERIFY(Trace::isRecording());
+        {
+            DBusWrapper::PropertyCache cache(dbus->client(), testService, testPath, testInterface);
+            QTRY_VERIFY(cache.isAvailable());
+            service.invoke([](auto s) { s->setStr("traced"); });
+            QTRY_COMPARE(cache.get<QString>("str"), "traced");
+        }
+        Trace::stop();
+        QVERIFY(!Trace::isRecording());
+
+        // Every stage from the call to the signals of this thread is recorded, and each delivery to this thread
+        // continues a flow started on the backend thread
+        const auto trace = QJsonDocument::fromJson(Trace::toChromeTrace()).object();
+        QSet<QString> names, flowsStarted, flowsEnded;
+        for (const auto& value : trace.value("traceEvents").toArray()) {
+            const QJsonObject event = value.toObject();
+            names.insert(event.value("name").toString());
+            const QString phase = event.value("ph").toString();
+            if (phase == "s")
+                flowsStarted.insert(event.value("id").toString());
+            else if (phase == "f")
+                flowsEnded.insert(event.value("id").toString());
+        }
+        for (const char* name : {"thread_name", "GetAll", "loadReply", "doReset", "publish", "deliver", "reset",
+                                 "PropertiesChanged", "changeProperties", "emitPropertiesChanged"})
+            QVERIFY2(names.contains(name), name);
+        QVERIFY(!flowsEnded.isEmpty());
+        QVERIFY(flowsStarted.contains(flowsEnded));
+        QCOMPARE(trace.value("otherData").toObject().value("droppedEvents").toDouble(), 0.0);
+
+        // Events beyond the capacity are dropped and counted
+        Trace::start(0);
+        DBusWrapper::emitPropertiesChanged(dbus->client(), testPath, testInterface, "str", "dropped");
+        Trace::stop();
+        const auto dropped = QJsonDocument::fromJson(Trace::toChromeTrace()).object();
+        QVERIFY(dropped.value("otherData").toObject().value("droppedEvents").toDouble() >= 1);
+        for (const auto& value : dropped.value("traceEvents").toArray())
+            QCOMPARE(value.toObject().value("ph").toString(), "M");
+    }
+
+    void snapshotReader()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        service.sync([](auto s) { s->setBoth(0, "0"); });
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        DBusWrapper::PropertySnapshotReader reader(target);
+        QTRY_VERIFY((reader.update(), reader.isAvailable()));
+        QCOMPARE(reader.get<QString>("str"), "0");
+        QCOMPARE(reader.get<int>(DBusWrapper::PropertyCache::handle("variant")), 0);
+        QVERIFY(!reader.update());
+
+        // A worker without an event loop always sees both properties of a change together
+        std::atomic<bool> done{false};
+        std::atomic<bool> consistent{true};
+        std::atomic<int> seen{0};
+        std::unique_ptr<QThread> worker(QThread::create([&] {
+            DBusWrapper::PropertySnapshotReader workerReader(target);
+            while (!done) {
+                workerReader.update();
+                if (!workerReader.isAvailable())
+                    continue;
+                const int variant = workerReader.get<int>("variant");
+                if (workerReader.get<QString>("str") != QString::number(variant))
+                    consistent = false;
+                seen = variant;
+            }
+        }));
+        worker->start();
+        const quint64 version = reader.version();
+        service.invoke([](auto s) {
+            for (int i = 1; i <= 100; i++)
+                s->setBoth(i, QString::number(i));
+        });
+        QTRY_COMPARE(seen.load(), 100);
+        done = true;
+        worker->wait();
+        QVERIFY(consistent);
+
+        // The held snapshot only changes when it's updated
+        QCOMPARE(reader.version(), version);
+        QCOMPARE(reader.get<QString>("str"), "0");
+        QVERIFY(reader.update());
+        QCOMPARE(reader.get<QString>("str"), "100");
+        QCOMPARE(reader.version(), version + 100);
+    }
+
+    void backendThreads()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        DBusWrapper::Target otherTarget(dbus->client(), "org.example.other", testPath, testInterface);
+
+        // Services with an explicit priority are isolated on their own thread
+        DBusWrapper::PropertyCache::setServicePriority(dbus->client(), testService, QThread::HighPriority);
+        DBusWrapper::PropertyCache cache(target);
+        DBusWrapper::PropertyCache otherCache(otherTarget);
+        auto thread = DBusWrapper::PropertyCacheBackend::test_backendThread(target);
+        QVERIFY(thread);
+        QVERIFY(thread != QThread::currentThread());
+        QVERIFY(thread != DBusWrapper::PropertyCacheBackend::test_backendThread(otherTarget));
+        QTRY_VERIFY(cache.isAvailable());
+
+        service.invoke([](auto s) { s->setStr("isolated"); });
+        QTRY_COMPARE(cache.get<QString>("str"), "isolated");
+        DBusWrapper::PropertyCache::setServicePriority(dbus->client(), testService, QThread::InheritPriority);
+    }
+
     void destroyQuickly()
     {
         DBusWrapper::PropertyCache cache(dbus->client(), testService, testPath, testInterface);
@@ -296,6 +810,309 @@ private slots:
         QTRY_VERIFY(expected.isEmpty());
     }
 
+    void propertiesChangedEmitter()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        DBusWrapper::PropertyCache cache(dbus->client(), testService, testPath, testInterface);
+        QTRY_VERIFY(cache.isAvailable());
+
+        // Changes in one batch are sent as one signal with the last value of each property
+        QStringList changes;
+        connect(&cache, &DBusWrapper::PropertyCache::propertyChanged, [&](auto property, auto value) {
+            if (property == "str")
+                changes.append(value.toString());
+        });
+        service.invoke([](auto s) { s->setBatched({"one", "two", "three"}, 42); });
+        QTRY_COMPARE(cache.get("variant"), QVariant(42));
+        QCOMPARE(changes, QStringList{"three"});
+        QCOMPARE(cache.get<QString>("str"), "three");
+
+        // Batches are collapsed the same way with a minimum interval
+        service.sync([](auto s) {
+            s->emitter.setInterval(100);
+            QVERIFY(!s->emitter.hasPendingChanges());
+        });
+        service.invoke([](auto s) { s->setBatched({"four", "five"}, 43); });
+        QTRY_COMPARE(cache.get("variant"), QVariant(43));
+        QCOMPARE(changes, (QStringList{"three", "five"}));
+    }
+
+    void propertyStore()
+    {
+        DBusTest::TestService<StoreService> service(*dbus);
+        service.sync([](auto s) { QVERIFY(s->store.isRegistered()); });
+        DBusWrapper::PropertyCache cache(dbus->client(), testService, storePath, testInterface);
+        QTRY_VERIFY(cache.isAvailable());
+        QCOMPARE(cache.get<QString>("str"), "hello");
+        QCOMPARE(cache.get<QStringList>("list"), (QStringList{"a", "b"}));
+
+        // Changes are signalled, and unchanged values are not
+        QStringList changes;
+        connect(&cache, &DBusWrapper::PropertyCache::propertyChanged, [&](auto property, auto) {
+            changes.append(property);
+        });
+        service.invoke([](auto s) { s->store.setValues({{"str", "changed"}, {"list", QStringList{"a", "b"}}}); });
+        QTRY_COMPARE(cache.get<QString>("str"), "changed");
+        QCOMPARE(changes, QStringList{"str"});
+
+        // Writable properties can be set by clients
+        auto result = cache.set("str", "written");
+        QTRY_VERIFY(result->isFinished());
+        QVERIFY(!result->isError());
+        QTRY_COMPARE(cache.get<QString>("str"), "written");
+        service.sync([](auto s) { QCOMPARE(s->store.value("str"), QVariant("written")); });
+
+        result = cache.set("list", QStringList{"c"});
+        QTRY_VERIFY(result->isFinished());
+        QCOMPARE(result->error().type(), QDBusError::PropertyReadOnly);
+
+        // Writes can't change the type of a property
+        result = cache.set("str", 5);
+        QTRY_VERIFY(result->isFinished());
+        QCOMPARE(result->error().type(), QDBusError::InvalidArgs);
+        service.sync([](auto s) { QCOMPARE(s->store.value("str"), QVariant("written")); });
+    }
+
+    void propertyStoreGetAll()
+    {
+        DBusTest::TestService<StoreService> service(*dbus);
+        auto getAll = [this]() {
+            auto call = QDBusMessage::createMethodCall(testService, storePath, DBusWrapper::k_property_interface,
+                                                       "GetAll");
+            call << testInterface;
+            QDBusReply<QVariantMap> reply = dbus->client().call(call);
+            return reply.value();
+        };
+        auto marshalCount = [&service]() {
+            int count = 0;
+            service.sync([&count](auto s) { count = s->store.test_getAllMarshalCount(); });
+            return count;
+        };
+
+        // The reply is marshalled once and reused until a value changes
+        const QVariantMap expected{{"str", "hello"}, {"list", QStringList{"a", "b"}}};
+        for (int i = 0; i < 3; i++)
+            QCOMPARE(getAll(), expected);
+        QCOMPARE(marshalCount(), 1);
+
+        service.sync([](auto s) { s->store.setValue("str", "changed"); });
+        QCOMPARE(getAll().value("str"), QVariant("changed"));
+        QCOMPARE(getAll().value("str"), QVariant("changed"));
+        QCOMPARE(marshalCount(), 2);
+
+        service.sync([](auto s) { s->store.removeValue("list"); });
+        QCOMPARE(getAll(), (QVariantMap{{"str", "changed"}}));
+        QCOMPARE(marshalCount(), 3);
+    }
+
+    void propertyStoreRemove()
+    {
+        DBusTest::TestService<StoreService> service(*dbus);
+        DBusWrapper::PropertyCache cache(dbus->client(), testService, storePath, testInterface);
+        QTRY_VERIFY(cache.isAvailable());
+
+        // Invalid values are rejected instead of removing the property
+        QTest::ignoreMessage(QtWarningMsg, QRegularExpression("ignoring invalid value for \"list\""));
+        service.sync([](auto s) {
+            s->store.setValue("list", QVariant());
+            QCOMPARE(s->store.value("list"), QVariant(QStringList{"a", "b"}));
+        });
+
+        // Removed properties are invalidated for clients
+        service.sync([](auto s) {
+            s->store.removeValue("list");
+            QVERIFY(!s->store.values().contains("list"));
+        });
+        QTRY_VERIFY(cache.isStale("list"));
+        QCOMPARE(cache.get<QString>("str"), "hello");
+    }
+
+    void decodedValues()
+    {
+        DBusTest::TestService<StoreService> service(*dbus);
+        service.sync([](auto s) { s->store.setValue("map", QVariantMap{{"a", 1}, {"b", "two"}}); });
+        const DBusWrapper::Target target(dbus->client(), testService, storePath, testInterface);
+        DBusWrapper::PropertyCache cache(target);
+        QTRY_VERIFY(cache.isAvailable());
+
+        // Complex values stay marshalled until they're read as their type
+        QCOMPARE(cache.get("map").userType(), qMetaTypeId<QDBusArgument>());
+        const auto map = cache.get<QVariantMap>("map");
+        QCOMPARE(map, (QVariantMap{{"a", 1}, {"b", "two"}}));
+        QCOMPARE(cache.get("map", qMetaTypeId<QStringList>()).userType(), qMetaTypeId<QDBusArgument>());
+
+        // The decoded value is shared by every reader until the property changes
+        DBusWrapper::PropertyCache other(target);
+        QVERIFY(other.initialize());
+        QVERIFY(other.get<QVariantMap>(DBusWrapper::PropertyCache::handle("map")).isSharedWith(map));
+        DBusWrapper::PropertySnapshotReader reader(target);
+        service.invoke([](auto s) { s->store.setValue("map", QVariantMap{{"a", 2}}); });
+        QTRY_COMPARE(cache.get<QVariantMap>("map"), (QVariantMap{{"a", 2}}));
+        const auto changed = cache.get<QVariantMap>("map");
+        QVERIFY(!changed.isSharedWith(map));
+
+        // Older snapshots never see a value decoded for a newer one
+        QCOMPARE(reader.get<QVariantMap>("map"), (QVariantMap{{"a", 1}, {"b", "two"}}));
+        QVERIFY(reader.update());
+        QVERIFY(reader.get<QVariantMap>("map").isSharedWith(changed));
+
+        // Changes to other properties keep the decoded value
+        service.invoke([](auto s) { s->store.setValue("str", "other"); });
+        QTRY_COMPARE(cache.get<QString>("str"), "other");
+        QVERIFY(cache.get<QVariantMap>("map").isSharedWith(changed));
+    }
+
+    void compactStorage()
+    {
+        // Maps keep QVariantMap's order, and names come from the interned property names
+        const QString name = QStringLiteral("b").append(QStringLiteral("name"));
+        auto map = DBusWrapper::PropertyMap::fromVariantMap({{name, 1}, {"a", "x"}});
+        QCOMPARE(map.keys(), (QStringList{"a", "bname"}));
+        QCOMPARE(map.constFind("bname").key().constData(), DBusWrapper::PropertyHandle("bname").name().constData());
+        QVERIFY(map.constFind("bname").key().constData() != name.constData());
+        map.insert("c", 3.5);
+        map.insert("a", "y");
+        map.remove("bname");
+        map.remove("missing");
+        QCOMPARE(map.toVariantMap(), (QVariantMap{{"a", "y"}, {"c", 3.5}}));
+        QVERIFY(!map.contains("bname"));
+        QCOMPARE(map.value("missing"), QVariant());
+        auto copy = map;
+        QCOMPARE(copy, map);
+        copy.insert("c", 4);
+        QVERIFY(copy != map);
+        QCOMPARE(map.value("c"), QVariant(3.5));
+
+        // Every target of an interface shares the names of its properties
+        DBusTest::LoadService::Profile profile;
+        profile.paths = 2;
+        profile.properties = 3;
+        DBusTest::TestService<DBusTest::LoadService> load(*dbus, [=](auto bus) {
+            return new DBusTest::LoadService(bus, profile);
+        });
+        QVector<DBusWrapper::Target> targets;
+        std::vector<std::unique_ptr<DBusWrapper::PropertyCache>> caches;
+        for (int i = 0; i < profile.paths; i++) {
+            targets.append(DBusWrapper::Target(dbus->client(), profile.service, QStringLiteral("/load/%1").arg(i),
+                                               profile.interface));
+            caches.push_back(std::make_unique<DBusWrapper::PropertyCache>(targets.last()));
+        }
+        for (const auto& cache : caches)
+            QTRY_VERIFY(cache->isAvailable());
+        QCOMPARE(caches[0]->getAll().size(), profile.properties);
+        QVector<const QChar*> names;
+        for (const auto& target : targets) {
+            auto backend = DBusWrapper::PropertyCacheBackend::instance(target);
+            QMutexLocker lock(&backend->m_dataMutex);
+            names.append(backend->m_snapshot->properties.constBegin().key().constData());
+        }
+        QCOMPARE(names[0], names[1]);
+    }
+
+    void propertyHandles()
+    {
+        auto str = DBusWrapper::PropertyCache::handle("str");
+        QVERIFY(str.isValid());
+        QCOMPARE(str.name(), "str");
+        QCOMPARE(str, DBusWrapper::PropertyHandle("str"));
+        QVERIFY(str != DBusWrapper::PropertyCache::handle("variant"));
+        QVERIFY(!DBusWrapper::PropertyHandle().isValid());
+
+        DBusTest::TestService<PropertyService> service(*dbus);
+        DBusWrapper::PropertyCache cache(dbus->client(), testService, testPath, testInterface);
+        QVERIFY(!cache.get(str).isValid());
+        QTRY_VERIFY(cache.isAvailable());
+        QVERIFY(cache.contains(str));
+        QCOMPARE(cache.get<QString>(str), "hello");
+        QVERIFY(!cache.contains(DBusWrapper::PropertyCache::handle("missing")));
+
+        // Cached lookups must follow changes, and the change signal carries the handle
+        QSignalSpy handleSpy(&cache, &DBusWrapper::PropertyCache::propertyHandleChanged);
+        service.invoke([](auto s) { s->setStr("changed"); });
+        QTRY_COMPARE(handleSpy.count(), 1);
+        QCOMPARE(handleSpy[0][0].value<DBusWrapper::PropertyHandle>(), str);
+        QCOMPARE(handleSpy[0][1], QVariant("changed"));
+        QCOMPARE(cache.get<QString>(str), "changed");
+    }
+
+    void typedPropertyCache()
+    {
+        using Schema = PropertyServiceSchema;
+        DBusTest::TestService<PropertyService> service(*dbus);
+        DBusWrapper::TypedPropertyCache<Schema> typed(DBusWrapper::Target(dbus->client(), testService, testPath, testInterface));
+        QVERIFY(!typed.isValid<Schema::Str>());
+        QVERIFY(typed.get<Schema::Str>().isEmpty());
+
+        QTRY_VERIFY(typed.cache().isAvailable());
+        QCOMPARE(typed.get<Schema::Str>(), "hello");
+        QVERIFY(typed.isValid<Schema::Str>());
+        QCOMPARE(std::get<0>(typed.values()), "hello");
+
+        // A type mismatch is reported once per change and returns the default value
+        QTest::ignoreMessage(QtWarningMsg, QRegularExpression("property str .* has signature \"s\" instead of i"));
+        QCOMPARE(typed.get<Schema::StrAsInt>(), 0);
+        QVERIFY(!typed.isValid<Schema::StrAsInt>());
+        QCOMPARE(typed.get<Schema::StrAsInt>(), 0);
+
+        QStringList changes;
+        typed.onChanged<Schema::Str>(this, [&](const QString& value) {
+            // The typed value is consistent with the cache during signals
+            QCOMPARE(value, typed.cache().get<QString>("str"));
+            changes << value;
+        });
+        service.invoke([](auto s) { s->setStr("typed"); });
+        QTRY_COMPARE(changes, QStringList{"typed"});
+        QCOMPARE(typed.get<Schema::Str>(), "typed");
+    }
+
+    void propertyChangeRouting()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        DBusWrapper::PropertyCache cache(dbus->client(), testService, testPath, testInterface);
+        QTRY_VERIFY(cache.isAvailable());
+        QSignalSpy changeSpy(&cache, &DBusWrapper::PropertyCache::propertyChanged);
+
+        // Changes for other paths and interfaces of the same service must not reach this cache
+        service.invoke([](auto s) {
+            DBusWrapper::emitPropertiesChanged(s->m_bus, "/other/path", testInterface, "str", "wrong path");
+            DBusWrapper::emitPropertiesChanged(s->m_bus, testPath, "other.interface", "str", "wrong interface");
+            s->setStr("right");
+        });
+        QTRY_COMPARE(changeSpy.count(), 1);
+        QCOMPARE(changeSpy[0][1], QVariant("right"));
+        QCOMPARE(cache.get<QString>("str"), "right");
+    }
+
+    void invalidatedProperties()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        DBusWrapper::PropertyCache cache(target);
+        QTRY_VERIFY(cache.isAvailable());
+        QSignalSpy changeSpy(&cache, &DBusWrapper::PropertyCache::propertyChanged);
+
+        // Invalidated properties are fetched again immediately by default
+        service.invoke([](auto s) { s->invalidateStr("fetched"); });
+        QTRY_COMPARE(changeSpy.count(), 1);
+        QCOMPARE(changeSpy[0][1], QVariant("fetched"));
+        QVERIFY(!cache.isStale("str"));
+        service.sync([](auto s) { QCOMPARE(s->strGetCount, 2); });
+
+        // Lazy properties are only fetched when they're read
+        DBusWrapper::PropertyCache::setLazyProperties(target, {"str"});
+        service.invoke([](auto s) { s->invalidateStr("lazy"); });
+        QTRY_VERIFY(cache.isStale("str"));
+        QTest::qWait(50);
+        service.sync([](auto s) { QCOMPARE(s->strGetCount, 2); });
+        QCOMPARE(changeSpy.count(), 1);
+        QCOMPARE(cache.get<QString>("str"), "fetched");
+        QTRY_COMPARE(cache.get<QString>("str"), "lazy");
+        QVERIFY(!cache.isStale("str"));
+        QCOMPARE(changeSpy.count(), 2);
+        service.sync([](auto s) { QCOMPARE(s->strGetCount, 3); });
+        DBusWrapper::PropertyCache::setLazyProperties(target, {});
+    }
+
     void propertyChangeSignalAtomic()
     {
         DBusTest::TestService<PropertyService> service(*dbus);
@@ -340,6 +1157,74 @@ private slots:
         QTRY_COMPARE(count, 2);
     }
 
+    void coalescedChanges()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        auto policy = DBusWrapper::CoalescingPolicy::interval(500);
+        DBusWrapper::PropertyCache cache(DBusWrapper::Target(dbus->client(), testService, testPath, testInterface), policy);
+        QCOMPARE(cache.coalescing(), policy);
+        QVERIFY(!DBusWrapper::CoalescingPolicy().isEnabled());
+        QTRY_VERIFY(cache.isAvailable());
+
+        // Rapid changes are merged; intermediate values may be skipped, but the cache is always consistent
+        QStringList values;
+        connect(&cache, &DBusWrapper::PropertyCache::propertyChanged, [&](auto property, auto value) {
+            QCOMPARE(cache.get(property), value);
+            if (property == "str")
+                values << value.toString();
+        });
+        service.invoke([](auto s) { s->setStr("one"); s->setStr("two"); s->setStr("three"); });
+        QTRY_COMPARE(cache.get<QString>("str"), "three");
+        QVERIFY(!values.isEmpty() && values.size() <= 2);
+        QCOMPARE(values.last(), "three");
+
+        // Changes that return to the delivered value within an interval don't emit signals
+        values.clear();
+        service.invoke([](auto s) { s->setStr("four"); s->setStr("three"); s->setVariant(1); });
+        QTRY_COMPARE(cache.get("variant"), 1);
+        QCOMPARE(values, QStringList());
+        QCOMPARE(cache.get<QString>("str"), "three");
+    }
+
+    void watchedProperties()
+    {
+        using DBusWrapper::PropertyCache;
+        DBusTest::TestService<PropertyService> service(*dbus);
+        service.sync([](auto s) { s->setVariant(0); });
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        PropertyCache all(target);
+        PropertyCache watching(target, {"variant", "variant"});
+        QCOMPARE(watching.watchedProperties(), QStringList{"variant"});
+        QVERIFY(all.watchedProperties().isEmpty());
+        QTRY_VERIFY(all.isAvailable() && watching.isAvailable());
+        QVERIFY(all.contains("str"));
+        QVERIFY(!watching.contains("str"));
+        QCOMPARE(watching.getAll().keys(), QStringList{"variant"});
+
+        // Changes of other properties are dropped before they reach the thread
+        QSignalSpy spyChanged(&watching, &PropertyCache::propertyChanged);
+        const auto before = PropertyCache::statistics(target);
+        service.invoke([](auto s) { s->setStr("one"); s->setStr("two"); });
+        QTRY_COMPARE(all.get<QString>("str"), "two");
+        QTRY_COMPARE(PropertyCache::statistics(target).queuedDeliveries, quint64(0));
+        QCOMPARE(spyChanged.count(), 0);
+        QVERIFY(!watching.get("str").isValid());
+        QVERIFY(!watching.get(PropertyCache::handle("str")).isValid());
+
+        // Only the watched property of a mixed change is signalled
+        service.invoke([](auto s) { s->setBoth(1, "three"); });
+        QTRY_COMPARE(watching.get("variant"), QVariant(1));
+        QCOMPARE(spyChanged.count(), 1);
+        QCOMPARE(spyChanged.at(0).at(0).toString(), "variant");
+        QCOMPARE(all.get<QString>("str"), "three");
+
+        // Dropped snapshots still count as delivered
+        QTRY_COMPARE(PropertyCache::statistics(target).queuedDeliveries, quint64(0));
+        const auto after = PropertyCache::statistics(target);
+        QCOMPARE(after.snapshotsPublished, before.snapshotsPublished + 3);
+        QCOMPARE(after.snapshotsDelivered, before.snapshotsDelivered + 6);
+    }
+
     void setProperty()
     {
         DBusTest::TestService<PropertyService> service(*dbus);
@@ -348,11 +1233,38 @@ private slots:
 
         // Warning should be printed if the call fails
         QTest::ignoreMessage(QtWarningMsg, QRegularExpression("failed to set property \"invalid\""));
-        cache.set("invalid", "invalid");
+        auto failed = cache.set("invalid", "invalid");
+        QVERIFY(!failed->isFinished());
+        QSignalSpy failedSpy(failed.get(), &DBusWrapper::PendingSet::finished);
+        QTRY_VERIFY(failed->isFinished());
+        QVERIFY(failed->isError());
+        QCOMPARE(failedSpy.count(), 1);
 
         // Asynchronously call the DBus Set method, wait for the property to actually change
-        cache.set("str", "I did it");
+        auto result = cache.set("str", "I did it");
         QTRY_COMPARE(cache.get<QString>("str"), "I did it");
+        QTRY_VERIFY(result->isFinished());
+        QVERIFY(!result->isError());
+        QCOMPARE(result->value(), QVariant("I did it"));
+    }
+
+    void setPropertyCoalesced()
+    {
+        DBusTest::TestService<PropertyService> service(*dbus);
+        DBusWrapper::PropertyCache cache(dbus->client(), testService, testPath, testInterface);
+        QTRY_VERIFY(cache.isAvailable());
+
+        // The first write is sent immediately, and the rest are replaced by the latest value while it's in flight
+        QVector<QSharedPointer<DBusWrapper::PendingSet>> results;
+        for (int i = 0; i < 10; i++)
+            results.append(cache.set("str", QString::number(i), DBusWrapper::PropertyCache::SetMode::Coalesced));
+        QTRY_VERIFY(results.last()->isFinished());
+        for (const auto& result : results) {
+            QVERIFY(result->isFinished());
+            QVERIFY(!result->isError());
+        }
+        QTRY_COMPARE(cache.get<QString>("str"), "9");
+        service.sync([](auto s) { QCOMPARE(s->strSetCount, 2); });
     }
 
     void moveToThread()
@@ -402,6 +1314,224 @@ private slots:
         QCOMPARE(changeSpy.count(), cache.getAll().count());
     }
 
+    void reloadBackoff()
+    {
+        using DBusWrapper::PropertyCache;
+        const auto defaults = PropertyCache::reloadPolicy();
+        auto policy = defaults;
+        policy.initialBackoff = 300;
+        policy.jitter = 0;
+        PropertyCache::setReloadPolicy(policy);
+
+        DBusTest::TestService<PropertyService> service(*dbus, [](auto bus) -> auto {
+            return new PropertyService(bus, PropertyService::InitMode::NoRegisterObject);
+        });
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        PropertyCache cache(target);
+        QTRY_COMPARE(cache.error().type(), QDBusError::UnknownObject);
+        const quint64 loads = PropertyCache::statistics(target).loads;
+
+        // Signals from a target that failed to load are merged into one load after the backoff
+        service.invoke([](auto s) {
+            for (int i = 0; i < 3; i++)
+                DBusWrapper::emitPropertiesChanged(s->m_bus, testPath, testInterface, "str", i);
+        });
+        QTest::qWait(150);
+        QCOMPARE(PropertyCache::statistics(target).loads, loads);
+        QTRY_COMPARE(PropertyCache::statistics(target).loads, loads + 1);
+        QTest::qWait(100);
+        QCOMPARE(PropertyCache::statistics(target).loads, loads + 1);
+
+        // The next failure backs off for longer, and a successful load stops backing off
+        QTRY_COMPARE(PropertyCache::statistics(target).loadErrors, quint64(2));
+        service.invoke([](auto s) {
+            s->registerObject();
+            DBusWrapper::emitPropertiesChanged(s->m_bus, testPath, testInterface, "str", "ready");
+        });
+        QTest::qWait(400);
+        QVERIFY(!cache.isAvailable());
+        QTRY_VERIFY(cache.isAvailable());
+        QCOMPARE(PropertyCache::statistics(target).loads, loads + 2);
+
+        PropertyCache::setReloadPolicy(defaults);
+        QCOMPARE(PropertyCache::reloadPolicy().initialBackoff, defaults.initialBackoff);
+    }
+
+    void serviceOwnerTracking()
+    {
+        using DBusWrapper::PropertyCache;
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        const DBusWrapper::Target other = target.withInterface("test.other");
+        PropertyCache cache(target);
+        QTRY_COMPARE(cache.error().type(), QDBusError::ServiceUnknown);
+        QCOMPARE(PropertyCache::statistics(target).loads, quint64(1));
+
+        // Once the service is known to be absent, new targets don't call it
+        PropertyCache otherCache(other);
+        QTRY_COMPARE(otherCache.error().type(), QDBusError::ServiceUnknown);
+        QCOMPARE(PropertyCache::statistics(other).loads, quint64(0));
+
+        // Every target of the service follows the same owner changes
+        {
+            DBusTest::TestService<PropertyService> service(*dbus);
+            QTRY_VERIFY(cache.isAvailable());
+            QTRY_COMPARE(otherCache.error().type(), QDBusError::UnknownInterface);
+            QCOMPARE(PropertyCache::statistics(other).loads, quint64(1));
+        }
+        QTRY_COMPARE(cache.error().type(), QDBusError::ServiceUnknown);
+        QTRY_COMPARE(otherCache.error().type(), QDBusError::ServiceUnknown);
+        QVERIFY(!cache.isAvailable());
+    }
+
+    void objectManager()
+    {
+        DBusWrapper::PropertyCache::setObjectManager(dbus->client(), testService, "/");
+        DBusTest::TestService<ObjectManagerService> service(*dbus);
+
+        std::vector<std::unique_ptr<DBusWrapper::PropertyCache>> caches;
+        for (int i = 0; i < 3; i++) {
+            caches.push_back(std::make_unique<DBusWrapper::PropertyCache>(dbus->client(), testService,
+                                                                          QString("/test/path/%1").arg(i), testInterface));
+        }
+        for (int i = 0; i < 3; i++) {
+            QTRY_VERIFY(caches[i]->isAvailable());
+            QCOMPARE(caches[i]->get<QString>("str"), QString("hello %1").arg(i));
+        }
+        // All caches should be loaded by a single call
+        service.sync([](auto s) { QCOMPARE(s->getManagedObjectsCount, 1); });
+
+        // Objects that don't exist are unavailable until the service adds them
+        DBusWrapper::PropertyCache added(dbus->client(), testService, "/test/path/added", testInterface);
+        QTRY_COMPARE(added.error().type(), QDBusError::UnknownObject);
+        service.invoke([](auto s) { s->addInterface("/test/path/added", testInterface, {{"str", "added"}}); });
+        QTRY_VERIFY(added.isAvailable());
+        QCOMPARE(added.get<QString>("str"), "added");
+
+        service.invoke([](auto s) { s->removeInterface("/test/path/added", testInterface); });
+        QTRY_VERIFY(!added.isAvailable());
+        QCOMPARE(added.error().type(), QDBusError::UnknownInterface);
+        QVERIFY(!added.contains("str"));
+
+        DBusWrapper::PropertyCache::setObjectManager(dbus->client(), testService, QString());
+    }
+
+    void objectManagerFallbackStatistics()
+    {
+        // A service without an ObjectManager falls back to GetAll within the same load
+        DBusWrapper::PropertyCache::setObjectManager(dbus->client(), testService, "/");
+        DBusTest::TestService<PropertyService> service(*dbus);
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        DBusWrapper::PropertyCache cache(target);
+        QTRY_VERIFY(cache.isAvailable());
+        const auto stats = DBusWrapper::PropertyCache::statistics(target);
+        QCOMPARE(stats.loads, quint64(1));
+        QCOMPARE(stats.retries, quint64(0));
+        QCOMPARE(stats.loadErrors, quint64(0));
+        QCOMPARE(std::accumulate(stats.loadLatency.constBegin(), stats.loadLatency.constEnd(), quint64(0)), quint64(1));
+
+        DBusWrapper::PropertyCache::setObjectManager(dbus->client(), testService, QString());
+    }
+
+    void resetChanges()
+    {
+        DBusWrapper::PropertyCache::setObjectManager(dbus->client(), testService, "/");
+        DBusTest::TestService<ObjectManagerService> service(*dbus);
+        DBusWrapper::PropertyCache cache(dbus->client(), testService, "/test/path/0", testInterface);
+        QTRY_VERIFY(cache.isAvailable());
+
+        // Only properties that differ from the previous values are signalled after a reset
+        QVariantMap changes;
+        connect(&cache, &DBusWrapper::PropertyCache::propertyChanged, [&](auto property, auto value) {
+            changes.insert(property, value);
+        });
+        QSignalSpy spyReset(&cache, &DBusWrapper::PropertyCache::propertiesReset);
+        service.invoke([](auto s) { s->addInterface("/test/path/0", testInterface, {{"str", "hello 0"}, {"extra", 1}}); });
+        QTRY_COMPARE(spyReset.count(), 1);
+        QCOMPARE(changes, (QVariantMap{{"extra", 1}}));
+
+        changes.clear();
+        service.invoke([](auto s) { s->addInterface("/test/path/0", testInterface, {{"extra", 2}}); });
+        QTRY_COMPARE(spyReset.count(), 2);
+        QCOMPARE(changes, (QVariantMap{{"extra", 2}, {"str", QVariant()}}));
+        QVERIFY(!cache.contains("str"));
+
+        DBusWrapper::PropertyCache::setObjectManager(dbus->client(), testService, QString());
+    }
+
+    void snapshotStore()
+    {
+        using DBusWrapper::PropertyCache;
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString fileName = dir.filePath("properties");
+        const DBusWrapper::Target target(dbus->client(), testService, "/test/path/0", testInterface);
+        PropertyCache::setObjectManager(dbus->client(), testService, "/");
+        PropertyCache::setSnapshotStore(fileName);
+        {
+            DBusTest::TestService<ObjectManagerService> service(*dbus);
+            PropertyCache cache(target);
+            QTRY_VERIFY(cache.isAvailable());
+            QVERIFY(!cache.isRevalidating());
+        }
+
+        // Write the file and open it again, as a new process would
+        PropertyCache::setSnapshotStore(QString());
+        QVERIFY(QFile::exists(fileName));
+        DBusWrapper::PropertyCacheBackend::test_clearCache();
+        PropertyCache::setSnapshotStore(fileName);
+
+        // Stored properties are available immediately, even though the service isn't running
+        PropertyCache cache(target);
+        QVERIFY(cache.initialize());
+        QVERIFY(cache.isAvailable());
+        QVERIFY(cache.isRevalidating());
+        QCOMPARE(cache.get<QString>("str"), "hello 0");
+
+        // Once the service starts, only differences are signalled instead of a reset
+        QSignalSpy resetSpy(&cache, &PropertyCache::propertiesReset);
+        QSignalSpy changeSpy(&cache, &PropertyCache::propertyChanged);
+        QSignalSpy revalidatedSpy(&cache, &PropertyCache::revalidated);
+        DBusTest::TestService<ObjectManagerService> service(*dbus);
+        QTRY_COMPARE(revalidatedSpy.count(), 1);
+        QVERIFY(!cache.isRevalidating());
+        QVERIFY(cache.isAvailable());
+        QCOMPARE(resetSpy.count(), 0);
+        QCOMPARE(changeSpy.count(), 0);
+        QCOMPARE(cache.get<QString>("str"), "hello 0");
+
+        PropertyCache::setSnapshotStore(QString());
+        PropertyCache::setObjectManager(dbus->client(), testService, QString());
+    }
+
+    void snapshotStoreChanges()
+    {
+        using DBusWrapper::PropertyCache;
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString fileName = dir.filePath("properties");
+        const DBusWrapper::Target target(dbus->client(), testService, testPath, testInterface);
+        PropertyCache::setSnapshotStore(fileName);
+        {
+            DBusTest::TestService<PropertyService> service(*dbus);
+            PropertyCache cache(target);
+            QTRY_VERIFY(cache.isAvailable());
+            service.invoke([](auto s) { s->setStr("one"); s->setStr("two"); });
+            QTRY_COMPARE(cache.get<QString>("str"), "two");
+        }
+
+        PropertyCache::setSnapshotStore(QString());
+        DBusWrapper::PropertyCacheBackend::test_clearCache();
+        PropertyCache::setSnapshotStore(fileName);
+
+        // Changes are merged into the stored properties
+        PropertyCache cache(target);
+        QVERIFY(cache.initialize());
+        QVERIFY(cache.isRevalidating());
+        QCOMPARE(cache.get<QString>("str"), "two");
+
+        PropertyCache::setSnapshotStore(QString());
+    }
+
 private:
     enum InitializationMode
     {
@@ -1,6 +1,12 @@
 #include <QTest>
+#include <QDBusMetaType>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include "dbustarget.h"
 #include "testbus.h"
+#include "testservice.h"
 
 static const QString testService = QStringLiteral("test.service");
 static const QString testPath = QStringLiteral("/test/path");
@@ -8,6 +14,49 @@ static const QString testInterface = QStringLiteral("test.interface");
 
 using namespace DBusWrapper;
 
+using Counts = QMap<QString, int>;
+Q_DECLARE_METATYPE(Counts)
+
+class MethodService : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "test.interface")
+
+public:
+    QDBusConnection m_bus;
+    int callCount = 0;
+
+    MethodService(const QDBusConnection& bus, QObject* parent = nullptr)
+        : QObject(parent), m_bus(bus)
+    {
+        m_bus.registerObject(testPath, this, QDBusConnection::ExportScriptableSlots);
+        m_bus.registerService(testService);
+    }
+    ~MethodService() {
+        m_bus.unregisterService(testService);
+        m_bus.unregisterObject(testPath);
+    }
+
+public slots:
+    Q_SCRIPTABLE int Add(int a, int b)
+    {
+        callCount++;
+        return a + b;
+    }
+    Q_SCRIPTABLE void Ping()
+    {
+        callCount++;
+    }
+    Q_SCRIPTABLE Counts Count(const QStringList& words)
+    {
+        callCount++;
+        Counts counts;
+        for (const auto& word : words)
+            counts[word]++;
+        return counts;
+    }
+};
+
 class TestTarget : public QObject
 {
     Q_OBJECT
@@ -86,6 +135,91 @@ private slots:
         QCOMPARE(arg.value<QDBusVariant>().variant(), QVariant(1));
     }
 
+    void callAsync()
+    {
+        qDBusRegisterMetaType<Counts>();
+        DBusTest::TestBus dbus;
+        QVERIFY(dbus.isValid());
+        DBusTest::TestService<MethodService> service(dbus);
+        Target test(dbus.client(), testService, testPath, testInterface);
+
+        auto sum = test.callAsync<int>("Add", 2, 3);
+        QVERIFY(sum.isValid());
+        QVERIFY(!sum.isFinished());
+        QCOMPARE(sum.call()->method(), "Add");
+        QTRY_VERIFY(sum.isFinished());
+        QVERIFY(!sum.isError());
+        QCOMPARE(sum.value(), 5);
+
+        // Complex types are demarshalled before the reply finishes
+        auto counts = test.callAsync<Counts>("Count", QStringList{"a", "b", "a"});
+        bool called = false;
+        counts.then(this, [&](const PendingReply<Counts>& reply) {
+            called = true;
+            QVERIFY(reply.isFinished());
+            QCOMPARE(reply.value(), (Counts{{"a", 2}, {"b", 1}}));
+        });
+        QTRY_VERIFY(called);
+        QVERIFY(!counts.isError());
+
+        // then() on a finished reply is called from the event loop
+        called = false;
+        counts.then(this, [&](const PendingReply<Counts>&) { called = true; });
+        QVERIFY(!called);
+        QTRY_VERIFY(called);
+
+        auto ping = test.callAsync("Ping");
+        QTRY_VERIFY(ping.isFinished());
+        QVERIFY(!ping.isError());
+
+        // Errors from the service, and replies of the wrong type
+        auto missing = test.callAsync<int>("Missing");
+        QTRY_VERIFY(missing.isFinished());
+        QVERIFY(missing.isError());
+        QCOMPARE(missing.error().type(), QDBusError::UnknownMethod);
+        QCOMPARE(missing.value(), 0);
+        auto wrongType = test.callAsync<QStringList>("Add", 2, 3);
+        QTRY_VERIFY(wrongType.isFinished());
+        QCOMPARE(wrongType.error().type(), QDBusError::InvalidSignature);
+
+        // The call finishes without any reference to it
+        auto callCount = [&] {
+            int count = 0;
+            service.sync([&](auto s) { count = s->callCount; });
+            return count;
+        };
+        QCOMPARE(callCount(), 4);
+        test.callAsync("Ping");
+        QTRY_COMPARE(callCount(), 5);
+    }
+
+    void callAsyncBatch()
+    {
+        DBusTest::TestBus dbus;
+        QVERIFY(dbus.isValid());
+        DBusTest::TestService<MethodService> service(dbus);
+        Target test(dbus.client(), testService, testPath, testInterface);
+
+        QVERIFY(test.callAsync<int>(QVector<QDBusMessage>()).isEmpty());
+
+        QVector<QDBusMessage> calls;
+        for (int i = 0; i < 50; i++)
+            calls.append(test.createMethodCall("Add", i, 1));
+        calls.append(test.withPath("/missing/path").createMethodCall("Add", 0, 0));
+        const auto replies = test.callAsync<int>(calls);
+        QCOMPARE(replies.size(), calls.size());
+
+        int finished = 0;
+        for (const auto& reply : replies)
+            reply.then(this, [&finished](const PendingReply<int>&) { finished++; });
+        QTRY_COMPARE(finished, replies.size());
+        for (int i = 0; i < 50; i++) {
+            QVERIFY(!replies[i].isError());
+            QCOMPARE(replies[i].value(), i + 1);
+        }
+        QVERIFY(replies.last().isError());
+    }
+
     void move()
     {
         Target test(testService, testPath, testInterface);
@@ -122,6 +256,62 @@ private slots:
         QVERIFY(base != qHash(test3, 0));
     }
 
+    void identity()
+    {
+        // Targets built separately are equal and hash equally, including after every earlier copy is destroyed
+        uint hash = 0;
+        {
+            Target test(testService, testPath, testInterface);
+            hash = qHash(test);
+            Target copy = test;
+            QCOMPARE(copy, Target(QDBusConnection::sessionBus(), testService, testPath, testInterface));
+            QCOMPARE(qHash(copy), hash);
+            copy = Target();
+            QVERIFY(!copy.isValid());
+            QCOMPARE(test.withPath("/other/path").withPath(testPath), test);
+        }
+        Target test(testService, testPath, testInterface);
+        QCOMPARE(qHash(test), hash);
+        QCOMPARE(test.service(), testService);
+        QCOMPARE(Target(QDBusConnection(QString()), "", "", ""), Target());
+
+        // Threads creating and destroying the same targets concurrently always agree
+        std::vector<std::unique_ptr<QThread>> threads;
+        std::atomic<int> mismatches{0};
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back(QThread::create([&] {
+                for (int j = 0; j < 2000; j++) {
+                    Target other(testService, QStringLiteral("/test/%1").arg(j % 10), testInterface);
+                    if (other != Target(testService, other.path(), testInterface) || other.withPath(testPath) != test)
+                        mismatches++;
+                }
+            }));
+            threads.back()->start();
+        }
+        for (const auto& thread : threads)
+            QVERIFY(thread->wait(10000));
+        QCOMPARE(mismatches.load(), 0);
+    }
+
+    void identityReconnected()
+    {
+        // A connection reopened under the same name gets new targets, rather than the identity of the closed one
+        DBusTest::TestBus dbus;
+        QVERIFY(dbus.isValid());
+        const QString name = QStringLiteral("reopened");
+        const Target closed(QDBusConnection::connectToBus(dbus.busAddress(), name), testService, testPath, testInterface);
+        QDBusConnection::disconnectFromBus(name);
+        QVERIFY(!closed.bus().isConnected());
+
+        const QDBusConnection bus = QDBusConnection::connectToBus(dbus.busAddress(), name);
+        QVERIFY(bus.isConnected());
+        const Target reopened(bus, testService, testPath, testInterface);
+        QVERIFY(reopened.bus().isConnected());
+        QVERIFY(reopened != closed);
+        QCOMPARE(reopened, Target(bus, testService, testPath, testInterface));
+        QDBusConnection::disconnectFromBus(name);
+    }
+
     void qdebug()
     {
         Target invalid;